@@ -18,6 +18,7 @@ TEST_CASE("Time series operations", "[write, query, getMetrics, aggregates, dele
         point.value = 75.5;
 
         db->write(point);
+        db->flush();
 
         std::vector<waffledb::TimePoint> results = db->query(
             "cpu.usage",
@@ -58,6 +59,7 @@ TEST_CASE("Time series operations", "[write, query, getMetrics, aggregates, dele
 
         // Write batch to database
         db->writeBatch(points);
+        db->flush();
 
         // Query all points
         std::vector<waffledb::TimePoint> results = db->query(
@@ -92,6 +94,7 @@ TEST_CASE("Time series operations", "[write, query, getMetrics, aggregates, dele
         // Write points to database
         db->write(point1);
         db->write(point2);
+        db->flush();
 
         // Query with tag filter
         std::unordered_map<std::string, std::string> tags;
@@ -134,6 +137,7 @@ TEST_CASE("Time series operations", "[write, query, getMetrics, aggregates, dele
         db->write(point1);
         db->write(point2);
         db->write(point3);
+        db->flush();
 
         // Query last hour
         std::vector<waffledb::TimePoint> results = db->query(
@@ -224,6 +228,7 @@ TEST_CASE("Time series operations", "[write, query, getMetrics, aggregates, dele
         db->write(p2);
         db->write(p3);
         db->write(p4);
+        db->flush();
 
         uint64_t startTime = now - 100;
         uint64_t endTime = now + 10;
@@ -252,6 +257,7 @@ TEST_CASE("Time series operations", "[write, query, getMetrics, aggregates, dele
         p5.value = 100.0;
         p5.tags["host"] = "special";
         db->write(p5);
+        db->flush();
 
         std::unordered_map<std::string, std::string> tags;
         tags["host"] = "special";
@@ -8,42 +8,124 @@
 #include <unordered_set>
 #include <string>
 #include <mutex>
+#include <memory>
+#include <functional>
+#include <cstdint>
+#include "roaring_bitmap.h"
 
 namespace waffledb
 {
 
+    // Memory the materialized per-pattern structures may use by default
+    constexpr size_t ADAPTIVE_INDEX_BUDGET = 16 * 1024 * 1024;
+
+    // A (metric, tag set) pattern is materialized once its decayed query
+    // count reaches this; patterns decay by half every ADAPTIVE_DECAY_INTERVAL
+    // queries and are dropped again once they cool below one query
+    constexpr double HOT_PATTERN_QUERIES = 4.0;
+    constexpr size_t ADAPTIVE_DECAY_INTERVAL = 1024;
+
+    struct AdaptivePatternStats
+    {
+        std::string metric;
+        std::string tags; // "key=value,..." sorted by key
+        uint64_t queries = 0;
+        uint64_t hits = 0; // queries answered from the materialized list
+        double heat = 0.0; // decayed query count
+        bool materialized = false;
+        size_t bytes = 0;
+    };
+
+    struct AdaptiveIndexStats
+    {
+        uint64_t queries = 0;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        size_t structures = 0; // materialized series lists
+        size_t bytes = 0;
+        size_t budget = 0;
+        std::vector<AdaptivePatternStats> patterns; // hottest first
+    };
+
     // Adaptive indexing for time-series data
     class AdaptiveIndex
     {
+    public:
+        using SeriesList = std::shared_ptr<const RoaringBitmap>;
+
     private:
         struct IndexEntry
         {
             uint64_t minTime;
             uint64_t maxTime;
             size_t chunkId;
+        };
+
+        // Chunks of one metric sorted by minTime. maxPrefix[i] is the
+        // largest maxTime among entries [0, i], so the first entry that can
+        // reach a start time is found by binary search even when chunks of
+        // different series overlap.
+        struct MetricIndex
+        {
+            std::vector<IndexEntry> entries;
+            std::vector<uint64_t> maxPrefix;
+
+            void rebuildPrefix(size_t from);
+        };
+
+        // Observed tag-filtered query pattern and, while it is hot, the
+        // series it selects
+        struct Pattern
+        {
             std::string metric;
-            std::unordered_map<std::string, std::unordered_set<std::string>> tagIndex;
+            std::unordered_map<std::string, std::string> tags;
+            double heat = 0.0;
+            uint64_t queries = 0;
+            uint64_t hits = 0;
+            SeriesList series;
+            size_t generation = 0; // catalog size the list was built for
+            size_t bytes = 0;
         };
 
-        std::vector<IndexEntry> entries_;
+        std::unordered_map<std::string, MetricIndex> metrics_;
+        std::unordered_map<std::string, Pattern> patterns_;
         std::atomic<size_t> queryCount_{0};
-        std::unordered_map<std::string, size_t> queryPatterns_;
+        uint64_t hits_ = 0;
+        uint64_t misses_ = 0;
+        size_t bytes_ = 0;
+        size_t budget_ = ADAPTIVE_INDEX_BUDGET;
         mutable std::mutex mutex_;
 
+        void dropStructure(Pattern &pattern);
+        void enforceBudget();
+        void decay();
+
     public:
         void addChunk(size_t chunkId, const std::string &metric,
-                      uint64_t minTime, uint64_t maxTime,
-                      const std::unordered_map<std::string, std::unordered_set<std::string>> &tags);
+                      uint64_t minTime, uint64_t maxTime);
+        void removeChunk(size_t chunkId, const std::string &metric);
+        void removeMetric(const std::string &metric);
 
+        // Ids of the chunks of metric overlapping [startTime, endTime] in
+        // O(log n + matches), ordered by their first timestamp
         std::vector<size_t> findChunks(const std::string &metric,
-                                       uint64_t startTime, uint64_t endTime,
-                                       const std::unordered_map<std::string, std::string> &tags);
+                                       uint64_t startTime, uint64_t endTime) const;
+
+        // Series selected by tags for a query on metric. Hot patterns are
+        // answered from a materialized list while generation (the catalog
+        // size) is unchanged; otherwise compute() runs, and its result is
+        // kept if the pattern is hot and fits the budget.
+        SeriesList selectSeries(const std::string &metric,
+                                const std::unordered_map<std::string, std::string> &tags,
+                                size_t generation, const std::function<RoaringBitmap()> &compute);
 
-        void recordQuery(const std::string &pattern);
+        // Decays pattern heat and drops cold patterns and structures
         void optimize();
+        void setBudget(size_t bytes);
+        AdaptiveIndexStats stats() const;
         void clear();
     };
 
 } // namespace waffledb
 
-#endif // ADAPTIVE_INDEX_H
\ No newline at end of file
+#endif // ADAPTIVE_INDEX_H
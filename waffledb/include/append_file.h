@@ -0,0 +1,41 @@
+// waffledb/include/append_file.h
+#pragma once
+
+#include <string>
+#include <memory>
+#include <cstdint>
+
+namespace waffledb
+{
+
+    // File descriptor opened for appending. Writes go straight to the OS,
+    // with no user-space buffer; sync() forces them to the disk.
+    class AppendFile
+    {
+    private:
+        std::string path_;
+        int fd_ = -1;
+
+        AppendFile(std::string path, int fd) : path_(std::move(path)), fd_(fd) {}
+
+    public:
+        ~AppendFile();
+
+        AppendFile(const AppendFile &) = delete;
+        AppendFile &operator=(const AppendFile &) = delete;
+
+        // Creates the file if missing; throws if it cannot be opened
+        static std::unique_ptr<AppendFile> open(const std::string &path, bool truncate = false);
+
+        const std::string &path() const { return path_; }
+
+        // Each returns false and leaves errno set on failure
+        bool write(const uint8_t *data, size_t size);
+        bool sync();
+        bool truncate(uint64_t size);
+    };
+
+    // Makes files created, renamed or removed in the directory durable
+    bool syncDirectory(const std::string &path);
+
+} // namespace waffledb
@@ -0,0 +1,45 @@
+// waffledb/include/bloom_filter.h
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+namespace waffledb
+{
+
+    // Bloom filter over the tag key=value pairs of one chunk, about ten bits
+    // per pair for ~1% false positives. Lets tag-filtered queries skip chunks
+    // without reading their bodies. An empty filter admits every pair. Pair
+    // hashes are stable across builds so filters can be persisted.
+    class TagBloomFilter
+    {
+    private:
+        static constexpr uint32_t PROBES = 7;
+        static constexpr size_t BITS_PER_PAIR = 10;
+
+        std::vector<uint64_t> words_;
+
+    public:
+        // Largest filter accepted from disk
+        static constexpr size_t MAX_WORDS = 1 << 16;
+
+        TagBloomFilter() = default;
+        explicit TagBloomFilter(size_t pairs);
+
+        static uint64_t hash(const std::string &key, const std::string &value);
+
+        void add(const std::string &key, const std::string &value) { add(hash(key, value)); }
+        void add(uint64_t pairHash);
+
+        // False only if the pair was never added
+        bool mayContain(uint64_t pairHash) const;
+        bool mayContainAll(const std::unordered_map<std::string, std::string> &tags) const;
+
+        bool empty() const { return words_.empty(); }
+        const std::vector<uint64_t> &words() const { return words_; }
+        void assign(std::vector<uint64_t> words) { words_ = std::move(words); }
+    };
+
+} // namespace waffledb
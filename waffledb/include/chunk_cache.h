@@ -0,0 +1,113 @@
+// waffledb/include/chunk_cache.h
+#pragma once
+
+#include "columnar_storage.h"
+#include <string>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+
+namespace waffledb
+{
+
+    constexpr size_t CHUNK_CACHE_BUDGET = 256ULL << 20; // bytes
+
+    struct ChunkCacheStats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        size_t entries = 0;
+        size_t bytes = 0;
+        size_t budget = 0;
+    };
+
+    // Buffer pool of resident chunk bodies keyed by (metric, chunk id),
+    // bounded by a byte budget and evicted with CLOCK. Chunks fault in
+    // through the loader on a miss. Pinned (handed out) and dirty chunks
+    // are never evicted, so the pool may briefly exceed its budget.
+    class ChunkCache
+    {
+    public:
+        using Loader = std::function<std::unique_ptr<ColumnarChunk>()>;
+
+        // Pins a chunk for as long as the handle is alive
+        class Handle
+        {
+        private:
+            friend class ChunkCache;
+            std::shared_ptr<ColumnarChunk> chunk_;
+
+            explicit Handle(std::shared_ptr<ColumnarChunk> chunk) : chunk_(std::move(chunk)) {}
+
+        public:
+            Handle() = default;
+
+            ColumnarChunk *get() const { return chunk_.get(); }
+            ColumnarChunk *operator->() const { return chunk_.get(); }
+            ColumnarChunk &operator*() const { return *chunk_; }
+            explicit operator bool() const { return chunk_ != nullptr; }
+        };
+
+        explicit ChunkCache(size_t budget = CHUNK_CACHE_BUDGET);
+
+        // Returns a pinned handle to the chunk, loading it on a miss. Empty
+        // if the loader fails.
+        Handle get(const std::string &metric, size_t chunkId, const Loader &load);
+
+        // Dirty chunks stay resident until markClean
+        void insert(const std::string &metric, size_t chunkId, std::unique_ptr<ColumnarChunk> chunk,
+                    bool dirty = false);
+        void markClean(const std::string &metric, size_t chunkId);
+        std::vector<std::pair<std::string, size_t>> dirtyChunks() const;
+
+        void erase(const std::string &metric);
+        void erase(const std::string &metric, size_t chunkId);
+        void clear();
+
+        void setBudget(size_t budget);
+        ChunkCacheStats stats() const;
+
+    private:
+        using Key = std::pair<std::string, size_t>;
+
+        struct KeyHash
+        {
+            size_t operator()(const Key &key) const
+            {
+                return std::hash<std::string>()(key.first) ^ (std::hash<size_t>()(key.second) * 0x9e3779b97f4a7c15ULL);
+            }
+        };
+
+        struct Slot
+        {
+            Key key;
+            std::shared_ptr<ColumnarChunk> chunk; // null when the slot is free
+            size_t bytes = 0;
+            bool referenced = false;
+            bool dirty = false;
+
+            bool pinned() const { return chunk.use_count() > 1; }
+        };
+
+        size_t budget_;
+        size_t bytes_ = 0;
+        size_t hand_ = 0;
+        std::vector<Slot> slots_;
+        std::vector<size_t> freeSlots_;
+        std::unordered_map<Key, size_t, KeyHash> index_;
+
+        uint64_t hits_ = 0;
+        uint64_t misses_ = 0;
+        uint64_t evictions_ = 0;
+
+        mutable std::mutex mutex_;
+
+        std::shared_ptr<ColumnarChunk> insertLocked(const Key &key, std::unique_ptr<ColumnarChunk> chunk, bool dirty);
+        void release(size_t slot);
+        void evict();
+    };
+
+} // namespace waffledb
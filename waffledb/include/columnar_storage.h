@@ -3,39 +3,167 @@
 
 #include "waffledb.h"
 #include "compression.h"
+#include "mapped_file.h"
+#include "series_catalog.h"
+#include "bloom_filter.h"
+#include "segment_file.h"
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
 #include <memory>
 #include <cstdint>
+#include <utility>
+#include <limits>
+#include <map>
+#include <set>
+#include <mutex>
 
 namespace waffledb
 {
 
     constexpr size_t VALUES_PER_CHUNK = 1000;
 
+    // Largest chunk compaction builds; stored chunks may hold up to this many
+    // points, appends still stop at VALUES_PER_CHUNK
+    constexpr size_t VALUES_PER_SEGMENT = 1 << 16;
+
+    // Stored chunks never span a partition, so retention drops whole
+    // partition directories. One day keeps every rollup bucket inside one.
+    constexpr uint64_t PARTITION_SECONDS = 86400;
+
+    inline uint64_t partitionOf(uint64_t timestamp)
+    {
+        return timestamp - timestamp % PARTITION_SECONDS;
+    }
+
+    // Aggregates over every point of a chunk, kept up to date on append and
+    // persisted in the chunk header so full-chunk queries never scan values
+    struct ChunkStats
+    {
+        uint64_t count = 0;
+        double sum = 0.0;
+        double sumSquares = 0.0;
+        double min = std::numeric_limits<double>::max();
+        double max = std::numeric_limits<double>::lowest();
+        double first = 0.0; // value at the minimum timestamp
+        double last = 0.0;  // value at the maximum timestamp
+    };
+
+    // Series ID of a chunk that holds points of more than one series, or
+    // whose series is not known without reading its body
+    constexpr uint32_t MIXED_SERIES = UINT32_MAX;
+
+    // Chunk directory entry: enough to prune a persisted chunk and answer
+    // full-chunk aggregates without reading its body
+    struct ChunkMeta
+    {
+        size_t id = 0;
+        uint64_t minTimestamp = UINT64_MAX;
+        uint64_t maxTimestamp = 0;
+        ChunkStats stats;
+        uint32_t seriesId = MIXED_SERIES;
+        TagBloomFilter tagFilter; // tag pairs of every series in the chunk
+
+        bool overlaps(uint64_t startTime, uint64_t endTime) const
+        {
+            return stats.count > 0 && minTimestamp <= endTime && maxTimestamp >= startTime;
+        }
+
+        bool coveredBy(uint64_t startTime, uint64_t endTime) const
+        {
+            return startTime <= minTimestamp && maxTimestamp <= endTime;
+        }
+    };
+
     class ColumnarChunk
     {
     private:
         std::vector<uint64_t> timestamps_;
         std::vector<double> values_;
-        std::vector<std::unordered_map<std::string, std::string>> tags_;
+
+        // One series ID per point, empty once a chunk of a single series
+        // is sealed; the tag sets live once in the catalog
+        std::vector<uint32_t> seriesIds_;
+        std::shared_ptr<SeriesCatalog> catalog_;
+        uint32_t seriesId_ = MIXED_SERIES; // the only series, if there is one
 
         uint64_t minTimestamp_ = UINT64_MAX;
         uint64_t maxTimestamp_ = 0;
         size_t count_ = 0;
         bool compressed_ = false;
+        ChunkStats stats_;
+
+        // Codec output for sealed chunks; the raw vectors above are released
+        // once this is populated
+        CompressionEngine::CompressedData compressedData_;
+
+        // Encoded column bytes of a sealed chunk. They point into
+        // compressedData_, or zero-copy into mapping_ for chunks read from
+        // an mmap'd file.
+        const uint8_t *timestampBlock_ = nullptr;
+        size_t timestampBlockSize_ = 0;
+        const uint8_t *valueBlock_ = nullptr;
+        size_t valueBlockSize_ = 0;
+        std::shared_ptr<const MappedFile> mapping_;
 
         std::unique_ptr<CompressionEngine> compressor_;
 
+        // Index range covering [startTime, endTime], decodes only timestamps
+        std::pair<size_t, size_t> indexRange(uint64_t startTime, uint64_t endTime) const;
+
+        // Feeds values in [first, last) to fn, streaming from the codec
+        // output where the codec allows it
+        template <typename Fn>
+        void scanValues(size_t first, size_t last, Fn &&fn) const;
+
+        // Columns as plain arrays when no decoding is needed: the live
+        // vectors of a raw chunk or uncompressed blocks of a sealed one
+        const double *plainValues() const;
+        const uint64_t *plainTimestamps() const;
+
+        void bindBlocks();
+        void releaseSeriesIds();
+        void parse(const uint8_t *data, size_t size, std::shared_ptr<const MappedFile> mapping);
+
+        // Aggregates over [first, last), computed on the compressed blocks
+        // where the codec allows it
+        double sumRange(size_t first, size_t last) const;
+        double minRange(size_t first, size_t last) const;
+        double maxRange(size_t first, size_t last) const;
+
         // SIMD optimization methods
-        double sumSIMD(size_t start, size_t end) const;
-        double minSIMD(size_t start, size_t end) const;
-        double maxSIMD(size_t start, size_t end) const;
+        double sumSIMD(const double *data, size_t start, size_t end) const;
+        double minSIMD(const double *data, size_t start, size_t end) const;
+        double maxSIMD(const double *data, size_t start, size_t end) const;
 
     public:
-        ColumnarChunk();
+        // Read-only view over the timestamp and value columns. Raw chunks
+        // alias their live vectors, sealed chunks decode into the view.
+        class ColumnView
+        {
+        private:
+            friend class ColumnarChunk;
+
+            CompressionEngine::DecompressedData decoded_;
+            const uint64_t *timestamps_ = nullptr;
+            const double *values_ = nullptr;
+            size_t count_ = 0;
+
+        public:
+            const uint64_t *timestamps() const { return timestamps_; }
+            const double *values() const { return values_; }
+            size_t size() const { return count_; }
+
+            // Half-open [first, last) index range covering [startTime, endTime]
+            std::pair<size_t, size_t> timeRange(uint64_t startTime, uint64_t endTime) const;
+        };
+
+        // Chunks without a shared catalog keep a private one
+        explicit ColumnarChunk(std::shared_ptr<SeriesCatalog> catalog = nullptr);
         ~ColumnarChunk();
 
+        // Points are kept sorted by timestamp; late ones are inserted in place
+        void append(uint64_t timestamp, double value, uint32_t seriesId);
         void append(uint64_t timestamp, double value,
                     const std::unordered_map<std::string, std::string> &tags);
 
@@ -44,11 +172,37 @@ namespace waffledb
 
         uint64_t getMinTimestamp() const { return minTimestamp_; }
         uint64_t getMaxTimestamp() const { return maxTimestamp_; }
+        const ChunkStats &stats() const { return stats_; }
+        ChunkMeta meta(size_t id) const;
+
+        // Filter over the tag pairs of the chunk's series
+        TagBloomFilter tagFilter() const;
+
+        // True when [startTime, endTime] contains every point of the chunk
+        bool coveredBy(uint64_t startTime, uint64_t endTime) const
+        {
+            return startTime <= minTimestamp_ && maxTimestamp_ <= endTime;
+        }
+
+        bool isCompressed() const { return compressed_; }
+        bool isMapped() const { return mapping_ != nullptr; }
+
+        // Approximate resident footprint: column buffers, codec output,
+        // mapped file and series IDs
+        size_t memoryUsage() const;
 
         // Data access methods
-        const double *getValuesPtr() const { return values_.data(); }
-        const uint64_t *getTimestampsPtr() const { return timestamps_.data(); }
-        const std::vector<std::unordered_map<std::string, std::string>> &getTagsRef() const { return tags_; }
+        ColumnView columns() const;
+        uint32_t seriesIdAt(size_t index) const
+        {
+            return seriesId_ != MIXED_SERIES ? seriesId_ : seriesIds_[index];
+        }
+        uint32_t seriesId() const { return seriesId_; }
+        const SeriesCatalog &catalog() const { return *catalog_; }
+        const std::unordered_map<std::string, std::string> &tagsAt(size_t index) const
+        {
+            return catalog_->tags(seriesIdAt(index));
+        }
 
         // Query methods
         std::vector<size_t> queryTimeRange(uint64_t startTime, uint64_t endTime) const;
@@ -56,35 +210,156 @@ namespace waffledb
             const std::unordered_map<std::string, std::string> &queryTags) const;
 
         // Aggregation methods
+        size_t count(uint64_t startTime, uint64_t endTime) const;
         double sum(uint64_t startTime, uint64_t endTime) const;
         double avg(uint64_t startTime, uint64_t endTime) const;
         double min(uint64_t startTime, uint64_t endTime) const;
         double max(uint64_t startTime, uint64_t endTime) const;
 
-        // Compression
+        // Compression: compress() swaps the raw columns for the codec output,
+        // decompress() restores them
         void compress();
         void decompress();
 
-        // Serialization
+        // Compressed chunk with the same points, built without modifying
+        // this one so readers can keep using it meanwhile
+        std::unique_ptr<ColumnarChunk> compressedCopy() const;
+
+        // Compressed chunk over columns already sorted by timestamp, which
+        // may exceed VALUES_PER_CHUNK up to VALUES_PER_SEGMENT points
+        static std::unique_ptr<ColumnarChunk> fromSorted(std::vector<uint64_t> timestamps,
+                                                         std::vector<double> values,
+                                                         std::vector<uint32_t> seriesIds,
+                                                         std::shared_ptr<SeriesCatalog> catalog);
+
+        // Serialization. The mapped overload keeps the column blocks in the
+        // file mapping instead of copying them.
         std::vector<uint8_t> serialize() const;
         void deserialize(const std::vector<uint8_t> &data);
+        void deserialize(std::shared_ptr<const MappedFile> file);
+        void deserialize(std::shared_ptr<const MappedFile> file, size_t offset, size_t size);
+
+        // Codec names of a sealed chunk's column blocks
+        const std::string &timestampCodec() const { return compressedData_.timestampCodec; }
+        const std::string &valueCodec() const { return compressedData_.valueCodec; }
     };
 
+    // Chunks are stored as blocks appended to a few segment files per
+    // metric, <metric>_<n>.seg, indexed by their footers. Chunk files of
+    // older databases, <metric>_<id>.chunk, are still read and deleted.
+    // WAL sequence of directories saved before it was recorded
+    constexpr uint64_t UNKNOWN_WAL_SEQUENCE = UINT64_MAX;
+
     class ColumnarStorageManager
     {
+    public:
+        using ChunkDirectory = std::unordered_map<std::string, std::vector<ChunkMeta>>;
+        using ChunkIds = std::unordered_map<std::string, std::unordered_set<size_t>>;
+
+        // Location of a block written before its chunk id is known
+        struct StagedChunk
+        {
+            uint64_t partition = 0;
+            uint32_t file = 0;
+            uint64_t offset = 0;
+        };
+
     private:
+        // Partition of segment files written flat into basePath before
+        // storage was partitioned
+        static constexpr uint64_t UNPARTITIONED = UINT64_MAX;
+
+        using FileKey = std::pair<uint64_t, uint32_t>; // partition, sequence number
+
+        struct BlockRef
+        {
+            FileKey file;
+            uint64_t offset = 0;
+        };
+
+        struct MetricSegments
+        {
+            std::map<FileKey, std::unique_ptr<SegmentFile>> files;
+            std::unordered_map<size_t, BlockRef> chunks;
+            bool legacyFiles = false; // has .chunk files
+        };
+
         std::string basePath_;
+        std::shared_ptr<SeriesCatalog> catalog_; // resolves series of loaded chunks
+        std::unordered_map<std::string, MetricSegments> metrics_;
+        std::set<std::string> unsyncedDirectories_; // with entries added since the last sync
+        mutable std::mutex mutex_;
+
+        void openSegments();
+        std::string partitionPath(uint64_t partition) const;
+        std::string segmentPath(const std::string &metric, const FileKey &file) const;
+        std::string legacyPath(const std::string &metric, size_t chunkId) const;
+
+        // The caller holds mutex_
+        BlockRef appendBlock(const std::string &metric, MetricSegments &segments, uint64_t partition,
+                             SegmentBlock block, const uint8_t *data, size_t size);
+        void removeFile(MetricSegments &segments, const FileKey &file);
+        void releaseBlock(MetricSegments &segments, const BlockRef &ref);
+        void bindChunk(MetricSegments &segments, size_t chunkId, const BlockRef &ref);
+        std::vector<size_t> listLegacyChunks(const std::string &metric);
 
     public:
-        explicit ColumnarStorageManager(const std::string &basePath);
+        // Reads the footer of every segment file under basePath. Files live
+        // in one directory per partition, part-<start>/<metric>_<n>.seg.
+        explicit ColumnarStorageManager(const std::string &basePath,
+                                        std::shared_ptr<SeriesCatalog> catalog = nullptr);
 
+        // Appends the chunk to the metric's current segment file in the
+        // partition of its newest point; a block saved earlier under the
+        // same id is released
         void saveChunk(const std::string &metric, size_t chunkId,
                        const ColumnarChunk &chunk);
+
+        // Appends a block that only becomes the chunk's once publishChunk
+        // names it; until then it is invisible and dropped on restart
+        StagedChunk stageChunk(const std::string &metric, const ColumnarChunk &chunk);
+        void publishChunk(const StagedChunk &staged, const std::string &metric, size_t chunkId);
+        void discardChunk(const StagedChunk &staged, const std::string &metric);
+
         std::unique_ptr<ColumnarChunk> loadChunk(
             const std::string &metric, size_t chunkId);
 
+        // Reads only the chunk header; older files without a stats header
+        // are loaded in full once
+        bool loadChunkMeta(const std::string &metric, size_t chunkId, ChunkMeta &meta);
+
+        // Writes pending segment footers and forces every segment file and
+        // directory entry written since the last call to disk
+        void syncFiles();
+
+        // Compact per-metric chunk directory read at startup instead of the
+        // chunk bodies. Segment files are synced first, so every chunk the
+        // directory names can be located after a crash. It records the
+        // sequence of the first WAL entry its chunks do not hold; excluded
+        // chunks are left out, their points being replayed from the WAL.
+        // Loading reports 0 for a database without a directory.
+        void saveDirectory(const ChunkDirectory &directory, uint64_t walSequence = 0,
+                           const ChunkIds &excluded = {});
+        ChunkDirectory loadDirectory(uint64_t *walSequence = nullptr);
+
+        // Releases every block the directory does not name: chunks written
+        // after the directory was last saved, or replaced before a crash
+        void retainChunks(const ChunkDirectory &directory);
+
+        // Copies the live blocks of segment files that are mostly released
+        // into the current one and removes the old files
+        void reclaimSegments(const std::string &metric);
+
+        // Unlinks the metric's segment files in partitions starting before
+        // the given one, without reading them. Chunks saved before storage
+        // was partitioned are left to deleteChunk.
+        void dropPartitions(const std::string &metric, uint64_t before);
+
         void deleteChunks(const std::string &metric);
+        void deleteChunk(const std::string &metric, size_t chunkId);
         std::vector<size_t> listChunks(const std::string &metric);
+        size_t segmentFileCount(const std::string &metric) const;
+        std::vector<uint64_t> partitions(const std::string &metric) const;
     };
 
 } // namespace waffledb
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <utility>
 
 namespace waffledb
 {
@@ -35,6 +36,49 @@ namespace waffledb
         std::vector<uint64_t> decompressTimestamps(const uint8_t *data, size_t size);
     };
 
+    // Delta-of-delta encoding for timestamps: the change between consecutive
+    // deltas is zig-zag encoded into a varint, so a steady scrape interval
+    // costs one byte per point and small jitter stays within one or two
+    class DeltaOfDeltaEncoding : public CompressionAlgorithm
+    {
+    public:
+        std::vector<uint8_t> compress(const uint8_t *data, size_t size) override;
+        std::vector<uint8_t> decompress(const uint8_t *data, size_t size) override;
+        std::string name() const override { return "dod"; }
+
+        std::vector<uint8_t> compressTimestamps(const uint64_t *timestamps, size_t count);
+        std::vector<uint64_t> decompressTimestamps(const uint8_t *data, size_t size);
+    };
+
+    // Constant-stride timestamps stored as start + interval + count. Lookups
+    // are answered arithmetically without expanding the column.
+    class ConstantStrideEncoding : public CompressionAlgorithm
+    {
+    public:
+        struct Stride
+        {
+            uint64_t start;
+            uint64_t interval;
+            uint64_t count;
+
+            uint64_t at(size_t index) const { return start + index * interval; }
+
+            // Half-open [first, last) index range covering [startTime, endTime]
+            std::pair<size_t, size_t> indexRange(uint64_t startTime, uint64_t endTime) const;
+        };
+
+        std::vector<uint8_t> compress(const uint8_t *data, size_t size) override;
+        std::vector<uint8_t> decompress(const uint8_t *data, size_t size) override;
+        std::string name() const override { return "stride"; }
+
+        // True when every delta equals the first one and is non-negative
+        static bool isConstantStride(const uint64_t *timestamps, size_t count);
+
+        std::vector<uint8_t> compressTimestamps(const uint64_t *timestamps, size_t count);
+        std::vector<uint64_t> decompressTimestamps(const uint8_t *data, size_t size);
+        static Stride decode(const uint8_t *data, size_t size);
+    };
+
     // Run-length encoding for repeated values
     class RunLengthEncoding : public CompressionAlgorithm
     {
@@ -46,23 +90,96 @@ namespace waffledb
         // Specialized for double values
         std::vector<uint8_t> compressDoubles(const double *values, size_t count);
         std::vector<double> decompressDoubles(const uint8_t *data, size_t size);
+
+        // Aggregates values [first, last) of an encoded block run by run,
+        // without expanding it: sum is run length x value
+        struct RangeAggregate
+        {
+            double sum = 0.0;
+            double min = 0.0;
+            double max = 0.0;
+            size_t count = 0;
+        };
+
+        static RangeAggregate aggregateRange(const uint8_t *data, size_t size,
+                                             size_t first, size_t last);
+    };
+
+    // Gorilla-style XOR encoding for slowly changing floating point values.
+    // Each value is XORed with its predecessor and only the meaningful bits
+    // between the leading and trailing zeros are written to a bit stream.
+    class GorillaEncoding : public CompressionAlgorithm
+    {
+    public:
+        std::vector<uint8_t> compress(const uint8_t *data, size_t size) override;
+        std::vector<uint8_t> decompress(const uint8_t *data, size_t size) override;
+        std::string name() const override { return "gorilla"; }
+
+        // Specialized for double values
+        std::vector<uint8_t> compressDoubles(const double *values, size_t count);
+        std::vector<double> decompressDoubles(const uint8_t *data, size_t size);
+
+        // Exact encoded size in bytes without producing the stream
+        static size_t encodedSize(const double *values, size_t count);
     };
 
-    // Bit-packing for small integer values
+    // Streaming decoder over a GorillaEncoding block, yields one value at a
+    // time so aggregates never materialise the whole column
+    class GorillaDecoder
+    {
+    private:
+        const uint8_t *data_;
+        size_t sizeBits_;
+        size_t bitPos_ = 0;
+        size_t count_ = 0;
+        size_t index_ = 0;
+        uint64_t previous_ = 0;
+        uint8_t leading_ = 0;
+        uint8_t meaningful_ = 0;
+
+        uint64_t readBits(unsigned bits);
+
+    public:
+        GorillaDecoder(const uint8_t *data, size_t size);
+
+        size_t count() const { return count_; }
+        bool next(double &value);
+        void skip(size_t n);
+    };
+
+    // Frame-of-reference bit-packing for integer columns. Values are split
+    // into blocks of BLOCK_SIZE, each block stores its minimum as the base
+    // and packs the offsets with the narrowest width that fits. Inside a
+    // block the offsets are interleaved over four 64-bit lanes so a block
+    // unpacks four values per step with AVX2.
     class BitPackingCompression : public CompressionAlgorithm
     {
     private:
         uint8_t bitsPerValue_;
 
     public:
+        static constexpr size_t BLOCK_SIZE = 128;
+
         explicit BitPackingCompression(uint8_t bitsPerValue = 0);
 
+        // Generic interface treats the input as an array of uint64_t
         std::vector<uint8_t> compress(const uint8_t *data, size_t size) override;
         std::vector<uint8_t> decompress(const uint8_t *data, size_t size) override;
         std::string name() const override { return "bitpacking"; }
 
+        // Specialized for 64-bit integers
+        std::vector<uint8_t> packIntegers(const uint64_t *values, size_t count);
+        std::vector<uint64_t> unpackIntegers(const uint8_t *data, size_t size);
+
+        // Exact packed size in bytes without producing the output
+        static size_t packedSize(const uint64_t *values, size_t count);
+
+        // Bits needed to represent maxValue
+        static uint8_t bitWidth(uint64_t maxValue);
+
         // Auto-detect optimal bit width
         void detectBitWidth(const uint64_t *values, size_t count);
+        uint8_t bitsPerValue() const { return bitsPerValue_; }
     };
 
     // Compression engine that manages multiple algorithms
@@ -70,8 +187,11 @@ namespace waffledb
     {
     private:
         std::unique_ptr<DeltaEncoding> deltaEncoder_;
+        std::unique_ptr<DeltaOfDeltaEncoding> dodEncoder_;
+        std::unique_ptr<ConstantStrideEncoding> strideEncoder_;
         std::unique_ptr<RunLengthEncoding> rleEncoder_;
         std::unique_ptr<BitPackingCompression> bitPacker_;
+        std::unique_ptr<GorillaEncoding> gorillaEncoder_;
 
     public:
         CompressionEngine();
@@ -100,6 +220,15 @@ namespace waffledb
 
         DecompressedData decompressColumns(const CompressedData &compressed);
 
+        // Decode a single column
+        std::vector<uint64_t> decompressTimestamps(const CompressedData &compressed);
+        std::vector<double> decompressValues(const CompressedData &compressed);
+
+        // Decode a single column straight from its encoded bytes, which may
+        // live outside a CompressedData (e.g. in a mapped chunk file)
+        std::vector<uint64_t> decodeTimestamps(const std::string &codec, const uint8_t *data, size_t size);
+        std::vector<double> decodeValues(const std::string &codec, const uint8_t *data, size_t size);
+
         // Compression statistics
         struct CompressionStats
         {
@@ -117,6 +246,13 @@ namespace waffledb
         // Choose best algorithm based on data characteristics
         std::string selectTimestampCodec(const uint64_t *timestamps, size_t count);
         std::string selectValueCodec(const double *values, size_t count);
+
+        // "bitpack" codec: zig-zagged deltas for timestamps; integral values
+        // are packed either directly (frame of reference) or as deltas
+        std::vector<uint8_t> packTimestamps(const uint64_t *timestamps, size_t count);
+        std::vector<uint64_t> unpackTimestamps(const uint8_t *data, size_t size);
+        std::vector<uint8_t> packValues(const double *values, size_t count);
+        std::vector<double> unpackValues(const uint8_t *data, size_t size);
     };
 
     // Compression block header for random access
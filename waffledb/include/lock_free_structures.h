@@ -10,10 +10,14 @@
 #include <functional>
 #include <stdexcept>
 #include <algorithm>
+#include <cstdint>
 
 namespace waffledb
 {
 
+    // Small dense number of the calling thread, assigned on first use
+    size_t currentThreadSlot();
+
     // Lock-free queue implementation using Michael & Scott algorithm
     template <typename T>
     class LockFreeQueue
@@ -122,6 +126,216 @@ namespace waffledb
         }
     };
 
+    // Write buffer made of bounded rings of preallocated slots, one per
+    // shard, with threads spread over the shards. Writers claim a slot with
+    // one CAS on their own shard's cursor and copy the item into it, reusing
+    // whatever capacity the slot already holds, so a steady-state push does
+    // not allocate. Multi-producer, single consumer: drains are serialized
+    // by the caller.
+    template <typename T>
+    class ShardedRingBuffer
+    {
+    public:
+        // Occupancy of the shard a push landed in
+        struct Fill
+        {
+            size_t items = 0;
+            size_t weight = 0;
+        };
+
+    private:
+        struct Slot
+        {
+            std::atomic<size_t> sequence{0};
+            size_t weight = 0;
+            T value;
+        };
+
+        struct alignas(64) Shard
+        {
+            std::unique_ptr<Slot[]> slots;
+            alignas(64) std::atomic<size_t> enqueuePos{0};
+            alignas(64) std::atomic<size_t> dequeuePos{0};
+            std::atomic<size_t> weight{0};
+
+            explicit Shard(size_t capacity) : slots(new Slot[capacity])
+            {
+                for (size_t i = 0; i < capacity; ++i)
+                {
+                    slots[i].sequence.store(i, std::memory_order_relaxed);
+                }
+            }
+        };
+
+        size_t capacity_; // slots per shard, a power of two
+        size_t mask_;
+        size_t shardCount_;
+        std::unique_ptr<std::atomic<Shard *>[]> shards_; // created on first push
+
+        Shard &localShard()
+        {
+            auto &entry = shards_[currentThreadSlot() & (shardCount_ - 1)];
+            Shard *shard = entry.load(std::memory_order_acquire);
+            if (!shard)
+            {
+                auto created = std::make_unique<Shard>(capacity_);
+                if (entry.compare_exchange_strong(shard, created.get(), std::memory_order_acq_rel))
+                {
+                    shard = created.release();
+                }
+            }
+            return *shard;
+        }
+
+        static size_t roundUpPow2(size_t n)
+        {
+            size_t p = 1;
+            while (p < n)
+                p <<= 1;
+            return p;
+        }
+
+    public:
+        // shards == 0 picks one per hardware thread
+        explicit ShardedRingBuffer(size_t capacity, size_t shards = 0)
+            : capacity_(roundUpPow2(std::max<size_t>(capacity, 2))),
+              mask_(capacity_ - 1),
+              shardCount_(roundUpPow2(std::min<size_t>(
+                  shards ? shards : std::max(1u, std::thread::hardware_concurrency()), 64))),
+              shards_(new std::atomic<Shard *>[shardCount_])
+        {
+            for (size_t i = 0; i < shardCount_; ++i)
+            {
+                shards_[i].store(nullptr, std::memory_order_relaxed);
+            }
+        }
+
+        ~ShardedRingBuffer()
+        {
+            for (size_t i = 0; i < shardCount_; ++i)
+            {
+                delete shards_[i].load();
+            }
+        }
+
+        ShardedRingBuffer(const ShardedRingBuffer &) = delete;
+        ShardedRingBuffer &operator=(const ShardedRingBuffer &) = delete;
+
+        size_t capacity() const { return capacity_; }
+        size_t shardCount() const { return shardCount_; }
+
+        // Returns false, leaving the buffer unchanged, if the calling
+        // thread's shard is full
+        bool tryPush(const T &item, size_t weight = 0, Fill *fill = nullptr)
+        {
+            Shard &shard = localShard();
+            size_t pos = shard.enqueuePos.load(std::memory_order_relaxed);
+            Slot *slot;
+            while (true)
+            {
+                slot = &shard.slots[pos & mask_];
+                size_t sequence = slot->sequence.load(std::memory_order_acquire);
+                intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+                if (diff == 0)
+                {
+                    if (shard.enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                }
+                else if (diff < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    pos = shard.enqueuePos.load(std::memory_order_relaxed);
+                }
+            }
+
+            slot->value = item;
+            slot->weight = weight;
+            slot->sequence.store(pos + 1, std::memory_order_release);
+            size_t total = shard.weight.fetch_add(weight, std::memory_order_relaxed) + weight;
+
+            if (fill)
+            {
+                // The consumer may already have taken this very item
+                size_t dequeued = shard.dequeuePos.load(std::memory_order_relaxed);
+                fill->items = pos + 1 > dequeued ? pos + 1 - dequeued : 0;
+                fill->weight = total;
+            }
+            return true;
+        }
+
+        // Swaps every item pushed before the call into out[count], out[count
+        // + 1], ..., growing out as needed, and returns the number drained.
+        // Slots receive the old contents of out, so buffers circulate between
+        // the two instead of being freed and reallocated.
+        size_t drain(std::vector<T> &out, size_t &count)
+        {
+            using std::swap;
+            size_t drained = 0;
+            for (size_t i = 0; i < shardCount_; ++i)
+            {
+                Shard *shard = shards_[i].load(std::memory_order_acquire);
+                if (!shard)
+                    continue;
+
+                size_t start = shard->dequeuePos.load(std::memory_order_relaxed);
+                size_t end = shard->enqueuePos.load(std::memory_order_acquire);
+                size_t pos = start;
+                size_t weight = 0;
+                for (; pos != end; ++pos)
+                {
+                    Slot &slot = shard->slots[pos & mask_];
+                    // A writer has claimed the slot but not filled it yet
+                    while (slot.sequence.load(std::memory_order_acquire) != pos + 1)
+                    {
+                        std::this_thread::yield();
+                    }
+
+                    if (count == out.size())
+                        out.emplace_back();
+                    swap(out[count++], slot.value);
+                    weight += slot.weight;
+                    slot.sequence.store(pos + capacity_, std::memory_order_release);
+                }
+
+                drained += end - start;
+                shard->dequeuePos.store(end, std::memory_order_release);
+                shard->weight.fetch_sub(weight, std::memory_order_relaxed);
+            }
+            return drained;
+        }
+
+        bool empty() const
+        {
+            for (size_t i = 0; i < shardCount_; ++i)
+            {
+                Shard *shard = shards_[i].load(std::memory_order_acquire);
+                if (shard && shard->enqueuePos.load(std::memory_order_acquire) !=
+                                 shard->dequeuePos.load(std::memory_order_acquire))
+                    return false;
+            }
+            return true;
+        }
+
+        // True if any shard holds at least items items or weight weight
+        bool anyShardAtLeast(size_t items, size_t weight) const
+        {
+            for (size_t i = 0; i < shardCount_; ++i)
+            {
+                Shard *shard = shards_[i].load(std::memory_order_acquire);
+                if (!shard)
+                    continue;
+                size_t held = shard->enqueuePos.load(std::memory_order_acquire) -
+                              shard->dequeuePos.load(std::memory_order_acquire);
+                if (held >= items || shard->weight.load(std::memory_order_relaxed) >= weight)
+                    return true;
+            }
+            return false;
+        }
+    };
+
     // Epoch-based memory reclamation
     class EpochManager
     {
@@ -0,0 +1,44 @@
+// waffledb/include/mapped_file.h
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+namespace waffledb
+{
+
+    // Read-only mapping of a whole file. Platforms without mmap read the
+    // file into memory instead, so callers only ever see data()/size().
+    class MappedFile
+    {
+    private:
+        const uint8_t *data_ = nullptr;
+        size_t size_ = 0;   // of the file when it was mapped
+        size_t length_ = 0; // mapped, reserve included
+        std::vector<uint8_t> fallback_;
+
+        MappedFile() = default;
+
+    public:
+        ~MappedFile();
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        // Returns nullptr if the file is missing, empty or cannot be mapped.
+        // A reserve maps at least that many bytes, so a file still being
+        // appended to grows into the mapping; bytes past its end must not
+        // be read. Without mmap the reserve is ignored.
+        static std::shared_ptr<const MappedFile> open(const std::string &path, size_t reserve = 0);
+
+        const uint8_t *data() const { return data_; }
+        size_t size() const { return size_; }
+
+        // Bytes addressable through data(); those past the end of the file
+        // fault when read
+        size_t length() const { return length_; }
+    };
+
+} // namespace waffledb
@@ -0,0 +1,85 @@
+// waffledb/include/roaring_bitmap.h
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <initializer_list>
+
+namespace waffledb
+{
+
+    // Compressed set of uint32_t. Values are split by their high 16 bits
+    // into containers of up to 65536 values, each stored in whichever form
+    // is smallest: a sorted array (up to ARRAY_MAX values), a 65536-bit
+    // bitmap, or a list of runs. Bitmap containers are combined with AVX2.
+    class RoaringBitmap
+    {
+    public:
+        static constexpr uint32_t ARRAY_MAX = 4096;
+        static constexpr size_t BITMAP_WORDS = 65536 / 64;
+
+    private:
+        struct Container
+        {
+            enum class Type : uint8_t
+            {
+                Array,
+                Bitmap,
+                Run
+            };
+
+            Type type = Type::Array;
+            uint32_t cardinality = 0;
+            std::vector<uint16_t> values;                    // Array: sorted values
+            std::vector<uint64_t> words;                     // Bitmap: BITMAP_WORDS words
+            std::vector<std::pair<uint16_t, uint16_t>> runs; // Run: start and length - 1
+
+            bool contains(uint16_t low) const;
+            size_t sizeInBytes() const;
+        };
+
+        std::vector<uint16_t> keys_; // high 16 bits, sorted
+        std::vector<Container> containers_;
+
+        Container &containerFor(uint16_t key);
+
+        static const uint64_t *wordsOf(const Container &container, std::vector<uint64_t> &scratch);
+        static Container fromWords(std::vector<uint64_t> words);
+        static std::vector<uint16_t> lowValues(const Container &container);
+
+        static Container intersect(const Container &a, const Container &b);
+        static Container unite(const Container &a, const Container &b);
+        static Container difference(const Container &a, const Container &b);
+
+    public:
+        RoaringBitmap() = default;
+        RoaringBitmap(std::initializer_list<uint32_t> values);
+
+        void add(uint32_t value);
+        void addRange(uint32_t first, uint32_t last); // [first, last)
+        bool contains(uint32_t value) const;
+
+        uint64_t cardinality() const;
+        bool empty() const { return keys_.empty(); }
+        uint32_t maximum() const; // largest value; the bitmap must not be empty
+
+        std::vector<uint32_t> toVector() const;
+
+        // Converts containers to runs wherever that is smaller
+        void runOptimize();
+        size_t sizeInBytes() const;
+
+        static RoaringBitmap intersect(const RoaringBitmap &a, const RoaringBitmap &b);
+        static RoaringBitmap unite(const RoaringBitmap &a, const RoaringBitmap &b);
+        static RoaringBitmap difference(const RoaringBitmap &a, const RoaringBitmap &b); // a AND NOT b
+
+        bool operator==(const RoaringBitmap &other) const;
+        bool operator!=(const RoaringBitmap &other) const { return !(*this == other); }
+
+        void serialize(std::vector<uint8_t> &buffer) const;
+        static RoaringBitmap deserialize(const uint8_t *&ptr, size_t &remaining);
+    };
+
+} // namespace waffledb
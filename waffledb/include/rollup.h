@@ -0,0 +1,108 @@
+// waffledb/include/rollup.h
+#pragma once
+
+#include "waffledb.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <array>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+#include <limits>
+
+namespace waffledb
+{
+
+    // Bucket widths of the rollup tree in seconds, finest level first
+    constexpr std::array<uint64_t, 3> ROLLUP_LEVELS = {60, 3600, 86400};
+
+    // How far behind a metric's newest point each level but the coarsest
+    // keeps its buckets; older spans are answered by the next level
+    constexpr std::array<uint64_t, ROLLUP_LEVELS.size() - 1> ROLLUP_HORIZONS = {2 * 86400, 90 * 86400};
+
+    // Pre-aggregated summary of the points that fell into one time bucket
+    struct RollupBucket
+    {
+        uint64_t count = 0;
+        double sum = 0.0;
+        double min = std::numeric_limits<double>::max();
+        double max = std::numeric_limits<double>::lowest();
+
+        void add(double value);
+        void merge(const RollupBucket &other);
+        double avg() const { return count > 0 ? sum / count : 0.0; }
+    };
+
+    // Maintains 1m/1h/1d buckets per metric and tag set so long-range
+    // aggregates are answered from a handful of buckets instead of raw chunks
+    class RollupManager
+    {
+    private:
+        struct Series
+        {
+            std::unordered_map<std::string, std::string> tags;
+            std::array<std::map<uint64_t, RollupBucket>, ROLLUP_LEVELS.size()> levels;
+        };
+
+        struct MetricRollup
+        {
+            uint64_t points = 0;
+            uint64_t newest = 0;
+            std::array<uint64_t, ROLLUP_LEVELS.size()> keptFrom{}; // each level has no buckets before it
+            uint64_t nextExpiry = 0;
+            std::unordered_map<std::string, Series> series; // keyed by canonical tag string
+        };
+
+        std::string path_;
+        std::unordered_map<std::string, MetricRollup> metrics_;
+        mutable bool dirty_ = false; // changed since the last save
+        mutable std::mutex mutex_;
+
+        static std::string seriesKey(const std::unordered_map<std::string, std::string> &tags);
+        static bool matches(const Series &series, const std::unordered_map<std::string, std::string> &tags);
+        static void addPoint(MetricRollup &rollup, Series &series, uint64_t timestamp, double value);
+        static void expire(MetricRollup &rollup);
+        static uint64_t resolution(const MetricRollup &rollup, uint64_t timestamp);
+        static void aggregateSpan(const Series &series, uint64_t start, uint64_t end,
+                                  size_t level, RollupBucket &out);
+        void aggregateLocked(const std::string &metric, uint64_t start, uint64_t end,
+                             const std::unordered_map<std::string, std::string> &tags, RollupBucket &out) const;
+
+    public:
+        explicit RollupManager(const std::string &basePath);
+
+        void add(const std::string &metric, const std::unordered_map<std::string, std::string> &tags,
+                 uint64_t timestamp, double value);
+
+        // Folds points of one metric in under a single lock acquisition
+        void add(const std::string &metric, const std::vector<const TimePoint *> &points);
+
+        // Aggregates [start, end) over every series whose tags contain the
+        // filter; each bound must be a multiple of the finest level still
+        // kept there
+        RollupBucket aggregate(const std::string &metric, uint64_t start, uint64_t end,
+                               const std::unordered_map<std::string, std::string> &tags) const;
+
+        // Aggregates the widest span [innerStart, innerEnd) within
+        // [start, end] that the kept buckets answer; false if none fits
+        bool aggregateWithin(const std::string &metric, uint64_t start, uint64_t end,
+                             const std::unordered_map<std::string, std::string> &tags, RollupBucket &out,
+                             uint64_t &innerStart, uint64_t &innerEnd) const;
+
+        // Number of points folded into the metric, used to detect stale rollups
+        uint64_t pointCount(const std::string &metric) const;
+
+        std::vector<std::string> getMetrics() const;
+        void dropMetric(const std::string &metric);
+
+        // Drops buckets ending at or before the timestamp, which retention
+        // passes aligned to the coarsest level
+        void dropBefore(const std::string &metric, uint64_t timestamp);
+
+        // No-op when nothing changed since the last save
+        void save() const;
+        void load();
+    };
+
+} // namespace waffledb
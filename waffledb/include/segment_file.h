@@ -0,0 +1,94 @@
+// waffledb/include/segment_file.h
+#pragma once
+
+#include "mapped_file.h"
+#include "append_file.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <cstdint>
+
+namespace waffledb
+{
+
+    // Segment files of a metric roll over once they reach this size, which
+    // is also the address space a file's mapping reserves up front
+    constexpr uint64_t SEGMENT_FILE_BYTES = 64ull << 20;
+
+    // Chunk id of a block written before its id is known
+    constexpr uint64_t STAGED_BLOCK = UINT64_MAX;
+
+    // Index entry of one column block, repeated in the block's record
+    // header and in the footer
+    struct SegmentBlock
+    {
+        uint64_t chunkId = STAGED_BLOCK;
+        uint64_t offset = 0; // of the block bytes within the file
+        uint64_t size = 0;
+        uint64_t minTimestamp = 0;
+        uint64_t maxTimestamp = 0;
+        uint32_t seriesId = UINT32_MAX;
+        uint32_t checksum = 0; // CRC-32 of the block bytes
+        std::string timestampCodec;
+        std::string valueCodec;
+    };
+
+    // Append-only file holding many chunk blocks. Every block is preceded
+    // by a record header carrying its index entry; writeFooter appends the
+    // entries of all live blocks followed by a fixed-size trailer. A file
+    // that ends in a trailer opens with one read of its footer; one that
+    // does not, after a crash, is recovered by walking its records. Bytes
+    // are never rewritten, so mappings of a file stay valid as it grows.
+    // Records are written through one descriptor, opened on first append.
+    class SegmentFile
+    {
+    private:
+        std::string path_;
+        uint64_t size_ = 0;
+        uint64_t liveBytes_ = 0;
+        bool footerStale_ = false;
+        bool unsynced_ = false; // written since the last sync
+        std::map<uint64_t, SegmentBlock> blocks_; // by offset
+        std::shared_ptr<const MappedFile> mapping_;
+        std::unique_ptr<AppendFile> out_;
+
+        explicit SegmentFile(std::string path) : path_(std::move(path)) {}
+
+        bool readFooter();
+        void scan();
+        void write(const std::vector<uint8_t> &record, const uint8_t *data = nullptr, size_t size = 0);
+
+    public:
+        // Opens the file, creating it if missing. Throws if it exists but
+        // is not a segment file.
+        static std::unique_ptr<SegmentFile> open(const std::string &path);
+
+        static uint32_t checksum(const uint8_t *data, size_t size);
+
+        const std::string &path() const { return path_; }
+        uint64_t size() const { return size_; }
+        uint64_t liveBytes() const { return liveBytes_; }
+        const std::map<uint64_t, SegmentBlock> &blocks() const { return blocks_; }
+
+        // Appends a block and returns its offset; the footer is stale
+        // until the next writeFooter
+        uint64_t append(SegmentBlock block, const uint8_t *data, size_t size);
+
+        void relabel(uint64_t offset, uint64_t chunkId);
+        void erase(uint64_t offset);
+
+        // No-op when nothing changed since the last footer
+        void writeFooter();
+
+        // Forces the records written so far to disk; throws on failure
+        void sync();
+
+        // Mapping covering a block. It reserves SEGMENT_FILE_BYTES, so it is
+        // replaced only once a file grows past that. Throws if the file
+        // does not hold the block. The caller checks the block bytes
+        // against block.checksum.
+        std::shared_ptr<const MappedFile> map(const SegmentBlock &block);
+    };
+
+} // namespace waffledb
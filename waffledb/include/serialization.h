@@ -0,0 +1,88 @@
+// waffledb/include/serialization.h
+#pragma once
+
+#include "append_file.h"
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+
+namespace waffledb
+{
+
+    // Helpers shared by the on-disk formats: values are stored in host byte
+    // order, strings with a uint32 length prefix. Readers advance ptr and
+    // throw "Invalid <source>: truncated <field>" when the input runs out.
+
+    template <typename T>
+    void appendPod(std::vector<uint8_t> &buffer, const T &value)
+    {
+        size_t oldSize = buffer.size();
+        buffer.resize(oldSize + sizeof(T));
+        std::memcpy(buffer.data() + oldSize, &value, sizeof(T));
+    }
+
+    inline void appendString(std::vector<uint8_t> &buffer, const std::string &value)
+    {
+        appendPod(buffer, static_cast<uint32_t>(value.size()));
+        buffer.insert(buffer.end(), value.begin(), value.end());
+    }
+
+    [[noreturn]] inline void throwTruncated(const char *source, const char *field)
+    {
+        throw std::runtime_error(std::string("Invalid ") + source + ": truncated " + field);
+    }
+
+    template <typename T>
+    T readPod(const uint8_t *&ptr, size_t &remaining, const char *source, const char *field = "data")
+    {
+        if (remaining < sizeof(T))
+        {
+            throwTruncated(source, field);
+        }
+        T value;
+        std::memcpy(&value, ptr, sizeof(T));
+        ptr += sizeof(T);
+        remaining -= sizeof(T);
+        return value;
+    }
+
+    inline std::string readString(const uint8_t *&ptr, size_t &remaining, const char *source,
+                                  const char *field = "data")
+    {
+        uint32_t length = readPod<uint32_t>(ptr, remaining, source, field);
+        if (remaining < length)
+        {
+            throwTruncated(source, field);
+        }
+        std::string value(reinterpret_cast<const char *>(ptr), length);
+        ptr += length;
+        remaining -= length;
+        return value;
+    }
+
+    // Replaces path with the buffer through a temporary file, synced before
+    // the rename, which is synced in turn; a crash leaves either the old or
+    // the new contents. what names the file in the error thrown on failure.
+    inline void replaceFile(const std::string &path, const std::vector<uint8_t> &buffer, const char *what)
+    {
+        std::string tmpPath = path + ".tmp";
+        {
+            auto file = AppendFile::open(tmpPath, true);
+            if (!file->write(buffer.data(), buffer.size()) || !file->sync())
+            {
+                throw std::runtime_error(std::string("Failed to save ") + what + ": " + tmpPath);
+            }
+        }
+        std::filesystem::rename(tmpPath, path);
+
+        std::string directory = std::filesystem::path(path).parent_path().string();
+        if (!syncDirectory(directory.empty() ? "." : directory))
+        {
+            throw std::runtime_error(std::string("Failed to save ") + what + ": " + path);
+        }
+    }
+
+} // namespace waffledb
@@ -0,0 +1,60 @@
+// waffledb/include/series_catalog.h
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <cstdint>
+#include <unordered_map>
+#include "tag_index.h"
+
+namespace waffledb
+{
+
+    using TagSet = std::unordered_map<std::string, std::string>;
+
+    // Maps each distinct tag set to a dense series ID so chunks store one
+    // uint32_t per point instead of a tag map. Tag predicates resolve to
+    // series through an inverted index persisted next to the catalog.
+    class SeriesCatalog
+    {
+    private:
+        std::string path_;
+        std::string indexPath_;
+        std::deque<TagSet> series_; // indexed by ID, references stay valid on growth
+        std::unordered_map<std::string, uint32_t> ids_; // canonical key -> ID
+        TagIndex index_;
+        mutable std::mutex mutex_;
+
+        uint32_t internLocked(const TagSet &tags, bool indexed);
+
+    public:
+        // An empty path keeps the catalog in memory only
+        explicit SeriesCatalog(const std::string &basePath = "");
+
+        // Canonical key of a tag set: pairs sorted by tag name
+        static std::string canonicalKey(const TagSet &tags);
+
+        // Returns the ID of the tag set, assigning the next one if it is new
+        uint32_t intern(const TagSet &tags);
+
+        const TagSet &tags(uint32_t id) const;
+        bool matches(uint32_t id, const TagSet &filter) const;
+
+        // Every series whose tags contain the filter
+        RoaringBitmap select(const TagSet &filter) const;
+
+        // Sorted IDs of every series whose tags contain the filter
+        std::vector<uint32_t> find(const TagSet &filter) const;
+
+        // Sorted IDs of every series whose key tag has any of the values
+        std::vector<uint32_t> findAny(const std::string &key, const std::vector<std::string> &values) const;
+
+        size_t size() const;
+
+        void save() const;
+        void load();
+    };
+
+} // namespace waffledb
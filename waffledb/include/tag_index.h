@@ -0,0 +1,50 @@
+// waffledb/include/tag_index.h
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include "roaring_bitmap.h"
+
+namespace waffledb
+{
+
+    // Series IDs carrying one tag key=value pair. Roaring containers keep
+    // both rare values (arrays) and common ones (bitmaps, runs) compact.
+    using Postings = RoaringBitmap;
+
+    // Inverted index from tag key=value to the postings list of series that
+    // carry it. Multi-tag predicates intersect the lists, smallest first.
+    // Not synchronized; the owning catalog serializes access.
+    class TagIndex
+    {
+    private:
+        std::unordered_map<std::string, std::unordered_map<std::string, Postings>> postings_;
+        size_t seriesCount_ = 0; // series folded in so far
+
+    public:
+        void add(uint32_t seriesId, const std::unordered_map<std::string, std::string> &tags);
+        void clear();
+
+        // Postings list of one pair, or nullptr if no series carries it
+        const Postings *find(const std::string &key, const std::string &value) const;
+
+        // Series carrying every pair of the filter; an empty filter is
+        // answered by the caller, which knows every series
+        Postings select(const std::unordered_map<std::string, std::string> &filter) const;
+
+        // Series whose key tag has any of the given values
+        Postings selectAny(const std::string &key, const std::vector<std::string> &values) const;
+
+        size_t seriesCount() const { return seriesCount_; }
+        size_t pairCount() const;
+
+        // Postings are stored as run-optimized roaring bitmaps. load() returns false,
+        // leaving the index empty, when the file is missing or does not
+        // cover exactly expectedSeries series.
+        void save(const std::string &path) const;
+        bool load(const std::string &path, size_t expectedSeries);
+    };
+
+} // namespace waffledb
@@ -0,0 +1,44 @@
+// waffledb/include/thread_pool.h
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace waffledb
+{
+
+    // Fixed set of worker threads for splitting one job into independent
+    // work items. The calling thread works on the items as well, so a pool
+    // without workers simply runs them inline.
+    class ThreadPool
+    {
+    private:
+        std::vector<std::thread> workers_;
+        std::deque<std::function<void()>> tasks_;
+        std::mutex mutex_;
+        std::condition_variable available_;
+        bool stopping_ = false;
+
+        void workerLoop();
+
+    public:
+        // threads == 0 uses one worker per hardware thread besides the caller
+        explicit ThreadPool(size_t threads = 0);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        size_t size() const { return workers_.size(); }
+
+        // Runs fn(0) ... fn(count - 1) across the workers and the calling
+        // thread and returns once all have finished. The first exception
+        // thrown by an item is rethrown here.
+        void parallelFor(size_t count, const std::function<void(size_t)> &fn);
+    };
+
+} // namespace waffledb
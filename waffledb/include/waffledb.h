@@ -11,6 +11,9 @@ namespace waffledb
 {
     // Forward declarations
     class QueryDSL;
+    struct RollupBucket;
+    struct ChunkCacheStats;
+    struct AdaptiveIndexStats;
 
     // Time point structure
     struct TimePoint
@@ -21,6 +24,16 @@ namespace waffledb
         std::unordered_map<std::string, std::string> tags;
     };
 
+    // When the write-ahead log is forced to disk: with every write, every
+    // few milliseconds, or whenever the OS writes it back. Writes are handed
+    // to the OS before they return under every policy.
+    enum class WalSyncPolicy
+    {
+        EveryWrite,
+        Interval,
+        None
+    };
+
     // Base database interface
     class IDatabase
     {
@@ -37,6 +50,13 @@ namespace waffledb
             uint64_t end_time,
             const std::unordered_map<std::string, std::string> &tags = {}) = 0;
 
+        // Writes are buffered; flush() returns once every earlier write is
+        // visible to queries, sync() once it is also in the chunk files and
+        // forced to disk, so it survives a crash or power loss.
+        // Implementations that write through need not override them.
+        virtual void flush() {}
+        virtual void sync() {}
+
         // Aggregate functions
         virtual double avg(
             const std::string &metric,
@@ -92,6 +112,20 @@ namespace waffledb
             uint64_t start_time,
             uint64_t end_time,
             const std::unordered_map<std::string, std::string> &tags = {}) override;
+        void flush() override;
+        void sync() override;
+
+        // Merges small sealed chunks and overflow chunks into large sorted
+        // segments, after rebuilding rollups found stale on open. Runs in
+        // the background as well; blocks until done.
+        void compact();
+
+        // Seconds of data kept behind a metric's newest point, for every
+        // metric or one; 0, the default, keeps everything. Expired day
+        // partitions are unlinked by the compactor or applyRetention.
+        void setRetention(uint64_t seconds);
+        void setRetention(const std::string &metric, uint64_t seconds);
+        void applyRetention();
 
         double avg(
             const std::string &metric,
@@ -114,6 +148,40 @@ namespace waffledb
             uint64_t end_time,
             const std::unordered_map<std::string, std::string> &tags = {}) override;
 
+        // Tumbling windows answered from the 1m/1h/1d rollups. Returns false
+        // when the window size or start is not minute aligned.
+        bool rollupWindows(
+            const std::string &metric,
+            uint64_t start_time,
+            uint64_t end_time,
+            uint64_t window_seconds,
+            const std::unordered_map<std::string, std::string> &tags,
+            std::vector<std::pair<uint64_t, RollupBucket>> &windows);
+
+        // Byte budget of the pool holding sealed chunk bodies, and its
+        // hit/miss/eviction counters
+        void setChunkCacheBudget(size_t bytes);
+        ChunkCacheStats chunkCacheStats() const;
+
+        // Points up to this many seconds older than the newest point of their
+        // series are sorted into its chunk; older ones go to an overflow
+        // chunk of the metric, merged back by compaction
+        void setOutOfOrderWindow(uint64_t seconds);
+
+        // Durability of acknowledged writes; Interval syncs every
+        // interval_ms milliseconds. Concurrent writers share each sync.
+        void setWalSyncPolicy(WalSyncPolicy policy, uint64_t interval_ms = 100);
+
+        // The log is checkpointed in the background, as by sync(), once it
+        // holds wal_bytes or its oldest entry is max_age_seconds old; 0
+        // disables either. Defaults to 64 MiB and 300 seconds.
+        void setCheckpointThreshold(uint64_t wal_bytes, uint64_t max_age_seconds);
+
+        // Memory budget of the series lists materialized for hot tag
+        // queries, and which patterns are hot and how often they hit
+        void setAdaptiveIndexBudget(size_t bytes);
+        AdaptiveIndexStats adaptiveIndexStats() const;
+
         std::vector<std::string> getMetrics() override;
         void deleteMetric(const std::string &metric) override;
         void destroy() override;
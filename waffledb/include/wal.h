@@ -2,11 +2,15 @@
 #pragma once
 
 #include "waffledb.h"
+#include "append_file.h"
 #include <string>
-#include <fstream>
+#include <memory>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
 #include <atomic>
 #include <vector>
+#include <chrono>
 
 namespace waffledb
 {
@@ -20,28 +24,98 @@ namespace waffledb
         std::unordered_map<std::string, std::string> tags;
     };
 
+    // Interval between syncs under WalSyncPolicy::Interval unless set
+    constexpr std::chrono::milliseconds WAL_SYNC_INTERVAL{100};
+
+    // Append-only log with group commit. Writers encode their entries into
+    // a shared buffer and wait; the first of them to find no write in
+    // progress becomes the leader and writes, and under EveryWrite syncs,
+    // everything buffered so far, its own entries and those of writers
+    // that queued behind it, in one call. Bytes are counted from the open,
+    // and a writer is done once the written (or synced) count passes the
+    // end of its entries. A group that fails is cut off the log again, so
+    // later groups still follow whole entries; if that fails too, appends
+    // are refused until rotate() starts a new log.
+    //
+    // rotate() moves the log aside as wal.<n>.log, n being the sequence
+    // number of the first entry after it, and release() deletes the logs
+    // moved aside once a checkpoint holds their entries.
     class WriteAheadLog
     {
     private:
+        std::string basePath_;
         std::string logPath_;
-        std::ofstream logFile_;
-        std::mutex writeMutex_;
+        std::unique_ptr<AppendFile> log_;
         std::atomic<uint64_t> sequenceNumber_{0};
 
-        // Helper methods for proper serialization
-        void writeEntryToFile(const TimePoint &point);
-        TimePoint parseEntry(const uint8_t *data, uint32_t entrySize, uint64_t &maxSequence);
+        mutable std::mutex mutex_;
+        std::condition_variable committed_;
+        std::vector<uint8_t> pending_; // encoded, not yet written
+        std::vector<uint8_t> spare_;   // the last group's buffer, reused
+        uint64_t enqueued_ = 0;
+        uint64_t written_ = 0;
+        uint64_t synced_ = 0;
+        uint64_t failedFrom_ = 0; // bytes of the last group that failed
+        uint64_t failedTo_ = 0;
+        int failedErrno_ = 0;
+        uint64_t logSize_ = 0; // of wal.log, whole entries only
+        bool torn_ = false;    // a failed group could not be cut off
+        bool idle_ = true;     // no entry since the log was started
+        std::chrono::steady_clock::time_point startedAt_; // first entry since
+        bool leaderActive_ = false;
+        WalSyncPolicy policy_ = WalSyncPolicy::Interval;
+        std::chrono::milliseconds interval_ = WAL_SYNC_INTERVAL;
+
+        // Syncs the log every interval_ under WalSyncPolicy::Interval
+        std::thread syncThread_;
+        std::condition_variable syncSignal_;
+        bool syncStopping_ = false;
+
+        void checkWritable() const;
+        void appendEntry(const TimePoint &point);
+        void commit(std::unique_lock<std::mutex> &lock, uint64_t ticket, bool sync);
+        void syncLoop();
+        void stopSyncer();
+        std::vector<std::pair<uint64_t, std::string>> retiredLogs() const;
+        size_t readLog(const std::string &path, uint64_t from, std::vector<TimePoint> &points, uint64_t &next);
+        TimePoint parseEntry(const uint8_t *data, uint32_t entrySize, uint64_t &sequence);
 
     public:
-        explicit WriteAheadLog(const std::string &basePath);
+        explicit WriteAheadLog(const std::string &basePath,
+                               WalSyncPolicy policy = WalSyncPolicy::Interval,
+                               std::chrono::milliseconds interval = WAL_SYNC_INTERVAL);
         ~WriteAheadLog();
 
+        // Return once the entries are written, and synced under EveryWrite;
+        // throw if they were not
         void append(const TimePoint &point);
         void appendBatch(const std::vector<TimePoint> &points);
 
-        std::vector<TimePoint> recover();
+        void setSyncPolicy(WalSyncPolicy policy, std::chrono::milliseconds interval = WAL_SYNC_INTERVAL);
+
+        // Entries numbered from on, from the logs moved aside and then the
+        // current one. Numbering continues past every entry read, and a
+        // torn tail of the current log is cut off.
+        std::vector<TimePoint> recover(uint64_t from = 0);
+
+        // Syncs every entry appended so far, unless the policy is None
         void checkpoint();
+
+        // Writes, syncs unless the policy is None, and moves the log aside,
+        // starting an empty one; returns the number of its first entry
+        uint64_t rotate();
+
+        // Deletes the logs moved aside whose entries are all numbered
+        // before sequence
+        void release(uint64_t sequence);
+
+        // Drops every entry; numbering carries on
         void clear();
+
+        // Bytes logged since the log was started, and how long ago the
+        // first of them was appended
+        uint64_t size() const;
+        std::chrono::steady_clock::duration age() const;
     };
 
-} // namespace waffledb
\ No newline at end of file
+} // namespace waffledb
@@ -1,135 +1,286 @@
 // waffledb/src/adaptive_index.cpp
 #include "adaptive_index.h"
+#include "series_catalog.h"
 #include <algorithm>
 #include <mutex>
 
 namespace waffledb
 {
 
+    void AdaptiveIndex::MetricIndex::rebuildPrefix(size_t from)
+    {
+        maxPrefix.resize(entries.size());
+        for (size_t i = from; i < entries.size(); ++i)
+        {
+            maxPrefix[i] = i == 0 ? entries[i].maxTime : std::max(maxPrefix[i - 1], entries[i].maxTime);
+        }
+    }
+
     void AdaptiveIndex::addChunk(size_t chunkId, const std::string &metric,
-                                 uint64_t minTime, uint64_t maxTime,
-                                 const std::unordered_map<std::string, std::unordered_set<std::string>> &tags)
+                                 uint64_t minTime, uint64_t maxTime)
     {
         std::lock_guard<std::mutex> lock(mutex_);
 
-        IndexEntry entry;
-        entry.chunkId = chunkId;
-        entry.metric = metric;
-        entry.minTime = minTime;
-        entry.maxTime = maxTime;
-        entry.tagIndex = tags;
+        MetricIndex &index = metrics_[metric];
 
-        entries_.push_back(entry);
+        // New chunks usually start after the existing ones, so this is
+        // normally an append
+        auto it = std::upper_bound(index.entries.begin(), index.entries.end(), minTime,
+                                   [](uint64_t time, const IndexEntry &entry)
+                                   { return time < entry.minTime; });
+        size_t position = it - index.entries.begin();
+        index.entries.insert(it, IndexEntry{minTime, maxTime, chunkId});
+        index.rebuildPrefix(position);
     }
 
-    std::vector<size_t> AdaptiveIndex::findChunks(const std::string &metric,
-                                                  uint64_t startTime, uint64_t endTime,
-                                                  const std::unordered_map<std::string, std::string> &tags)
+    void AdaptiveIndex::removeChunk(size_t chunkId, const std::string &metric)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto metricIt = metrics_.find(metric);
+        if (metricIt == metrics_.end())
+            return;
+
+        auto &entries = metricIt->second.entries;
+        auto it = std::find_if(entries.begin(), entries.end(),
+                               [chunkId](const IndexEntry &entry)
+                               { return entry.chunkId == chunkId; });
+        if (it == entries.end())
+            return;
+
+        size_t position = it - entries.begin();
+        entries.erase(it);
+        metricIt->second.rebuildPrefix(position);
+    }
+
+    void AdaptiveIndex::removeMetric(const std::string &metric)
     {
         std::lock_guard<std::mutex> lock(mutex_);
+        metrics_.erase(metric);
+        for (auto it = patterns_.begin(); it != patterns_.end();)
+        {
+            if (it->second.metric == metric)
+            {
+                dropStructure(it->second);
+                it = patterns_.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
 
+    std::vector<size_t> AdaptiveIndex::findChunks(const std::string &metric,
+                                                  uint64_t startTime, uint64_t endTime) const
+    {
         std::vector<size_t> result;
+        if (startTime > endTime)
+            return result;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto metricIt = metrics_.find(metric);
+        if (metricIt == metrics_.end())
+            return result;
 
-        // Record query pattern
-        std::string pattern = metric;
-        for (const auto &[key, value] : tags)
+        const MetricIndex &index = metricIt->second;
+
+        // Entries past last start after endTime; entries before first all
+        // end before startTime
+        auto lastIt = std::upper_bound(index.entries.begin(), index.entries.end(), endTime,
+                                       [](uint64_t time, const IndexEntry &entry)
+                                       { return time < entry.minTime; });
+        size_t last = lastIt - index.entries.begin();
+        size_t first = std::lower_bound(index.maxPrefix.begin(), index.maxPrefix.begin() + last, startTime) -
+                       index.maxPrefix.begin();
+
+        for (size_t i = first; i < last; ++i)
         {
-            pattern += ":" + key + "=" + value;
+            if (index.entries[i].maxTime >= startTime)
+            {
+                result.push_back(index.entries[i].chunkId);
+            }
         }
-        queryPatterns_[pattern]++;
-        queryCount_++;
 
-        // Find matching chunks
-        for (const auto &entry : entries_)
+        return result;
+    }
+
+    AdaptiveIndex::SeriesList AdaptiveIndex::selectSeries(const std::string &metric,
+                                                          const std::unordered_map<std::string, std::string> &tags,
+                                                          size_t generation,
+                                                          const std::function<RoaringBitmap()> &compute)
+    {
+        std::string key = metric;
+        key.push_back('\0');
+        key += SeriesCatalog::canonicalKey(tags);
+
         {
-            // Check metric
-            if (entry.metric != metric)
+            std::lock_guard<std::mutex> lock(mutex_);
+            Pattern &pattern = patterns_[key];
+            if (pattern.queries == 0)
             {
-                continue;
+                pattern.metric = metric;
+                pattern.tags = tags;
             }
+            pattern.heat += 1.0;
+            pattern.queries++;
 
-            // Check time range overlap
-            if (entry.maxTime < startTime || entry.minTime > endTime)
+            SeriesList hit;
+            if (pattern.series && pattern.generation == generation)
+            {
+                pattern.hits++;
+                hits_++;
+                hit = pattern.series;
+            }
+            else
             {
-                continue;
+                misses_++;
             }
 
-            // Check tags
-            bool tagsMatch = true;
-            for (const auto &[key, value] : tags)
+            if (++queryCount_ % ADAPTIVE_DECAY_INTERVAL == 0)
+            {
+                decay();
+            }
+            if (hit)
             {
-                auto it = entry.tagIndex.find(key);
-                if (it == entry.tagIndex.end() || it->second.find(value) == it->second.end())
+                return hit;
+            }
+        }
+
+        // Evaluate outside the lock; the catalog has its own
+        auto series = std::make_shared<const RoaringBitmap>(compute());
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = patterns_.find(key);
+        if (it != patterns_.end() && it->second.heat >= HOT_PATTERN_QUERIES)
+        {
+            Pattern &pattern = it->second;
+            dropStructure(pattern);
+            size_t bytes = series->sizeInBytes() + key.size();
+            if (bytes <= budget_)
+            {
+                pattern.series = series;
+                pattern.generation = generation;
+                pattern.bytes = bytes;
+                bytes_ += bytes;
+                enforceBudget();
+            }
+        }
+        return series;
+    }
+
+    void AdaptiveIndex::dropStructure(Pattern &pattern)
+    {
+        bytes_ -= pattern.bytes;
+        pattern.bytes = 0;
+        pattern.series.reset();
+    }
+
+    void AdaptiveIndex::enforceBudget()
+    {
+        // Evict the coldest structures first
+        while (bytes_ > budget_)
+        {
+            Pattern *coldest = nullptr;
+            for (auto &[key, pattern] : patterns_)
+            {
+                if (pattern.series && (!coldest || pattern.heat < coldest->heat))
                 {
-                    tagsMatch = false;
-                    break;
+                    coldest = &pattern;
                 }
             }
-
-            if (tagsMatch)
+            if (!coldest)
             {
-                result.push_back(entry.chunkId);
+                break;
             }
+            dropStructure(*coldest);
         }
+    }
 
-        // Trigger optimization if query count is high
-        if (queryCount_ % 1000 == 0)
+    void AdaptiveIndex::decay()
+    {
+        for (auto it = patterns_.begin(); it != patterns_.end();)
         {
-            optimize();
+            it->second.heat *= 0.5;
+            if (it->second.heat < 1.0)
+            {
+                dropStructure(it->second);
+                it = patterns_.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
         }
+    }
 
-        return result;
+    void AdaptiveIndex::optimize()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        decay();
     }
 
-    void AdaptiveIndex::recordQuery(const std::string &pattern)
+    void AdaptiveIndex::setBudget(size_t bytes)
     {
         std::lock_guard<std::mutex> lock(mutex_);
-        queryPatterns_[pattern]++;
+        budget_ = bytes;
+        enforceBudget();
     }
 
-    void AdaptiveIndex::optimize()
+    AdaptiveIndexStats AdaptiveIndex::stats() const
     {
-        // Analyze query patterns and create specialized indexes
-        // for frequently accessed data
+        std::lock_guard<std::mutex> lock(mutex_);
+        AdaptiveIndexStats stats;
+        stats.queries = hits_ + misses_;
+        stats.hits = hits_;
+        stats.misses = misses_;
+        stats.bytes = bytes_;
+        stats.budget = budget_;
 
-        // Find most common query patterns
-        std::vector<std::pair<std::string, size_t>> patterns;
-        for (const auto &[pattern, count] : queryPatterns_)
+        for (const auto &[key, pattern] : patterns_)
         {
-            patterns.push_back({pattern, count});
+            AdaptivePatternStats entry;
+            entry.metric = pattern.metric;
+            std::vector<std::pair<std::string, std::string>> pairs(pattern.tags.begin(), pattern.tags.end());
+            std::sort(pairs.begin(), pairs.end());
+            for (const auto &[tagKey, value] : pairs)
+            {
+                if (!entry.tags.empty())
+                {
+                    entry.tags += ',';
+                }
+                entry.tags += tagKey + "=" + value;
+            }
+            entry.queries = pattern.queries;
+            entry.hits = pattern.hits;
+            entry.heat = pattern.heat;
+            entry.materialized = pattern.series != nullptr;
+            entry.bytes = pattern.bytes;
+            if (entry.materialized)
+            {
+                stats.structures++;
+            }
+            stats.patterns.push_back(std::move(entry));
         }
 
-        // Sort by frequency
-        std::sort(patterns.begin(), patterns.end(),
-                  [](const auto &a, const auto &b)
-                  {
-                      return a.second > b.second;
-                  });
-
-        // In a real implementation, we would:
-        // 1. Create specialized indexes for top patterns
-        // 2. Reorganize chunks for better locality
-        // 3. Build bloom filters for tag combinations
-        // 4. Create time-based partitions
-
-        // For now, just sort entries by metric and time for binary search
-        std::sort(entries_.begin(), entries_.end(),
-                  [](const IndexEntry &a, const IndexEntry &b)
+        std::sort(stats.patterns.begin(), stats.patterns.end(),
+                  [](const AdaptivePatternStats &a, const AdaptivePatternStats &b)
                   {
-                      if (a.metric != b.metric)
-                      {
-                          return a.metric < b.metric;
-                      }
-                      return a.minTime < b.minTime;
+                      return a.heat > b.heat;
                   });
+        return stats;
     }
 
     void AdaptiveIndex::clear()
     {
         std::lock_guard<std::mutex> lock(mutex_);
-        entries_.clear();
-        queryPatterns_.clear();
+        metrics_.clear();
+        patterns_.clear();
         queryCount_ = 0;
+        hits_ = 0;
+        misses_ = 0;
+        bytes_ = 0;
     }
 
-} // namespace waffledb
\ No newline at end of file
+} // namespace waffledb
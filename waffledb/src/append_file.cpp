@@ -0,0 +1,95 @@
+// waffledb/src/append_file.cpp
+#include "append_file.h"
+#include <stdexcept>
+#include <cerrno>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+namespace waffledb
+{
+
+    std::unique_ptr<AppendFile> AppendFile::open(const std::string &path, bool truncate)
+    {
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | (truncate ? O_TRUNC : 0), 0644);
+#else
+        int fd = ::_open(path.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY | (truncate ? _O_TRUNC : 0), 0644);
+#endif
+        if (fd < 0)
+        {
+            throw std::runtime_error("Failed to open " + path);
+        }
+        return std::unique_ptr<AppendFile>(new AppendFile(path, fd));
+    }
+
+    AppendFile::~AppendFile()
+    {
+#ifndef _WIN32
+        ::close(fd_);
+#else
+        ::_close(fd_);
+#endif
+    }
+
+    bool AppendFile::write(const uint8_t *data, size_t size)
+    {
+        while (size > 0)
+        {
+#ifndef _WIN32
+            ssize_t n = ::write(fd_, data, size);
+#else
+            int n = ::_write(fd_, data, static_cast<unsigned int>(size));
+#endif
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            data += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    bool AppendFile::sync()
+    {
+#if defined(_WIN32)
+        return ::_commit(fd_) == 0;
+#elif defined(__APPLE__)
+        return ::fsync(fd_) == 0;
+#else
+        return ::fdatasync(fd_) == 0;
+#endif
+    }
+
+    bool AppendFile::truncate(uint64_t size)
+    {
+#ifndef _WIN32
+        return ::ftruncate(fd_, static_cast<off_t>(size)) == 0;
+#else
+        return ::_chsize_s(fd_, static_cast<__int64>(size)) == 0;
+#endif
+    }
+
+    bool syncDirectory(const std::string &path)
+    {
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        bool synced = ::fsync(fd) == 0;
+        ::close(fd);
+        return synced;
+#else
+        // Directory entries cannot be flushed on their own here
+        (void)path;
+        return true;
+#endif
+    }
+
+} // namespace waffledb
@@ -0,0 +1,88 @@
+// waffledb/src/bloom_filter.cpp
+#include "bloom_filter.h"
+#include <algorithm>
+
+namespace waffledb
+{
+
+    namespace
+    {
+        uint64_t mix64(uint64_t x)
+        {
+            x ^= x >> 30;
+            x *= 0xBF58476D1CE4E5B9ULL;
+            x ^= x >> 27;
+            x *= 0x94D049BB133111EBULL;
+            x ^= x >> 31;
+            return x;
+        }
+
+        void fnv1a(uint64_t &h, const std::string &bytes)
+        {
+            for (unsigned char c : bytes)
+            {
+                h ^= c;
+                h *= 0x100000001B3ULL;
+            }
+        }
+    } // namespace
+
+    TagBloomFilter::TagBloomFilter(size_t pairs)
+        : words_(std::max<size_t>(1, (pairs * BITS_PER_PAIR + 63) / 64), 0)
+    {
+    }
+
+    uint64_t TagBloomFilter::hash(const std::string &key, const std::string &value)
+    {
+        uint64_t h = 0xCBF29CE484222325ULL;
+        fnv1a(h, key);
+        h ^= 0xFF; // separator, so "ab"="c" and "a"="bc" differ
+        h *= 0x100000001B3ULL;
+        fnv1a(h, value);
+        return mix64(h);
+    }
+
+    void TagBloomFilter::add(uint64_t pairHash)
+    {
+        if (words_.empty())
+            return;
+
+        // Double hashing: probe i is h1 + i * h2
+        uint64_t bits = words_.size() * 64;
+        uint64_t h1 = pairHash;
+        uint64_t h2 = mix64(pairHash) | 1;
+        for (uint32_t i = 0; i < PROBES; ++i)
+        {
+            uint64_t bit = (h1 + i * h2) % bits;
+            words_[bit / 64] |= 1ULL << (bit % 64);
+        }
+    }
+
+    bool TagBloomFilter::mayContain(uint64_t pairHash) const
+    {
+        if (words_.empty())
+            return true;
+
+        uint64_t bits = words_.size() * 64;
+        uint64_t h1 = pairHash;
+        uint64_t h2 = mix64(pairHash) | 1;
+        for (uint32_t i = 0; i < PROBES; ++i)
+        {
+            uint64_t bit = (h1 + i * h2) % bits;
+            if (!(words_[bit / 64] & (1ULL << (bit % 64))))
+                return false;
+        }
+        return true;
+    }
+
+    bool TagBloomFilter::mayContainAll(const std::unordered_map<std::string, std::string> &tags) const
+    {
+        for (const auto &[key, value] : tags)
+        {
+            if (!mayContain(hash(key, value)))
+                return false;
+        }
+        return true;
+    }
+
+} // namespace waffledb
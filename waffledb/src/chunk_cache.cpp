@@ -0,0 +1,212 @@
+// waffledb/src/chunk_cache.cpp
+#include "chunk_cache.h"
+
+namespace waffledb
+{
+
+    ChunkCache::ChunkCache(size_t budget)
+        : budget_(budget)
+    {
+    }
+
+    ChunkCache::Handle ChunkCache::get(const std::string &metric, size_t chunkId, const Loader &load)
+    {
+        Key key(metric, chunkId);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = index_.find(key);
+            if (it != index_.end())
+            {
+                ++hits_;
+                Slot &slot = slots_[it->second];
+                slot.referenced = true;
+                return Handle(slot.chunk);
+            }
+            ++misses_;
+        }
+
+        // Load outside the lock so a slow read does not stall other lookups
+        auto chunk = load();
+        if (!chunk)
+        {
+            return Handle();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        // Another caller may have loaded the same chunk meanwhile
+        auto it = index_.find(key);
+        if (it != index_.end())
+        {
+            slots_[it->second].referenced = true;
+            return Handle(slots_[it->second].chunk);
+        }
+
+        return Handle(insertLocked(key, std::move(chunk), false));
+    }
+
+    void ChunkCache::insert(const std::string &metric, size_t chunkId, std::unique_ptr<ColumnarChunk> chunk,
+                            bool dirty)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        Key key(metric, chunkId);
+        auto it = index_.find(key);
+        if (it != index_.end())
+        {
+            release(it->second);
+        }
+
+        insertLocked(key, std::move(chunk), dirty);
+    }
+
+    std::shared_ptr<ColumnarChunk> ChunkCache::insertLocked(const Key &key, std::unique_ptr<ColumnarChunk> chunk,
+                                                            bool dirty)
+    {
+        size_t index;
+        if (!freeSlots_.empty())
+        {
+            index = freeSlots_.back();
+            freeSlots_.pop_back();
+        }
+        else
+        {
+            index = slots_.size();
+            slots_.emplace_back();
+        }
+
+        Slot &slot = slots_[index];
+        slot.key = key;
+        slot.bytes = chunk->memoryUsage();
+        slot.chunk = std::move(chunk);
+        slot.referenced = true;
+        slot.dirty = dirty;
+
+        index_[key] = index;
+        bytes_ += slot.bytes;
+
+        // Keep a reference across eviction so the new chunk counts as pinned
+        std::shared_ptr<ColumnarChunk> resident = slot.chunk;
+        evict();
+        return resident;
+    }
+
+    void ChunkCache::markClean(const std::string &metric, size_t chunkId)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = index_.find(Key(metric, chunkId));
+        if (it != index_.end())
+        {
+            slots_[it->second].dirty = false;
+            evict();
+        }
+    }
+
+    std::vector<std::pair<std::string, size_t>> ChunkCache::dirtyChunks() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<std::pair<std::string, size_t>> dirty;
+        for (const auto &slot : slots_)
+        {
+            if (slot.chunk && slot.dirty)
+            {
+                dirty.push_back(slot.key);
+            }
+        }
+        return dirty;
+    }
+
+    void ChunkCache::release(size_t index)
+    {
+        Slot &slot = slots_[index];
+        index_.erase(slot.key);
+        bytes_ -= slot.bytes;
+
+        // Outstanding handles keep the chunk alive until they are dropped
+        slot.chunk.reset();
+        slot.key = Key();
+        slot.bytes = 0;
+        slot.referenced = false;
+        slot.dirty = false;
+        freeSlots_.push_back(index);
+    }
+
+    void ChunkCache::evict()
+    {
+        // Every slot gets at most two visits: one to clear its reference bit,
+        // one to evict it. Anything left is pinned or dirty.
+        size_t visits = 2 * slots_.size();
+        while (bytes_ > budget_ && visits-- > 0)
+        {
+            hand_ = (hand_ + 1) % slots_.size();
+            Slot &slot = slots_[hand_];
+
+            if (!slot.chunk || slot.dirty || slot.pinned())
+                continue;
+
+            if (slot.referenced)
+            {
+                slot.referenced = false;
+                continue;
+            }
+
+            release(hand_);
+            ++evictions_;
+        }
+    }
+
+    void ChunkCache::erase(const std::string &metric, size_t chunkId)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = index_.find(Key(metric, chunkId));
+        if (it != index_.end())
+        {
+            release(it->second);
+        }
+    }
+
+    void ChunkCache::erase(const std::string &metric)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < slots_.size(); ++i)
+        {
+            if (slots_[i].chunk && slots_[i].key.first == metric)
+            {
+                release(i);
+            }
+        }
+    }
+
+    void ChunkCache::clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        slots_.clear();
+        freeSlots_.clear();
+        index_.clear();
+        bytes_ = 0;
+        hand_ = 0;
+    }
+
+    void ChunkCache::setBudget(size_t budget)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        budget_ = budget;
+        evict();
+    }
+
+    ChunkCacheStats ChunkCache::stats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        ChunkCacheStats stats;
+        stats.hits = hits_;
+        stats.misses = misses_;
+        stats.evictions = evictions_;
+        stats.entries = index_.size();
+        stats.bytes = bytes_;
+        stats.budget = budget_;
+        return stats;
+    }
+
+} // namespace waffledb
@@ -1,5 +1,6 @@
 // waffledb/src/columnar_storage.cpp
 #include "columnar_storage.h"
+#include "serialization.h"
 #include "compression.h"
 #include <fstream>
 #include <filesystem>
@@ -7,6 +8,10 @@
 #include <cstring>
 #include <sstream>
 #include <iostream>
+#include <limits>
+#include <unordered_set>
+#include <atomic>
+#include <tuple>
 
 // Add SIMD headers for AVX2 support
 #ifdef __AVX2__
@@ -20,27 +25,59 @@ namespace fs = std::filesystem;
 namespace waffledb
 {
 
-    ColumnarChunk::ColumnarChunk()
-        : compressor_(std::make_unique<CompressionEngine>())
+    ColumnarChunk::ColumnarChunk(std::shared_ptr<SeriesCatalog> catalog)
+        : catalog_(catalog ? std::move(catalog) : std::make_shared<SeriesCatalog>()),
+          compressor_(std::make_unique<CompressionEngine>())
     {
         timestamps_.reserve(VALUES_PER_CHUNK);
         values_.reserve(VALUES_PER_CHUNK);
-        tags_.reserve(VALUES_PER_CHUNK);
+        seriesIds_.reserve(VALUES_PER_CHUNK);
     }
 
     ColumnarChunk::~ColumnarChunk() = default;
 
     void ColumnarChunk::append(uint64_t timestamp, double value,
                                const std::unordered_map<std::string, std::string> &tags)
+    {
+        append(timestamp, value, catalog_->intern(tags));
+    }
+
+    void ColumnarChunk::append(uint64_t timestamp, double value, uint32_t seriesId)
     {
         if (count_ >= VALUES_PER_CHUNK)
         {
             throw std::runtime_error("Chunk is full");
         }
+        if (compressed_)
+        {
+            throw std::runtime_error("Chunk is sealed");
+        }
+
+        if (count_ == 0 || timestamp >= timestamps_.back())
+        {
+            timestamps_.push_back(timestamp);
+            values_.push_back(value);
+            seriesIds_.push_back(seriesId);
+        }
+        else
+        {
+            // Late point: insert after any equal timestamps so the columns
+            // stay sorted and range lookups stay binary searches
+            size_t pos = std::upper_bound(timestamps_.begin(), timestamps_.end(), timestamp) - timestamps_.begin();
+            timestamps_.insert(timestamps_.begin() + pos, timestamp);
+            values_.insert(values_.begin() + pos, value);
+            seriesIds_.insert(seriesIds_.begin() + pos, seriesId);
+        }
+        seriesId_ = count_ == 0 || seriesId_ == seriesId ? seriesId : MIXED_SERIES;
 
-        timestamps_.push_back(timestamp);
-        values_.push_back(value);
-        tags_.push_back(tags);
+        if (count_ == 0 || timestamp < minTimestamp_)
+        {
+            stats_.first = value;
+        }
+        if (count_ == 0 || timestamp >= maxTimestamp_)
+        {
+            stats_.last = value;
+        }
 
         if (count_ == 0)
         {
@@ -53,20 +90,138 @@ namespace waffledb
             maxTimestamp_ = std::max(maxTimestamp_, timestamp);
         }
         count_++;
+
+        stats_.count = count_;
+        stats_.sum += value;
+        stats_.sumSquares += value * value;
+        stats_.min = std::min(stats_.min, value);
+        stats_.max = std::max(stats_.max, value);
+    }
+
+    ColumnarChunk::ColumnView ColumnarChunk::columns() const
+    {
+        ColumnView view;
+        view.count_ = count_;
+
+        if (!compressed_)
+        {
+            view.timestamps_ = timestamps_.data();
+            view.values_ = values_.data();
+            return view;
+        }
+
+        // Uncompressed blocks are viewed in place, others decode into the view
+        view.timestamps_ = plainTimestamps();
+        if (!view.timestamps_)
+        {
+            view.decoded_.timestamps = compressor_->decodeTimestamps(
+                compressedData_.timestampCodec, timestampBlock_, timestampBlockSize_);
+            if (view.decoded_.timestamps.size() != count_)
+            {
+                throw std::runtime_error("Corrupt chunk: decoded column size mismatch");
+            }
+            view.timestamps_ = view.decoded_.timestamps.data();
+        }
+
+        view.values_ = plainValues();
+        if (!view.values_)
+        {
+            view.decoded_.values = compressor_->decodeValues(
+                compressedData_.valueCodec, valueBlock_, valueBlockSize_);
+            if (view.decoded_.values.size() != count_)
+            {
+                throw std::runtime_error("Corrupt chunk: decoded column size mismatch");
+            }
+            view.values_ = view.decoded_.values.data();
+        }
+        return view;
+    }
+
+    namespace
+    {
+        std::pair<size_t, size_t> sortedRange(const uint64_t *timestamps, size_t count,
+                                              uint64_t startTime, uint64_t endTime)
+        {
+            const uint64_t *first = std::lower_bound(timestamps, timestamps + count, startTime);
+            const uint64_t *last = std::upper_bound(first, timestamps + count, endTime);
+            return {static_cast<size_t>(first - timestamps), static_cast<size_t>(last - timestamps)};
+        }
+    } // namespace
+
+    std::pair<size_t, size_t> ColumnarChunk::ColumnView::timeRange(uint64_t startTime, uint64_t endTime) const
+    {
+        return sortedRange(timestamps_, count_, startTime, endTime);
+    }
+
+    std::pair<size_t, size_t> ColumnarChunk::indexRange(uint64_t startTime, uint64_t endTime) const
+    {
+        if (!compressed_)
+        {
+            return sortedRange(timestamps_.data(), count_, startTime, endTime);
+        }
+
+        // Constant-stride columns are resolved arithmetically, nothing to decode
+        if (compressedData_.timestampCodec == "stride")
+        {
+            auto stride = ConstantStrideEncoding::decode(timestampBlock_, timestampBlockSize_);
+            return stride.indexRange(startTime, endTime);
+        }
+
+        // Uncompressed columns are searched in place, possibly in page cache
+        if (const uint64_t *timestamps = plainTimestamps())
+        {
+            return sortedRange(timestamps, count_, startTime, endTime);
+        }
+
+        std::vector<uint64_t> timestamps = compressor_->decodeTimestamps(
+            compressedData_.timestampCodec, timestampBlock_, timestampBlockSize_);
+        return sortedRange(timestamps.data(), std::min(count_, timestamps.size()), startTime, endTime);
+    }
+
+    template <typename Fn>
+    void ColumnarChunk::scanValues(size_t first, size_t last, Fn &&fn) const
+    {
+        if (!compressed_)
+        {
+            for (size_t i = first; i < last; ++i)
+            {
+                fn(values_[i]);
+            }
+            return;
+        }
+
+        if (compressedData_.valueCodec == "gorilla")
+        {
+            GorillaDecoder decoder(valueBlock_, valueBlockSize_);
+            decoder.skip(first);
+
+            double value;
+            for (size_t i = first; i < last && decoder.next(value); ++i)
+            {
+                fn(value);
+            }
+            return;
+        }
+
+        std::vector<double> values = compressor_->decodeValues(
+            compressedData_.valueCodec, valueBlock_, valueBlockSize_);
+        last = std::min(last, values.size());
+        for (size_t i = first; i < last; ++i)
+        {
+            fn(values[i]);
+        }
     }
 
     std::vector<size_t> ColumnarChunk::queryTimeRange(uint64_t startTime, uint64_t endTime) const
     {
         std::vector<size_t> indices;
-        indices.reserve(count_);
 
-        // Binary search for start position
-        auto startIt = std::lower_bound(timestamps_.begin(), timestamps_.begin() + count_, startTime);
-        auto endIt = std::upper_bound(timestamps_.begin(), timestamps_.begin() + count_, endTime);
+        auto [first, last] = indexRange(startTime, endTime);
 
-        for (auto it = startIt; it != endIt; ++it)
+        indices.reserve(last - first);
+        for (size_t i = first; i < last; ++i)
         {
-            indices.push_back(it - timestamps_.begin());
+            indices.push_back(i);
         }
 
         return indices;
@@ -77,19 +232,17 @@ namespace waffledb
     {
         std::vector<size_t> indices;
 
+        // Test each distinct series once; points only compare IDs
+        std::unordered_map<uint32_t, bool> matches;
         for (size_t i = 0; i < count_; ++i)
         {
-            bool match = true;
-            for (const auto &[key, value] : queryTags)
+            uint32_t id = seriesIdAt(i);
+            auto it = matches.find(id);
+            if (it == matches.end())
             {
-                auto it = tags_[i].find(key);
-                if (it == tags_[i].end() || it->second != value)
-                {
-                    match = false;
-                    break;
-                }
+                it = matches.emplace(id, catalog_->matches(id, queryTags)).first;
             }
-            if (match)
+            if (it->second)
             {
                 indices.push_back(i);
             }
@@ -99,10 +252,10 @@ namespace waffledb
     }
 
     // SIMD-optimized sum using AVX2
-    double ColumnarChunk::sumSIMD(size_t start, size_t end) const
+    double ColumnarChunk::sumSIMD(const double *values, size_t start, size_t end) const
     {
 #if defined(__AVX2__) || (defined(_MSC_VER) && defined(__AVX2__))
-        const double *data = values_.data() + start;
+        const double *data = values + start;
         size_t n = end - start;
 
         __m256d sum_vec = _mm256_setzero_pd();
@@ -132,58 +285,159 @@ namespace waffledb
         double sum = 0.0;
         for (size_t i = start; i < end; ++i)
         {
-            sum += values_[i];
+            sum += values[i];
         }
         return sum;
 #endif
     }
 
-    double ColumnarChunk::sum(uint64_t startTime, uint64_t endTime) const
+    const double *ColumnarChunk::plainValues() const
     {
-        auto indices = queryTimeRange(startTime, endTime);
-        if (indices.empty())
-            return 0.0;
+        if (!compressed_)
+        {
+            return values_.data();
+        }
+        if (compressedData_.valueCodec == "none" && valueBlockSize_ >= count_ * sizeof(double))
+        {
+            return reinterpret_cast<const double *>(valueBlock_);
+        }
+        return nullptr;
+    }
 
-        // If indices are contiguous, use SIMD
-        bool contiguous = true;
-        for (size_t i = 1; i < indices.size(); ++i)
+    const uint64_t *ColumnarChunk::plainTimestamps() const
+    {
+        if (!compressed_)
         {
-            if (indices[i] != indices[i - 1] + 1)
-            {
-                contiguous = false;
-                break;
-            }
+            return timestamps_.data();
+        }
+        if (compressedData_.timestampCodec == "none" && timestampBlockSize_ >= count_ * sizeof(uint64_t))
+        {
+            return reinterpret_cast<const uint64_t *>(timestampBlock_);
         }
+        return nullptr;
+    }
 
-        if (contiguous && indices.size() >= 4)
+    size_t ColumnarChunk::memoryUsage() const
+    {
+        size_t bytes = sizeof(ColumnarChunk);
+        bytes += timestamps_.capacity() * sizeof(uint64_t);
+        bytes += values_.capacity() * sizeof(double);
+        bytes += compressedData_.timestamps.capacity() + compressedData_.values.capacity();
+        if (mapping_)
         {
-            return sumSIMD(indices.front(), indices.back() + 1);
+            // Only the chunk's own blocks; the mapping spans its whole file
+            bytes += timestampBlockSize_ + valueBlockSize_;
         }
 
-        // Otherwise, sum individual values
-        double total = 0.0;
-        for (size_t idx : indices)
+        bytes += seriesIds_.capacity() * sizeof(uint32_t);
+        return bytes;
+    }
+
+    void ColumnarChunk::bindBlocks()
+    {
+        mapping_.reset();
+        timestampBlock_ = compressedData_.timestamps.data();
+        timestampBlockSize_ = compressedData_.timestamps.size();
+        valueBlock_ = compressedData_.values.data();
+        valueBlockSize_ = compressedData_.values.size();
+    }
+
+    double ColumnarChunk::sumRange(size_t first, size_t last) const
+    {
+        // Matching indices are always contiguous, use SIMD on plain columns
+        if (const double *values = plainValues())
+        {
+            return sumSIMD(values, first, last);
+        }
+
+        if (compressedData_.valueCodec == "rle")
         {
-            total += values_[idx];
+            return RunLengthEncoding::aggregateRange(valueBlock_, valueBlockSize_, first, last)
+                .sum;
         }
+
+        double total = 0.0;
+        scanValues(first, last, [&total](double value)
+                   { total += value; });
         return total;
     }
 
+    double ColumnarChunk::minRange(size_t first, size_t last) const
+    {
+        if (const double *values = plainValues())
+        {
+            return minSIMD(values, first, last);
+        }
+
+        if (compressedData_.valueCodec == "rle")
+        {
+            return RunLengthEncoding::aggregateRange(valueBlock_, valueBlockSize_, first, last)
+                .min;
+        }
+
+        double min_val = std::numeric_limits<double>::max();
+        scanValues(first, last, [&min_val](double value)
+                   { min_val = std::min(min_val, value); });
+        return min_val;
+    }
+
+    double ColumnarChunk::maxRange(size_t first, size_t last) const
+    {
+        if (const double *values = plainValues())
+        {
+            return maxSIMD(values, first, last);
+        }
+
+        if (compressedData_.valueCodec == "rle")
+        {
+            return RunLengthEncoding::aggregateRange(valueBlock_, valueBlockSize_, first, last)
+                .max;
+        }
+
+        double max_val = std::numeric_limits<double>::lowest();
+        scanValues(first, last, [&max_val](double value)
+                   { max_val = std::max(max_val, value); });
+        return max_val;
+    }
+
+    size_t ColumnarChunk::count(uint64_t startTime, uint64_t endTime) const
+    {
+        if (coveredBy(startTime, endTime))
+            return count_;
+
+        auto [first, last] = indexRange(startTime, endTime);
+        return last - first;
+    }
+
+    double ColumnarChunk::sum(uint64_t startTime, uint64_t endTime) const
+    {
+        if (count_ > 0 && coveredBy(startTime, endTime))
+            return stats_.sum;
+
+        auto [first, last] = indexRange(startTime, endTime);
+        if (first == last)
+            return 0.0;
+
+        return sumRange(first, last);
+    }
+
     double ColumnarChunk::avg(uint64_t startTime, uint64_t endTime) const
     {
-        auto indices = queryTimeRange(startTime, endTime);
-        if (indices.empty())
+        if (count_ > 0 && coveredBy(startTime, endTime))
+            return stats_.sum / count_;
+
+        auto [first, last] = indexRange(startTime, endTime);
+        if (first == last)
             return 0.0;
 
-        double total = sum(startTime, endTime);
-        return total / indices.size();
+        return sumRange(first, last) / (last - first);
     }
 
     // SIMD-optimized min using AVX2
-    double ColumnarChunk::minSIMD(size_t start, size_t end) const
+    double ColumnarChunk::minSIMD(const double *values, size_t start, size_t end) const
     {
 #if defined(__AVX2__) || (defined(_MSC_VER) && defined(__AVX2__))
-        const double *data = values_.data() + start;
+        const double *data = values + start;
         size_t n = end - start;
 
         __m256d min_vec = _mm256_set1_pd(std::numeric_limits<double>::max());
@@ -213,7 +467,7 @@ namespace waffledb
         double min_val = std::numeric_limits<double>::max();
         for (size_t i = start; i < end; ++i)
         {
-            min_val = std::min(min_val, values_[i]);
+            min_val = std::min(min_val, values[i]);
         }
         return min_val;
 #endif
@@ -221,40 +475,21 @@ namespace waffledb
 
     double ColumnarChunk::min(uint64_t startTime, uint64_t endTime) const
     {
-        auto indices = queryTimeRange(startTime, endTime);
-        if (indices.empty())
-            return 0.0;
-
-        // Check if indices are contiguous for SIMD optimization
-        bool contiguous = true;
-        for (size_t i = 1; i < indices.size(); ++i)
-        {
-            if (indices[i] != indices[i - 1] + 1)
-            {
-                contiguous = false;
-                break;
-            }
-        }
+        if (count_ > 0 && coveredBy(startTime, endTime))
+            return stats_.min;
 
-        if (contiguous && indices.size() >= 4)
-        {
-            return minSIMD(indices.front(), indices.back() + 1);
-        }
+        auto [first, last] = indexRange(startTime, endTime);
+        if (first == last)
+            return 0.0;
 
-        // Otherwise, find min of individual values
-        double min_val = std::numeric_limits<double>::max();
-        for (size_t idx : indices)
-        {
-            min_val = std::min(min_val, values_[idx]);
-        }
-        return min_val;
+        return minRange(first, last);
     }
 
     // SIMD-optimized max using AVX2
-    double ColumnarChunk::maxSIMD(size_t start, size_t end) const
+    double ColumnarChunk::maxSIMD(const double *values, size_t start, size_t end) const
     {
 #if defined(__AVX2__) || (defined(_MSC_VER) && defined(__AVX2__))
-        const double *data = values_.data() + start;
+        const double *data = values + start;
         size_t n = end - start;
 
         __m256d max_vec = _mm256_set1_pd(std::numeric_limits<double>::lowest());
@@ -284,7 +519,7 @@ namespace waffledb
         double max_val = std::numeric_limits<double>::lowest();
         for (size_t i = start; i < end; ++i)
         {
-            max_val = std::max(max_val, values_[i]);
+            max_val = std::max(max_val, values[i]);
         }
         return max_val;
 #endif
@@ -292,33 +527,14 @@ namespace waffledb
 
     double ColumnarChunk::max(uint64_t startTime, uint64_t endTime) const
     {
-        auto indices = queryTimeRange(startTime, endTime);
-        if (indices.empty())
-            return 0.0;
-
-        // Check if indices are contiguous for SIMD optimization
-        bool contiguous = true;
-        for (size_t i = 1; i < indices.size(); ++i)
-        {
-            if (indices[i] != indices[i - 1] + 1)
-            {
-                contiguous = false;
-                break;
-            }
-        }
+        if (count_ > 0 && coveredBy(startTime, endTime))
+            return stats_.max;
 
-        if (contiguous && indices.size() >= 4)
-        {
-            return maxSIMD(indices.front(), indices.back() + 1);
-        }
+        auto [first, last] = indexRange(startTime, endTime);
+        if (first == last)
+            return 0.0;
 
-        // Otherwise, find max of individual values
-        double max_val = std::numeric_limits<double>::lowest();
-        for (size_t idx : indices)
-        {
-            max_val = std::max(max_val, values_[idx]);
-        }
-        return max_val;
+        return maxRange(first, last);
     }
 
     void ColumnarChunk::compress()
@@ -326,331 +542,1415 @@ namespace waffledb
         if (compressed_)
             return;
 
-        auto compressed = compressor_->compressColumns(
+        compressedData_ = compressor_->compressColumns(
             timestamps_.data(), values_.data(), count_);
+        bindBlocks();
 
-        // Replace data with compressed versions
-        // In a real implementation, we'd store the compressed data
-        // and clear the uncompressed vectors
+        // Release the raw columns, the codec output is now authoritative
+        std::vector<uint64_t>().swap(timestamps_);
+        std::vector<double>().swap(values_);
         compressed_ = true;
+        releaseSeriesIds();
     }
 
-    void ColumnarChunk::decompress()
+    // A sealed chunk of one series answers seriesIdAt from seriesId_ alone
+    void ColumnarChunk::releaseSeriesIds()
     {
-        if (!compressed_)
-            return;
-
-        // In a real implementation, decompress the data
-        compressed_ = false;
+        if (compressed_ && seriesId_ != MIXED_SERIES)
+        {
+            std::vector<uint32_t>().swap(seriesIds_);
+        }
     }
 
-    std::vector<uint8_t> ColumnarChunk::serialize() const
+    std::unique_ptr<ColumnarChunk> ColumnarChunk::compressedCopy() const
     {
-        std::vector<uint8_t> buffer;
-
-        // Calculate total size needed for better memory allocation
-        size_t totalSize = sizeof(uint64_t) * 2 + sizeof(size_t) + // header
-                           count_ * sizeof(uint64_t) +             // timestamps
-                           count_ * sizeof(double);                // values
+        auto copy = std::make_unique<ColumnarChunk>(catalog_);
+        ColumnView view = columns();
+        copy->timestamps_.assign(view.timestamps(), view.timestamps() + count_);
+        copy->values_.assign(view.values(), view.values() + count_);
+        copy->seriesIds_ = seriesIds_;
+        copy->seriesId_ = seriesId_;
+        copy->minTimestamp_ = minTimestamp_;
+        copy->maxTimestamp_ = maxTimestamp_;
+        copy->count_ = count_;
+        copy->stats_ = stats_;
+        copy->compress();
+        return copy;
+    }
 
-        // Estimate tag size
-        for (const auto &tag_map : tags_)
+    std::unique_ptr<ColumnarChunk> ColumnarChunk::fromSorted(std::vector<uint64_t> timestamps,
+                                                             std::vector<double> values,
+                                                             std::vector<uint32_t> seriesIds,
+                                                             std::shared_ptr<SeriesCatalog> catalog)
+    {
+        if (timestamps.size() != values.size() || timestamps.size() != seriesIds.size())
         {
-            totalSize += sizeof(uint32_t); // tag count
-            for (const auto &[key, value] : tag_map)
-            {
-                totalSize += sizeof(uint32_t) + key.length() +
-                             sizeof(uint32_t) + value.length();
-            }
+            throw std::runtime_error("Column sizes differ");
+        }
+        if (timestamps.size() > VALUES_PER_SEGMENT)
+        {
+            throw std::runtime_error("Segment is too large");
         }
 
-        buffer.reserve(totalSize);
+        auto chunk = std::make_unique<ColumnarChunk>(std::move(catalog));
+        chunk->timestamps_ = std::move(timestamps);
+        chunk->values_ = std::move(values);
+        chunk->seriesIds_ = std::move(seriesIds);
+        chunk->count_ = chunk->timestamps_.size();
 
-        // Write header
-        buffer.resize(sizeof(uint64_t) * 2 + sizeof(size_t));
-        uint8_t *ptr = buffer.data();
-
-        std::memcpy(ptr, &minTimestamp_, sizeof(uint64_t));
-        ptr += sizeof(uint64_t);
-        std::memcpy(ptr, &maxTimestamp_, sizeof(uint64_t));
-        ptr += sizeof(uint64_t);
-        std::memcpy(ptr, &count_, sizeof(size_t));
-
-        // Write timestamps
-        size_t timestamps_size = count_ * sizeof(uint64_t);
-        size_t old_size = buffer.size();
-        buffer.resize(old_size + timestamps_size);
-        std::memcpy(buffer.data() + old_size, timestamps_.data(), timestamps_size);
-
-        // Write values
-        size_t values_size = count_ * sizeof(double);
-        old_size = buffer.size();
-        buffer.resize(old_size + values_size);
-        std::memcpy(buffer.data() + old_size, values_.data(), values_size);
-
-        // Write tags with better format
-        for (const auto &tag_map : tags_)
-        {
-            // Write tag count for this entry
-            uint32_t tag_count = static_cast<uint32_t>(tag_map.size());
-            old_size = buffer.size();
-            buffer.resize(old_size + sizeof(uint32_t));
-            std::memcpy(buffer.data() + old_size, &tag_count, sizeof(uint32_t));
-
-            // Write each tag key-value pair
-            for (const auto &[key, value] : tag_map)
-            {
-                // Write key
-                uint32_t key_len = static_cast<uint32_t>(key.length());
-                old_size = buffer.size();
-                buffer.resize(old_size + sizeof(uint32_t) + key_len);
-                std::memcpy(buffer.data() + old_size, &key_len, sizeof(uint32_t));
-                std::memcpy(buffer.data() + old_size + sizeof(uint32_t), key.data(), key_len);
-
-                // Write value
-                uint32_t value_len = static_cast<uint32_t>(value.length());
-                old_size = buffer.size();
-                buffer.resize(old_size + sizeof(uint32_t) + value_len);
-                std::memcpy(buffer.data() + old_size, &value_len, sizeof(uint32_t));
-                std::memcpy(buffer.data() + old_size + sizeof(uint32_t), value.data(), value_len);
-            }
+        ChunkStats &stats = chunk->stats_;
+        stats.count = chunk->count_;
+        for (size_t i = 0; i < chunk->count_; ++i)
+        {
+            double value = chunk->values_[i];
+            stats.sum += value;
+            stats.sumSquares += value * value;
+            stats.min = std::min(stats.min, value);
+            stats.max = std::max(stats.max, value);
+
+            uint32_t seriesId = chunk->seriesIds_[i];
+            chunk->seriesId_ = i == 0 || chunk->seriesId_ == seriesId ? seriesId : MIXED_SERIES;
         }
 
-        return buffer;
-    }
-
-    void ColumnarChunk::deserialize(const std::vector<uint8_t> &data)
-    {
-        if (data.size() < sizeof(uint64_t) * 2 + sizeof(size_t))
+        if (chunk->count_ > 0)
         {
-            throw std::runtime_error("Invalid chunk data: too small for header");
+            chunk->minTimestamp_ = chunk->timestamps_.front();
+            chunk->maxTimestamp_ = chunk->timestamps_.back();
+            stats.first = chunk->values_.front();
+            stats.last = chunk->values_.back();
         }
 
-        const uint8_t *ptr = data.data();
-        size_t remaining = data.size();
+        chunk->compress();
+        return chunk;
+    }
 
-        // Read header
-        std::memcpy(&minTimestamp_, ptr, sizeof(uint64_t));
-        ptr += sizeof(uint64_t);
-        remaining -= sizeof(uint64_t);
+    void ColumnarChunk::decompress()
+    {
+        if (!compressed_)
+            return;
 
-        std::memcpy(&maxTimestamp_, ptr, sizeof(uint64_t));
-        ptr += sizeof(uint64_t);
-        remaining -= sizeof(uint64_t);
+        ColumnView view = columns();
+        timestamps_.assign(view.timestamps(), view.timestamps() + count_);
+        values_.assign(view.values(), view.values() + count_);
 
-        std::memcpy(&count_, ptr, sizeof(size_t));
-        ptr += sizeof(size_t);
-        remaining -= sizeof(size_t);
+        compressedData_ = CompressionEngine::CompressedData();
+        bindBlocks();
+        compressed_ = false;
+    }
 
-        // Validate count
-        if (count_ > VALUES_PER_CHUNK)
+    namespace
+    {
+        // On-disk chunk layout (little endian):
+        //   magic, version, minTimestamp, maxTimestamp, count
+        //   stats: sum, sumSquares, min, max, first, last (version 2+)
+        //   tag filter word count and words (version 5+)
+        //   timestamp codec name, timestamp block size, timestamp block
+        //   value codec name, value block size, value block
+        //   per-point tags (versions 1-3), or from version 4 a series
+        //   dictionary (count, then tag sets) and a bit-packed block of
+        //   per-point dictionary indices
+        // From version 3 each block is zero-padded to start on an 8-byte
+        // file offset so mapped files can be read as uint64/double arrays.
+        // Files written before the codec blocks existed start directly with
+        // minTimestamp and carry raw columns; they are still readable.
+        constexpr uint32_t CHUNK_MAGIC = 0x4B434657; // "WFCK"
+        constexpr uint32_t CHUNK_VERSION = 5;
+        constexpr size_t BLOCK_ALIGNMENT = 8;
+
+        // Bytes of a version 2 header up to and including the stats
+        constexpr size_t CHUNK_HEADER_SIZE = 2 * sizeof(uint32_t) + 3 * sizeof(uint64_t) + 6 * sizeof(double);
+
+        // Chunk directory layout: magic, version, metric count, then per
+        // metric its name and one record per chunk. Version 2 appends the
+        // chunk's series ID to each record, version 3 its tag filter.
+        constexpr uint32_t DIRECTORY_MAGIC = 0x44434657; // "WFCD"
+        constexpr uint32_t DIRECTORY_VERSION = 4;
+
+        // Named in read errors
+        constexpr const char *CHUNK_SOURCE = "chunk data";
+        constexpr const char *DIRECTORY_SOURCE = "chunk directory";
+
+        void appendBlock(std::vector<uint8_t> &buffer, const std::string &codec,
+                         const uint8_t *block, size_t size)
         {
-            throw std::runtime_error("Invalid chunk data: count too large");
+            appendPod(buffer, static_cast<uint8_t>(codec.size()));
+            buffer.insert(buffer.end(), codec.begin(), codec.end());
+            appendPod(buffer, static_cast<uint32_t>(size));
+            buffer.resize(buffer.size() + (BLOCK_ALIGNMENT - buffer.size() % BLOCK_ALIGNMENT) % BLOCK_ALIGNMENT, 0);
+            buffer.insert(buffer.end(), block, block + size);
         }
 
-        // Read timestamps
-        size_t timestamps_size = count_ * sizeof(uint64_t);
-        if (remaining < timestamps_size)
+        void appendTags(std::vector<uint8_t> &buffer, const std::unordered_map<std::string, std::string> &tags)
         {
-            throw std::runtime_error("Invalid chunk data: insufficient data for timestamps");
+            appendPod(buffer, static_cast<uint32_t>(tags.size()));
+            for (const auto &[key, value] : tags)
+            {
+                appendString(buffer, key);
+                appendString(buffer, value);
+            }
         }
 
-        timestamps_.resize(count_);
-        std::memcpy(timestamps_.data(), ptr, timestamps_size);
-        ptr += timestamps_size;
-        remaining -= timestamps_size;
+        void appendFilter(std::vector<uint8_t> &buffer, const TagBloomFilter &filter)
+        {
+            const auto &words = filter.words();
+            appendPod(buffer, static_cast<uint32_t>(words.size()));
+            size_t oldSize = buffer.size();
+            buffer.resize(oldSize + words.size() * sizeof(uint64_t));
+            std::memcpy(buffer.data() + oldSize, words.data(), words.size() * sizeof(uint64_t));
+        }
 
-        // Read values
-        size_t values_size = count_ * sizeof(double);
-        if (remaining < values_size)
+        TagBloomFilter readFilter(const uint8_t *&ptr, size_t &remaining)
         {
-            throw std::runtime_error("Invalid chunk data: insufficient data for values");
+            uint32_t wordCount = readPod<uint32_t>(ptr, remaining, CHUNK_SOURCE, "tag filter");
+            if (wordCount > TagBloomFilter::MAX_WORDS || remaining < wordCount * sizeof(uint64_t))
+            {
+                throw std::runtime_error("Invalid chunk data: bad tag filter");
+            }
+            std::vector<uint64_t> words(wordCount);
+            std::memcpy(words.data(), ptr, wordCount * sizeof(uint64_t));
+            ptr += wordCount * sizeof(uint64_t);
+            remaining -= wordCount * sizeof(uint64_t);
+
+            TagBloomFilter filter;
+            filter.assign(std::move(words));
+            return filter;
         }
 
-        values_.resize(count_);
-        std::memcpy(values_.data(), ptr, values_size);
-        ptr += values_size;
-        remaining -= values_size;
+        // Parses a block header and returns where its bytes start; aligned
+        // layouts skip the padding that precedes the bytes
+        const uint8_t *readBlock(const uint8_t *base, const uint8_t *&ptr, size_t &remaining,
+                                 bool aligned, std::string &codec, size_t &blockSize)
+        {
+            uint8_t codecLen = readPod<uint8_t>(ptr, remaining, CHUNK_SOURCE, "codec name");
+            if (remaining < codecLen)
+            {
+                throw std::runtime_error("Invalid chunk data: insufficient data for codec name");
+            }
+            codec.assign(reinterpret_cast<const char *>(ptr), codecLen);
+            ptr += codecLen;
+            remaining -= codecLen;
+
+            blockSize = readPod<uint32_t>(ptr, remaining, CHUNK_SOURCE, "column block size");
 
-        // Read tags
-        tags_.resize(count_);
-        for (size_t i = 0; i < count_; ++i)
+            size_t padding = aligned ? (BLOCK_ALIGNMENT - (ptr - base) % BLOCK_ALIGNMENT) % BLOCK_ALIGNMENT : 0;
+            if (remaining < padding + blockSize)
+            {
+                throw std::runtime_error("Invalid chunk data: insufficient data for column block");
+            }
+
+            const uint8_t *block = ptr + padding;
+            ptr += padding + blockSize;
+            remaining -= padding + blockSize;
+            return block;
+        }
+
+        std::string readTagString(const uint8_t *&ptr, size_t &remaining, const char *what)
         {
-            if (remaining < sizeof(uint32_t))
+            uint32_t length = readPod<uint32_t>(ptr, remaining, CHUNK_SOURCE, what);
+            if (length > 256 || remaining < length)
             {
-                throw std::runtime_error("Invalid chunk data: insufficient data for tag count");
+                throw std::runtime_error(std::string("Invalid chunk data: invalid ") + what);
             }
 
-            uint32_t tag_count;
-            std::memcpy(&tag_count, ptr, sizeof(uint32_t));
-            ptr += sizeof(uint32_t);
-            remaining -= sizeof(uint32_t);
+            std::string result(reinterpret_cast<const char *>(ptr), length);
+            ptr += length;
+            remaining -= length;
+            return result;
+        }
+
+        std::unordered_map<std::string, std::string> readTags(const uint8_t *&ptr, size_t &remaining)
+        {
+            uint32_t tag_count = readPod<uint32_t>(ptr, remaining, CHUNK_SOURCE, "tag count");
 
             if (tag_count > 100) // Sanity check
             {
                 throw std::runtime_error("Invalid chunk data: too many tags");
             }
 
+            std::unordered_map<std::string, std::string> tags;
             for (uint32_t j = 0; j < tag_count; ++j)
             {
-                // Read key
-                if (remaining < sizeof(uint32_t))
-                {
-                    throw std::runtime_error("Invalid chunk data: insufficient data for key length");
-                }
-
-                uint32_t key_len;
-                std::memcpy(&key_len, ptr, sizeof(uint32_t));
-                ptr += sizeof(uint32_t);
-                remaining -= sizeof(uint32_t);
+                std::string key = readTagString(ptr, remaining, "key length");
+                tags[key] = readTagString(ptr, remaining, "value length");
+            }
+            return tags;
+        }
+    } // namespace
 
-                if (key_len > 256 || remaining < key_len)
-                {
-                    throw std::runtime_error("Invalid chunk data: invalid key length");
-                }
+    std::vector<uint8_t> ColumnarChunk::serialize() const
+    {
+        std::vector<uint8_t> buffer;
 
-                std::string key(reinterpret_cast<const char *>(ptr), key_len);
-                ptr += key_len;
-                remaining -= key_len;
+        // Active chunks are saved on shutdown without being sealed first
+        CompressionEngine::CompressedData encoded;
+        const uint8_t *timestampBlock = timestampBlock_;
+        size_t timestampBlockSize = timestampBlockSize_;
+        const uint8_t *valueBlock = valueBlock_;
+        size_t valueBlockSize = valueBlockSize_;
+        const CompressionEngine::CompressedData *columns = &compressedData_;
+        if (!compressed_)
+        {
+            encoded = compressor_->compressColumns(timestamps_.data(), values_.data(), count_);
+            columns = &encoded;
+            timestampBlock = encoded.timestamps.data();
+            timestampBlockSize = encoded.timestamps.size();
+            valueBlock = encoded.values.data();
+            valueBlockSize = encoded.values.size();
+        }
 
-                // Read value
-                if (remaining < sizeof(uint32_t))
-                {
-                    throw std::runtime_error("Invalid chunk data: insufficient data for value length");
-                }
+        buffer.reserve(96 + timestampBlockSize + valueBlockSize);
 
-                uint32_t value_len;
-                std::memcpy(&value_len, ptr, sizeof(uint32_t));
-                ptr += sizeof(uint32_t);
-                remaining -= sizeof(uint32_t);
+        // Write header
+        appendPod(buffer, CHUNK_MAGIC);
+        appendPod(buffer, CHUNK_VERSION);
+        appendPod(buffer, minTimestamp_);
+        appendPod(buffer, maxTimestamp_);
+        appendPod(buffer, static_cast<uint64_t>(count_));
+        appendPod(buffer, stats_.sum);
+        appendPod(buffer, stats_.sumSquares);
+        appendPod(buffer, stats_.min);
+        appendPod(buffer, stats_.max);
+        appendPod(buffer, stats_.first);
+        appendPod(buffer, stats_.last);
+        appendFilter(buffer, tagFilter());
+
+        // Write column blocks
+        appendBlock(buffer, columns->timestampCodec, timestampBlock, timestampBlockSize);
+        appendBlock(buffer, columns->valueCodec, valueBlock, valueBlockSize);
+
+        // Write the series dictionary: each distinct tag set once, points
+        // refer to it by index. Files stay readable without the catalog.
+        std::vector<uint32_t> dictionary;
+        std::unordered_map<uint32_t, uint64_t> slots;
+        std::vector<uint64_t> indices(count_);
+        for (size_t i = 0; i < count_; ++i)
+        {
+            auto [it, inserted] = slots.emplace(seriesIdAt(i), dictionary.size());
+            if (inserted)
+            {
+                dictionary.push_back(seriesIdAt(i));
+            }
+            indices[i] = it->second;
+        }
 
-                if (value_len > 256 || remaining < value_len)
-                {
-                    throw std::runtime_error("Invalid chunk data: invalid value length");
-                }
+        appendPod(buffer, static_cast<uint32_t>(dictionary.size()));
+        for (uint32_t id : dictionary)
+        {
+            appendTags(buffer, catalog_->tags(id));
+        }
 
-                std::string value(reinterpret_cast<const char *>(ptr), value_len);
-                ptr += value_len;
-                remaining -= value_len;
+        BitPackingCompression packer;
+        std::vector<uint8_t> packed = packer.packIntegers(indices.data(), count_);
+        appendPod(buffer, static_cast<uint32_t>(packed.size()));
+        buffer.insert(buffer.end(), packed.begin(), packed.end());
 
-                tags_[i][key] = value;
-            }
-        }
+        return buffer;
     }
 
-    // ColumnarStorageManager implementation
-    ColumnarStorageManager::ColumnarStorageManager(const std::string &basePath)
-        : basePath_(basePath)
+    ChunkMeta ColumnarChunk::meta(size_t id) const
     {
-        fs::create_directories(basePath_);
+        ChunkMeta meta;
+        meta.id = id;
+        meta.minTimestamp = minTimestamp_;
+        meta.maxTimestamp = maxTimestamp_;
+        meta.stats = stats_;
+        meta.seriesId = seriesId_;
+        meta.tagFilter = tagFilter();
+        return meta;
     }
 
-    void ColumnarStorageManager::saveChunk(const std::string &metric, size_t chunkId,
-                                           const ColumnarChunk &chunk)
+    TagBloomFilter ColumnarChunk::tagFilter() const
     {
-        std::string filename = basePath_ + "/" + metric + "_" + std::to_string(chunkId) + ".chunk";
-
-        auto data = chunk.serialize();
-
-        // Use RAII to ensure file is closed
+        std::vector<uint32_t> series;
+        if (seriesId_ != MIXED_SERIES)
         {
-            std::ofstream file(filename, std::ios::binary);
-            if (!file)
-            {
-                throw std::runtime_error("Failed to save chunk: " + filename);
+            series.push_back(seriesId_);
+        }
+        else
+        {
+            std::unordered_set<uint32_t> seen(seriesIds_.begin(), seriesIds_.begin() + count_);
+            series.assign(seen.begin(), seen.end());
+        }
+
+        size_t pairs = 0;
+        for (uint32_t id : series)
+        {
+            pairs += catalog_->tags(id).size();
+        }
+
+        TagBloomFilter filter(pairs);
+        for (uint32_t id : series)
+        {
+            for (const auto &[key, value] : catalog_->tags(id))
+            {
+                filter.add(key, value);
             }
-            file.write(reinterpret_cast<const char *>(data.data()), data.size());
-            file.flush(); // Ensure data is written
-        } // File automatically closed here
+        }
+        return filter;
     }
 
-    std::unique_ptr<ColumnarChunk> ColumnarStorageManager::loadChunk(
-        const std::string &metric, size_t chunkId)
+    void ColumnarChunk::deserialize(const std::vector<uint8_t> &data)
     {
-        std::string filename = basePath_ + "/" + metric + "_" + std::to_string(chunkId) + ".chunk";
+        parse(data.data(), data.size(), nullptr);
+    }
 
-        // Check if file exists
-        if (!fs::exists(filename))
+    void ColumnarChunk::deserialize(std::shared_ptr<const MappedFile> file)
+    {
+        if (!file)
         {
-            return nullptr;
+            throw std::runtime_error("Invalid chunk data: no mapping");
         }
+        parse(file->data(), file->size(), file);
+    }
 
-        std::vector<uint8_t> buffer;
+    void ColumnarChunk::deserialize(std::shared_ptr<const MappedFile> file, size_t offset, size_t size)
+    {
+        if (!file || offset > file->size() || size > file->size() - offset)
+        {
+            throw std::runtime_error("Invalid chunk data: block outside mapping");
+        }
+        parse(file->data() + offset, size, file);
+    }
 
-        // Use RAII to ensure file is closed
+    void ColumnarChunk::parse(const uint8_t *data, size_t size, std::shared_ptr<const MappedFile> mapping)
+    {
+        if (size < sizeof(uint64_t) * 2 + sizeof(size_t))
         {
-            std::ifstream file(filename, std::ios::binary);
-            if (!file)
+            throw std::runtime_error("Invalid chunk data: too small for header");
+        }
+
+        const uint8_t *ptr = data;
+        size_t remaining = size;
+
+        uint32_t magic;
+        std::memcpy(&magic, ptr, sizeof(uint32_t));
+        bool legacy = magic != CHUNK_MAGIC;
+        uint32_t version = 0;
+
+        if (!legacy)
+        {
+            readPod<uint32_t>(ptr, remaining, CHUNK_SOURCE, "magic");
+            version = readPod<uint32_t>(ptr, remaining, CHUNK_SOURCE, "version");
+            if (version == 0 || version > CHUNK_VERSION)
             {
-                return nullptr;
+                throw std::runtime_error("Invalid chunk data: unsupported version " + std::to_string(version));
             }
+        }
+
+        // Read header
+        minTimestamp_ = readPod<uint64_t>(ptr, remaining, CHUNK_SOURCE, "header");
+        maxTimestamp_ = readPod<uint64_t>(ptr, remaining, CHUNK_SOURCE, "header");
+        count_ = legacy ? readPod<size_t>(ptr, remaining, CHUNK_SOURCE, "header")
+                        : static_cast<size_t>(readPod<uint64_t>(ptr, remaining, CHUNK_SOURCE, "header"));
+
+        // Validate count
+        if (count_ > VALUES_PER_SEGMENT)
+        {
+            throw std::runtime_error("Invalid chunk data: count too large");
+        }
 
-            file.seekg(0, std::ios::end);
-            size_t size = file.tellg();
-            file.seekg(0, std::ios::beg);
+        bool hasStats = version >= 2;
+        stats_ = ChunkStats();
+        stats_.count = count_;
+        if (hasStats)
+        {
+            stats_.sum = readPod<double>(ptr, remaining, CHUNK_SOURCE, "stats");
+            stats_.sumSquares = readPod<double>(ptr, remaining, CHUNK_SOURCE, "stats");
+            stats_.min = readPod<double>(ptr, remaining, CHUNK_SOURCE, "stats");
+            stats_.max = readPod<double>(ptr, remaining, CHUNK_SOURCE, "stats");
+            stats_.first = readPod<double>(ptr, remaining, CHUNK_SOURCE, "stats");
+            stats_.last = readPod<double>(ptr, remaining, CHUNK_SOURCE, "stats");
+        }
+        if (version >= 5)
+        {
+            // Only read by loadChunkMeta; a loaded chunk rebuilds it from
+            // its series on demand
+            uint32_t wordCount = readPod<uint32_t>(ptr, remaining, CHUNK_SOURCE, "tag filter");
+            if (wordCount > TagBloomFilter::MAX_WORDS || remaining < wordCount * sizeof(uint64_t))
+            {
+                throw std::runtime_error("Invalid chunk data: bad tag filter");
+            }
+            ptr += wordCount * sizeof(uint64_t);
+            remaining -= wordCount * sizeof(uint64_t);
+        }
 
-            if (size == 0)
+        if (legacy)
+        {
+            // Read raw timestamps and values
+            size_t timestamps_size = count_ * sizeof(uint64_t);
+            size_t values_size = count_ * sizeof(double);
+            if (remaining < timestamps_size + values_size)
             {
-                return nullptr;
+                throw std::runtime_error("Invalid chunk data: insufficient data for columns");
+            }
+
+            timestamps_.resize(count_);
+            std::memcpy(timestamps_.data(), ptr, timestamps_size);
+            ptr += timestamps_size;
+
+            values_.resize(count_);
+            std::memcpy(values_.data(), ptr, values_size);
+            ptr += values_size;
+            remaining -= timestamps_size + values_size;
+
+            compressedData_ = CompressionEngine::CompressedData();
+            bindBlocks();
+            compressed_ = false;
+        }
+        else
+        {
+            // Keep the codec output as-is, columns are decoded on demand
+            bool aligned = version >= 3;
+            compressedData_ = CompressionEngine::CompressedData();
+            const uint8_t *timestampBlock = readBlock(data, ptr, remaining, aligned,
+                                                      compressedData_.timestampCodec, timestampBlockSize_);
+            const uint8_t *valueBlock = readBlock(data, ptr, remaining, aligned,
+                                                  compressedData_.valueCodec, valueBlockSize_);
+
+            if (mapping && aligned)
+            {
+                // Zero-copy: the blocks stay in the mapped file
+                mapping_ = std::move(mapping);
+                timestampBlock_ = timestampBlock;
+                valueBlock_ = valueBlock;
+            }
+            else
+            {
+                compressedData_.timestamps.assign(timestampBlock, timestampBlock + timestampBlockSize_);
+                compressedData_.values.assign(valueBlock, valueBlock + valueBlockSize_);
+                bindBlocks();
+            }
+
+            // Nothing is appended to a sealed chunk; the capacity reserved
+            // for the raw columns is released
+            std::vector<uint64_t>().swap(timestamps_);
+            std::vector<double>().swap(values_);
+            compressed_ = true;
+        }
+
+        // Read series, interning each tag set into the catalog once
+        std::vector<uint32_t> seriesIds(count_, 0);
+        if (version >= 4)
+        {
+            uint32_t seriesCount = readPod<uint32_t>(ptr, remaining, CHUNK_SOURCE, "series count");
+            if (seriesCount > count_)
+            {
+                throw std::runtime_error("Invalid chunk data: too many series");
+            }
+
+            std::vector<uint32_t> dictionary;
+            dictionary.reserve(seriesCount);
+            for (uint32_t s = 0; s < seriesCount; ++s)
+            {
+                dictionary.push_back(catalog_->intern(readTags(ptr, remaining)));
+            }
+
+            uint32_t packedSize = readPod<uint32_t>(ptr, remaining, CHUNK_SOURCE, "series block size");
+            if (remaining < packedSize)
+            {
+                throw std::runtime_error("Invalid chunk data: insufficient data for series block");
+            }
+
+            BitPackingCompression packer;
+            std::vector<uint64_t> indices = packer.unpackIntegers(ptr, packedSize);
+            ptr += packedSize;
+            remaining -= packedSize;
+
+            if (indices.size() != count_)
+            {
+                throw std::runtime_error("Invalid chunk data: series block size mismatch");
+            }
+            for (size_t i = 0; i < count_; ++i)
+            {
+                if (indices[i] >= dictionary.size())
+                {
+                    throw std::runtime_error("Invalid chunk data: series index out of range");
+                }
+                seriesIds[i] = dictionary[indices[i]];
+            }
+        }
+        else
+        {
+            for (size_t i = 0; i < count_; ++i)
+            {
+                seriesIds[i] = catalog_->intern(readTags(ptr, remaining));
+            }
+        }
+
+        seriesId_ = MIXED_SERIES;
+        if (count_ > 0 && std::all_of(seriesIds.begin(), seriesIds.end(),
+                                      [&](uint32_t id) { return id == seriesIds[0]; }))
+        {
+            seriesId_ = seriesIds[0];
+        }
+        seriesIds_ = std::move(seriesIds);
+        releaseSeriesIds();
+
+        // Older files carry no stats header, rebuild it once from the columns
+        if (!hasStats && count_ > 0)
+        {
+            ColumnView view = columns();
+            for (size_t i = 0; i < count_; ++i)
+            {
+                double value = view.values()[i];
+                stats_.sum += value;
+                stats_.sumSquares += value * value;
+                stats_.min = std::min(stats_.min, value);
+                stats_.max = std::max(stats_.max, value);
+            }
+
+            auto [firstIt, lastIt] = std::minmax_element(view.timestamps(), view.timestamps() + count_);
+            stats_.first = view.values()[firstIt - view.timestamps()];
+            stats_.last = view.values()[lastIt - view.timestamps()];
+        }
+    }
+
+    // ColumnarStorageManager implementation
+    ColumnarStorageManager::ColumnarStorageManager(const std::string &basePath,
+                                                   std::shared_ptr<SeriesCatalog> catalog)
+        : basePath_(basePath), catalog_(std::move(catalog))
+    {
+        fs::create_directories(basePath_);
+        openSegments();
+    }
+
+    namespace
+    {
+        // Splits "<metric>_<number>" at the last underscore
+        bool parseStem(const std::string &stem, std::string &metric, uint64_t &number)
+        {
+            size_t sep = stem.rfind('_');
+            if (sep == std::string::npos || sep + 1 == stem.size() ||
+                stem.find_first_not_of("0123456789", sep + 1) != std::string::npos)
+            {
+                return false;
+            }
+            metric = stem.substr(0, sep);
+            number = std::stoull(stem.substr(sep + 1));
+            return true;
+        }
+
+        SegmentBlock blockInfo(const ColumnarChunk &chunk, uint64_t chunkId)
+        {
+            SegmentBlock block;
+            block.chunkId = chunkId;
+            block.minTimestamp = chunk.getMinTimestamp();
+            block.maxTimestamp = chunk.getMaxTimestamp();
+            block.seriesId = chunk.seriesId();
+            block.timestampCodec = chunk.timestampCodec();
+            block.valueCodec = chunk.valueCodec();
+            return block;
+        }
+    } // namespace
+
+    std::string ColumnarStorageManager::partitionPath(uint64_t partition) const
+    {
+        if (partition == UNPARTITIONED)
+            return basePath_;
+        return basePath_ + "/part-" + std::to_string(partition);
+    }
+
+    std::string ColumnarStorageManager::segmentPath(const std::string &metric, const FileKey &file) const
+    {
+        return partitionPath(file.first) + "/" + metric + "_" + std::to_string(file.second) + ".seg";
+    }
+
+    std::string ColumnarStorageManager::legacyPath(const std::string &metric, size_t chunkId) const
+    {
+        return basePath_ + "/" + metric + "_" + std::to_string(chunkId) + ".chunk";
+    }
+
+    // One listing of basePath and its partition directories, then one
+    // footer read per segment file. Files are opened in sequence order,
+    // flat ones first, so a chunk saved again later wins.
+    void ColumnarStorageManager::openSegments()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        std::map<std::tuple<bool, std::string, uint64_t, uint64_t>, std::string> found;
+        auto list = [&](const fs::path &directory, uint64_t partition)
+        {
+            for (const auto &entry : fs::directory_iterator(directory))
+            {
+                std::string extension = entry.path().extension().string();
+                std::string metric;
+                uint64_t number = 0;
+                if ((extension != ".seg" && extension != ".chunk") ||
+                    !parseStem(entry.path().stem().string(), metric, number))
+                {
+                    continue;
+                }
+
+                if (extension == ".chunk")
+                {
+                    if (partition == UNPARTITIONED)
+                        metrics_[metric].legacyFiles = true;
+                }
+                else if (number <= UINT32_MAX)
+                {
+                    found[{partition != UNPARTITIONED, metric, partition, number}] = entry.path().string();
+                }
+            }
+        };
+
+        list(basePath_, UNPARTITIONED);
+        for (const auto &entry : fs::directory_iterator(basePath_))
+        {
+            std::string name = entry.path().filename().string();
+            if (entry.is_directory() && name.size() > 5 && name.compare(0, 5, "part-") == 0 &&
+                name.find_first_not_of("0123456789", 5) == std::string::npos)
+            {
+                list(entry.path(), std::stoull(name.substr(5)));
+            }
+        }
+
+        for (const auto &[key, path] : found)
+        {
+            std::unique_ptr<SegmentFile> file;
+            try
+            {
+                file = SegmentFile::open(path);
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << "Skipping segment file " << path << ": " << e.what() << std::endl;
+                continue;
+            }
+
+            auto &segments = metrics_[std::get<1>(key)];
+            FileKey fileKey{std::get<2>(key), static_cast<uint32_t>(std::get<3>(key))};
+            SegmentFile &opened = *file;
+            segments.files[fileKey] = std::move(file);
+
+            std::vector<std::pair<uint64_t, uint64_t>> blocks;
+            for (const auto &[offset, block] : opened.blocks())
+            {
+                blocks.emplace_back(block.chunkId, offset);
+            }
+            for (const auto &[chunkId, offset] : blocks)
+            {
+                bindChunk(segments, chunkId, BlockRef{fileKey, offset});
+            }
+        }
+    }
+
+    // Appends to the metric's newest segment file in the partition, starting
+    // the next one once it is full. The file left behind gets its final
+    // footer first.
+    ColumnarStorageManager::BlockRef ColumnarStorageManager::appendBlock(
+        const std::string &metric, MetricSegments &segments, uint64_t partition,
+        SegmentBlock block, const uint8_t *data, size_t size)
+    {
+        auto newest = segments.files.upper_bound(FileKey{partition, UINT32_MAX});
+        if (newest != segments.files.begin() && std::prev(newest)->first.first == partition)
+        {
+            --newest;
+        }
+        else
+        {
+            newest = segments.files.end();
+        }
+
+        if (newest == segments.files.end() || newest->second->size() >= SEGMENT_FILE_BYTES)
+        {
+            FileKey next{partition, 0};
+            if (newest != segments.files.end())
+            {
+                newest->second->writeFooter();
+                next.second = newest->first.second + 1;
+            }
+            if (fs::create_directories(partitionPath(partition)))
+            {
+                unsyncedDirectories_.insert(basePath_);
+            }
+            newest = segments.files.emplace(next, SegmentFile::open(segmentPath(metric, next))).first;
+            unsyncedDirectories_.insert(partitionPath(partition));
+        }
+
+        uint64_t offset = newest->second->append(std::move(block), data, size);
+        return BlockRef{newest->first, offset};
+    }
+
+    // Unlinks a segment file, and its partition directory once no metric
+    // has files left in it
+    void ColumnarStorageManager::removeFile(MetricSegments &segments, const FileKey &file)
+    {
+        auto it = segments.files.find(file);
+        if (it == segments.files.end())
+            return;
+
+        std::error_code ec;
+        fs::remove(it->second->path(), ec);
+        segments.files.erase(it);
+        if (file.first != UNPARTITIONED)
+        {
+            fs::remove(partitionPath(file.first), ec); // fails while not empty
+        }
+    }
+
+    // Drops a block from its file's index, removing the file once nothing
+    // in it is live
+    void ColumnarStorageManager::releaseBlock(MetricSegments &segments, const BlockRef &ref)
+    {
+        auto it = segments.files.find(ref.file);
+        if (it == segments.files.end())
+            return;
+
+        it->second->erase(ref.offset);
+        if (it->second->blocks().empty())
+        {
+            removeFile(segments, ref.file);
+        }
+    }
+
+    void ColumnarStorageManager::bindChunk(MetricSegments &segments, size_t chunkId, const BlockRef &ref)
+    {
+        auto [it, inserted] = segments.chunks.try_emplace(chunkId, ref);
+        if (!inserted)
+        {
+            BlockRef previous = it->second;
+            it->second = ref;
+            releaseBlock(segments, previous);
+        }
+    }
+
+    void ColumnarStorageManager::saveChunk(const std::string &metric, size_t chunkId,
+                                           const ColumnarChunk &chunk)
+    {
+        auto data = chunk.serialize();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto &segments = metrics_[metric];
+        BlockRef ref = appendBlock(metric, segments, partitionOf(chunk.getMaxTimestamp()),
+                                   blockInfo(chunk, chunkId), data.data(), data.size());
+        bindChunk(segments, chunkId, ref);
+    }
+
+    ColumnarStorageManager::StagedChunk ColumnarStorageManager::stageChunk(const std::string &metric,
+                                                                           const ColumnarChunk &chunk)
+    {
+        auto data = chunk.serialize();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        BlockRef ref = appendBlock(metric, metrics_[metric], partitionOf(chunk.getMaxTimestamp()),
+                                   blockInfo(chunk, STAGED_BLOCK), data.data(), data.size());
+        return StagedChunk{ref.file.first, ref.file.second, ref.offset};
+    }
+
+    void ColumnarStorageManager::publishChunk(const StagedChunk &staged, const std::string &metric, size_t chunkId)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto &segments = metrics_[metric];
+        FileKey key{staged.partition, staged.file};
+        auto file = segments.files.find(key);
+        if (file == segments.files.end())
+        {
+            throw std::runtime_error("Staged chunk of " + metric + " is gone");
+        }
+        file->second->relabel(staged.offset, chunkId);
+        bindChunk(segments, chunkId, BlockRef{key, staged.offset});
+    }
+
+    void ColumnarStorageManager::discardChunk(const StagedChunk &staged, const std::string &metric)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto segments = metrics_.find(metric);
+        if (segments != metrics_.end())
+        {
+            releaseBlock(segments->second, BlockRef{{staged.partition, staged.file}, staged.offset});
+        }
+    }
+
+    std::unique_ptr<ColumnarChunk> ColumnarStorageManager::loadChunk(
+        const std::string &metric, size_t chunkId)
+    {
+        std::string filename;
+        std::shared_ptr<const MappedFile> mapping;
+        SegmentBlock block;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto segments = metrics_.find(metric);
+            if (segments != metrics_.end())
+            {
+                auto ref = segments->second.chunks.find(chunkId);
+                if (ref != segments->second.chunks.end())
+                {
+                    SegmentFile &file = *segments->second.files.at(ref->second.file);
+                    filename = file.path();
+                    block = file.blocks().at(ref->second.offset);
+                    try
+                    {
+                        mapping = file.map(block);
+                    }
+                    catch (const std::exception &e)
+                    {
+                        std::cerr << "Failed to map chunk " << metric << "/" << chunkId << ": " << e.what() << std::endl;
+                        return nullptr;
+                    }
+                }
             }
+        }
 
-            buffer.resize(size);
-            file.read(reinterpret_cast<char *>(buffer.data()), size);
-        } // File automatically closed here
+        // Sealed chunks are read through a private read-only mapping; their
+        // column blocks stay in the page cache instead of being copied
+        if (!mapping)
+        {
+            filename = legacyPath(metric, chunkId);
+            mapping = MappedFile::open(filename);
+            if (!mapping)
+            {
+                return nullptr;
+            }
+            block.offset = 0;
+            block.size = mapping->size();
+        }
+        else if (SegmentFile::checksum(mapping->data() + block.offset, block.size) != block.checksum)
+        {
+            std::cerr << "Checksum mismatch in chunk " << metric << "/" << chunkId << " of " << filename << std::endl;
+            return nullptr;
+        }
 
-        auto chunk = std::make_unique<ColumnarChunk>();
+        auto chunk = std::make_unique<ColumnarChunk>(catalog_);
         try
         {
-            chunk->deserialize(buffer);
+            chunk->deserialize(mapping, block.offset, block.size);
         }
         catch (const std::exception &e)
         {
-            std::cerr << "Failed to deserialize chunk " << filename << ": " << e.what() << std::endl;
+            std::cerr << "Failed to deserialize chunk " << metric << "/" << chunkId << " of " << filename << ": " << e.what() << std::endl;
             return nullptr;
         }
 
         return chunk;
     }
 
-    void ColumnarStorageManager::deleteChunks(const std::string &metric)
+    bool ColumnarStorageManager::loadChunkMeta(const std::string &metric, size_t chunkId, ChunkMeta &meta)
     {
-        for (const auto &entry : fs::directory_iterator(basePath_))
+        // The header of a segment block is read through the file's mapping,
+        // that of a chunk file with one small read
+        std::vector<uint8_t> buffer;
+        const uint8_t *header = nullptr;
+        size_t headerSize = 0;
+        std::shared_ptr<const MappedFile> mapping;
+        uint32_t seriesId = MIXED_SERIES;
         {
-            if (entry.path().filename().string().find(metric + "_") == 0)
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto segments = metrics_.find(metric);
+            if (segments != metrics_.end())
             {
-                fs::remove(entry.path());
+                auto ref = segments->second.chunks.find(chunkId);
+                if (ref != segments->second.chunks.end())
+                {
+                    SegmentFile &file = *segments->second.files.at(ref->second.file);
+                    const SegmentBlock &block = file.blocks().at(ref->second.offset);
+                    try
+                    {
+                        mapping = file.map(block);
+                    }
+                    catch (const std::exception &e)
+                    {
+                        std::cerr << "Failed to map chunk " << metric << "/" << chunkId << ": " << e.what() << std::endl;
+                        return false;
+                    }
+                    header = mapping->data() + block.offset;
+                    headerSize = block.size;
+                    seriesId = block.seriesId;
+                }
+            }
+        }
+
+        if (!header)
+        {
+            std::ifstream file(legacyPath(metric, chunkId), std::ios::binary);
+            if (!file)
+            {
+                return false;
+            }
+            // Fixed header plus the filter's word count, then the filter words
+            buffer.resize(CHUNK_HEADER_SIZE + sizeof(uint32_t));
+            file.read(reinterpret_cast<char *>(buffer.data()), buffer.size());
+            headerSize = static_cast<size_t>(file.gcount());
+            if (headerSize == buffer.size())
+            {
+                uint32_t wordCount;
+                std::memcpy(&wordCount, buffer.data() + CHUNK_HEADER_SIZE, sizeof(wordCount));
+                if (wordCount <= TagBloomFilter::MAX_WORDS)
+                {
+                    buffer.resize(buffer.size() + wordCount * sizeof(uint64_t));
+                    file.read(reinterpret_cast<char *>(buffer.data()) + headerSize, wordCount * sizeof(uint64_t));
+                    headerSize += static_cast<size_t>(file.gcount());
+                }
+            }
+            header = buffer.data();
+        }
+
+        const uint8_t *ptr = header;
+        size_t remaining = headerSize;
+        try
+        {
+            uint32_t version = 0;
+            if (readPod<uint32_t>(ptr, remaining, CHUNK_SOURCE, "magic") == CHUNK_MAGIC &&
+                (version = readPod<uint32_t>(ptr, remaining, CHUNK_SOURCE, "version")) >= 2 &&
+                version <= CHUNK_VERSION)
+            {
+                meta.id = chunkId;
+                meta.seriesId = seriesId;
+                meta.minTimestamp = readPod<uint64_t>(ptr, remaining, CHUNK_SOURCE, "header");
+                meta.maxTimestamp = readPod<uint64_t>(ptr, remaining, CHUNK_SOURCE, "header");
+                meta.stats = ChunkStats();
+                meta.stats.count = readPod<uint64_t>(ptr, remaining, CHUNK_SOURCE, "header");
+                meta.stats.sum = readPod<double>(ptr, remaining, CHUNK_SOURCE, "stats");
+                meta.stats.sumSquares = readPod<double>(ptr, remaining, CHUNK_SOURCE, "stats");
+                meta.stats.min = readPod<double>(ptr, remaining, CHUNK_SOURCE, "stats");
+                meta.stats.max = readPod<double>(ptr, remaining, CHUNK_SOURCE, "stats");
+                meta.stats.first = readPod<double>(ptr, remaining, CHUNK_SOURCE, "stats");
+                meta.stats.last = readPod<double>(ptr, remaining, CHUNK_SOURCE, "stats");
+                meta.tagFilter = version >= 5 ? readFilter(ptr, remaining) : TagBloomFilter();
+                return true;
             }
         }
+        catch (const std::exception &)
+        {
+        }
+
+        // Older chunks carry no stats header and are loaded in full once
+        auto chunk = loadChunk(metric, chunkId);
+        if (!chunk)
+        {
+            return false;
+        }
+        meta = chunk->meta(chunkId);
+        return true;
     }
 
-    std::vector<size_t> ColumnarStorageManager::listChunks(const std::string &metric)
+    void ColumnarStorageManager::syncFiles()
     {
-        std::vector<size_t> chunkIds;
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto &[metric, segments] : metrics_)
+        {
+            for (auto &[key, file] : segments.files)
+            {
+                file->writeFooter();
+                file->sync();
+            }
+        }
 
-        for (const auto &entry : fs::directory_iterator(basePath_))
+        for (auto it = unsyncedDirectories_.begin(); it != unsyncedDirectories_.end();)
         {
-            std::string filename = entry.path().filename().string();
-            if (filename.find(metric + "_") == 0 && filename.find(".chunk") != std::string::npos)
+            // Partition directories may have been removed since
+            std::error_code ec;
+            if (fs::exists(*it, ec) && !syncDirectory(*it))
             {
-                size_t start = metric.length() + 1;
-                size_t end = filename.find(".chunk");
-                if (end > start)
+                throw std::runtime_error("Failed to sync directory: " + *it);
+            }
+            it = unsyncedDirectories_.erase(it);
+        }
+    }
+
+    void ColumnarStorageManager::saveDirectory(const ChunkDirectory &directory, uint64_t walSequence,
+                                               const ChunkIds &excluded)
+    {
+        syncFiles();
+
+        std::vector<uint8_t> buffer;
+        appendPod(buffer, DIRECTORY_MAGIC);
+        appendPod(buffer, DIRECTORY_VERSION);
+        appendPod(buffer, walSequence);
+        appendPod(buffer, static_cast<uint32_t>(directory.size()));
+
+        static const std::unordered_set<size_t> none;
+        for (const auto &[metric, entries] : directory)
+        {
+            auto skipped = excluded.find(metric);
+            const auto &skip = skipped != excluded.end() ? skipped->second : none;
+
+            appendPod(buffer, static_cast<uint32_t>(metric.size()));
+            buffer.insert(buffer.end(), metric.begin(), metric.end());
+            size_t countOffset = buffer.size();
+            appendPod(buffer, uint32_t{0});
+
+            uint32_t count = 0;
+            for (const auto &meta : entries)
+            {
+                if (skip.count(meta.id))
+                    continue;
+                ++count;
+                appendPod(buffer, static_cast<uint64_t>(meta.id));
+                appendPod(buffer, meta.minTimestamp);
+                appendPod(buffer, meta.maxTimestamp);
+                appendPod(buffer, meta.stats.count);
+                appendPod(buffer, meta.stats.sum);
+                appendPod(buffer, meta.stats.sumSquares);
+                appendPod(buffer, meta.stats.min);
+                appendPod(buffer, meta.stats.max);
+                appendPod(buffer, meta.stats.first);
+                appendPod(buffer, meta.stats.last);
+                appendPod(buffer, meta.seriesId);
+                appendFilter(buffer, meta.tagFilter);
+            }
+            std::memcpy(buffer.data() + countOffset, &count, sizeof(count));
+        }
+
+        replaceFile(basePath_ + "/chunks.dir", buffer, "chunk directory");
+    }
+
+    ColumnarStorageManager::ChunkDirectory ColumnarStorageManager::loadDirectory(uint64_t *walSequence)
+    {
+        ChunkDirectory directory;
+        uint64_t unused = 0;
+        uint64_t &sequence = walSequence ? *walSequence : unused;
+        sequence = 0;
+
+        std::vector<uint8_t> buffer;
+        {
+            std::ifstream file(basePath_ + "/chunks.dir", std::ios::binary);
+            if (!file)
+            {
+                return directory;
+            }
+            buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+
+        const uint8_t *ptr = buffer.data();
+        size_t remaining = buffer.size();
+        try
+        {
+            if (readPod<uint32_t>(ptr, remaining, DIRECTORY_SOURCE, "directory magic") != DIRECTORY_MAGIC)
+            {
+                throw std::runtime_error("Invalid chunk directory: bad header");
+            }
+            uint32_t version = readPod<uint32_t>(ptr, remaining, DIRECTORY_SOURCE, "directory version");
+            if (version == 0 || version > DIRECTORY_VERSION)
+            {
+                throw std::runtime_error("Invalid chunk directory: unsupported version " + std::to_string(version));
+            }
+            sequence = version >= 4 ? readPod<uint64_t>(ptr, remaining, DIRECTORY_SOURCE, "WAL sequence")
+                                    : UNKNOWN_WAL_SEQUENCE;
+
+            uint32_t metricCount = readPod<uint32_t>(ptr, remaining, DIRECTORY_SOURCE, "metric count");
+            for (uint32_t m = 0; m < metricCount; ++m)
+            {
+                uint32_t nameLen = readPod<uint32_t>(ptr, remaining, DIRECTORY_SOURCE, "metric name");
+                if (remaining < nameLen)
                 {
-                    try
+                    throw std::runtime_error("Invalid chunk directory: truncated metric name");
+                }
+                std::string metric(reinterpret_cast<const char *>(ptr), nameLen);
+                ptr += nameLen;
+                remaining -= nameLen;
+
+                auto &entries = directory[metric];
+                uint32_t entryCount = readPod<uint32_t>(ptr, remaining, DIRECTORY_SOURCE, "entry count");
+                for (uint32_t i = 0; i < entryCount; ++i)
+                {
+                    ChunkMeta meta;
+                    meta.id = static_cast<size_t>(readPod<uint64_t>(ptr, remaining, DIRECTORY_SOURCE, "chunk id"));
+                    meta.minTimestamp = readPod<uint64_t>(ptr, remaining, DIRECTORY_SOURCE, "chunk entry");
+                    meta.maxTimestamp = readPod<uint64_t>(ptr, remaining, DIRECTORY_SOURCE, "chunk entry");
+                    meta.stats.count = readPod<uint64_t>(ptr, remaining, DIRECTORY_SOURCE, "chunk entry");
+                    meta.stats.sum = readPod<double>(ptr, remaining, DIRECTORY_SOURCE, "chunk entry");
+                    meta.stats.sumSquares = readPod<double>(ptr, remaining, DIRECTORY_SOURCE, "chunk entry");
+                    meta.stats.min = readPod<double>(ptr, remaining, DIRECTORY_SOURCE, "chunk entry");
+                    meta.stats.max = readPod<double>(ptr, remaining, DIRECTORY_SOURCE, "chunk entry");
+                    meta.stats.first = readPod<double>(ptr, remaining, DIRECTORY_SOURCE, "chunk entry");
+                    meta.stats.last = readPod<double>(ptr, remaining, DIRECTORY_SOURCE, "chunk entry");
+                    if (version >= 2)
                     {
-                        size_t chunkId = std::stoull(filename.substr(start, end - start));
-                        chunkIds.push_back(chunkId);
+                        meta.seriesId = readPod<uint32_t>(ptr, remaining, DIRECTORY_SOURCE, "chunk entry");
                     }
-                    catch (const std::exception &)
+                    if (version >= 3)
                     {
-                        // Skip files with invalid chunk IDs
+                        meta.tagFilter = readFilter(ptr, remaining);
                     }
+                    entries.push_back(meta);
+                }
+            }
+        }
+        catch (const std::exception &e)
+        {
+            // Fall back to reading chunk headers
+            std::cerr << "Ignoring chunk directory: " << e.what() << std::endl;
+            directory.clear();
+            sequence = UNKNOWN_WAL_SEQUENCE;
+        }
+
+        return directory;
+    }
+
+    void ColumnarStorageManager::retainChunks(const ChunkDirectory &directory)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto &[metric, segments] : metrics_)
+        {
+            std::unordered_set<size_t> live;
+            auto listed = directory.find(metric);
+            if (listed != directory.end())
+            {
+                for (const auto &meta : listed->second)
+                {
+                    live.insert(meta.id);
                 }
             }
+
+            for (auto it = segments.chunks.begin(); it != segments.chunks.end();)
+            {
+                if (live.count(it->first))
+                {
+                    ++it;
+                    continue;
+                }
+                BlockRef ref = it->second;
+                it = segments.chunks.erase(it);
+                releaseBlock(segments, ref);
+            }
+        }
+    }
+
+    // Rewrites at most one file per call, the first whose live blocks fill
+    // less than half of it; the newest file of a partition is still being
+    // appended to and is left alone. Copies go to the partition of their
+    // newest point, which moves blocks out of flat files. Checksums are
+    // verified without mutex_, and copies are appended staged, one per
+    // lock, so saves and loads interleave with the rewrite. They are
+    // named, and indexed by footers, before the old blocks are released; a
+    // crash in between leaves the old blocks, and the staged copies are
+    // dropped on open.
+    void ColumnarStorageManager::reclaimSegments(const std::string &metric)
+    {
+        FileKey source;
+        std::vector<SegmentBlock> blocks;
+        std::shared_ptr<const MappedFile> mapping;
+        std::string path;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto found = metrics_.find(metric);
+            if (found == metrics_.end())
+                return;
+
+            MetricSegments &segments = found->second;
+            for (auto it = segments.files.begin(); it != segments.files.end() && blocks.empty(); ++it)
+            {
+                auto next = std::next(it);
+                bool newest = it->first.first != UNPARTITIONED &&
+                              (next == segments.files.end() || next->first.first != it->first.first);
+                SegmentFile &file = *it->second;
+                if (newest || file.blocks().empty() || file.liveBytes() * 2 >= file.size())
+                    continue;
+
+                // A staged block is only located through its current position
+                bool staged = std::any_of(file.blocks().begin(), file.blocks().end(), [](const auto &entry)
+                                          { return entry.second.chunkId == STAGED_BLOCK; });
+                if (staged)
+                    continue;
+
+                source = it->first;
+                path = file.path();
+                for (const auto &[offset, block] : file.blocks())
+                {
+                    blocks.push_back(block);
+                }
+                mapping = file.map(blocks.back());
+            }
+        }
+        if (blocks.empty())
+            return;
+
+        for (const auto &block : blocks)
+        {
+            if (SegmentFile::checksum(mapping->data() + block.offset, block.size) != block.checksum)
+            {
+                std::cerr << "Checksum mismatch in " << path << ", keeping it" << std::endl;
+                return;
+            }
+        }
+
+        std::vector<BlockRef> copies;
+        for (const auto &block : blocks)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto found = metrics_.find(metric);
+            if (found == metrics_.end())
+                return; // the metric was deleted, with its files
+
+            SegmentBlock copy = block;
+            copy.chunkId = STAGED_BLOCK;
+            copies.push_back(appendBlock(metric, found->second, partitionOf(block.maxTimestamp), copy,
+                                         mapping->data() + block.offset, block.size));
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = metrics_.find(metric);
+        if (found == metrics_.end())
+            return;
+
+        // A chunk saved again or deleted meanwhile keeps its current block
+        MetricSegments &segments = found->second;
+        std::vector<bool> current(blocks.size());
+        for (size_t i = 0; i < blocks.size(); ++i)
+        {
+            auto ref = segments.chunks.find(blocks[i].chunkId);
+            current[i] = ref != segments.chunks.end() && ref->second.file == source &&
+                         ref->second.offset == blocks[i].offset;
+            if (current[i])
+            {
+                segments.files.at(copies[i].file)->relabel(copies[i].offset, blocks[i].chunkId);
+            }
+        }
+        for (const auto &copy : copies)
+        {
+            segments.files.at(copy.file)->writeFooter();
+        }
+
+        for (size_t i = 0; i < blocks.size(); ++i)
+        {
+            if (current[i])
+            {
+                segments.chunks[blocks[i].chunkId] = copies[i];
+                releaseBlock(segments, BlockRef{source, blocks[i].offset});
+            }
+            else
+            {
+                releaseBlock(segments, copies[i]);
+            }
+        }
+    }
+
+    void ColumnarStorageManager::dropPartitions(const std::string &metric, uint64_t before)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = metrics_.find(metric);
+        if (found == metrics_.end())
+            return;
+
+        MetricSegments &segments = found->second;
+        for (auto it = segments.chunks.begin(); it != segments.chunks.end();)
+        {
+            if (it->second.file.first < before)
+                it = segments.chunks.erase(it);
+            else
+                ++it;
+        }
+        while (!segments.files.empty() && segments.files.begin()->first.first < before)
+        {
+            removeFile(segments, segments.files.begin()->first);
+        }
+    }
+
+    void ColumnarStorageManager::deleteChunks(const std::string &metric)
+    {
+        bool legacyFiles = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto found = metrics_.find(metric);
+            if (found == metrics_.end())
+                return;
+
+            while (!found->second.files.empty())
+            {
+                removeFile(found->second, found->second.files.begin()->first);
+            }
+            legacyFiles = found->second.legacyFiles;
+            metrics_.erase(found);
+        }
+
+        if (legacyFiles)
+        {
+            for (const auto &chunkId : listLegacyChunks(metric))
+            {
+                std::error_code ec;
+                fs::remove(legacyPath(metric, chunkId), ec);
+            }
+        }
+    }
+
+    void ColumnarStorageManager::deleteChunk(const std::string &metric, size_t chunkId)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = metrics_.find(metric);
+        if (found == metrics_.end())
+            return;
+
+        MetricSegments &segments = found->second;
+        auto ref = segments.chunks.find(chunkId);
+        if (ref != segments.chunks.end())
+        {
+            BlockRef block = ref->second;
+            segments.chunks.erase(ref);
+            releaseBlock(segments, block);
+        }
+        if (segments.legacyFiles)
+        {
+            std::error_code ec;
+            fs::remove(legacyPath(metric, chunkId), ec);
+        }
+    }
+
+    std::vector<size_t> ColumnarStorageManager::listChunks(const std::string &metric)
+    {
+        std::vector<size_t> chunkIds;
+        bool legacyFiles = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto found = metrics_.find(metric);
+            if (found == metrics_.end())
+                return chunkIds;
+
+            for (const auto &[chunkId, ref] : found->second.chunks)
+            {
+                chunkIds.push_back(chunkId);
+            }
+            legacyFiles = found->second.legacyFiles;
+        }
+
+        if (legacyFiles)
+        {
+            auto legacy = listLegacyChunks(metric);
+            chunkIds.insert(chunkIds.end(), legacy.begin(), legacy.end());
         }
 
         std::sort(chunkIds.begin(), chunkIds.end());
+        chunkIds.erase(std::unique(chunkIds.begin(), chunkIds.end()), chunkIds.end());
+        return chunkIds;
+    }
+
+    // Only databases written before segment files have these
+    std::vector<size_t> ColumnarStorageManager::listLegacyChunks(const std::string &metric)
+    {
+        std::vector<size_t> chunkIds;
+        for (const auto &entry : fs::directory_iterator(basePath_))
+        {
+            std::string name;
+            uint64_t chunkId = 0;
+            if (entry.path().extension() == ".chunk" &&
+                parseStem(entry.path().stem().string(), name, chunkId) && name == metric)
+            {
+                chunkIds.push_back(chunkId);
+            }
+        }
         return chunkIds;
     }
 
+    size_t ColumnarStorageManager::segmentFileCount(const std::string &metric) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = metrics_.find(metric);
+        return found == metrics_.end() ? 0 : found->second.files.size();
+    }
+
+    std::vector<uint64_t> ColumnarStorageManager::partitions(const std::string &metric) const
+    {
+        std::vector<uint64_t> starts;
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = metrics_.find(metric);
+        if (found != metrics_.end())
+        {
+            for (const auto &[key, file] : found->second.files)
+            {
+                if (key.first != UNPARTITIONED && (starts.empty() || starts.back() != key.first))
+                    starts.push_back(key.first);
+            }
+        }
+        return starts;
+    }
+
 } // namespace waffledb
\ No newline at end of file
@@ -3,6 +3,11 @@
 #include <algorithm>
 #include <cstring>
 #include <cmath>
+#include <stdexcept>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 namespace waffledb
 {
@@ -189,6 +194,260 @@ namespace waffledb
         return result;
     }
 
+    namespace
+    {
+        inline uint64_t zigzagEncode(int64_t value)
+        {
+            return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+        }
+
+        inline int64_t zigzagDecode(uint64_t value)
+        {
+            return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+        }
+
+        // Order-preserving mapping of signed values onto unsigned ones
+        inline uint64_t biasEncode(int64_t value)
+        {
+            return static_cast<uint64_t>(value) ^ (1ULL << 63);
+        }
+
+        inline int64_t biasDecode(uint64_t value)
+        {
+            return static_cast<int64_t>(value ^ (1ULL << 63));
+        }
+
+        // Doubles holding exact integers (counters, gauges of whole units)
+        bool integralValues(const double *values, size_t count, std::vector<int64_t> &out)
+        {
+            constexpr double limit = 9007199254740992.0; // 2^53
+
+            out.resize(count);
+            for (size_t i = 0; i < count; ++i)
+            {
+                double v = values[i];
+                if (!(std::fabs(v) < limit) || v != std::trunc(v) || (v == 0.0 && std::signbit(v)))
+                {
+                    return false;
+                }
+                out[i] = static_cast<int64_t>(v);
+            }
+            return true;
+        }
+
+        template <typename T>
+        std::vector<uint64_t> zigzagDeltas(const T *values, size_t count)
+        {
+            std::vector<uint64_t> deltas;
+            deltas.reserve(count);
+            for (size_t i = 1; i < count; ++i)
+            {
+                deltas.push_back(zigzagEncode(static_cast<int64_t>(values[i] - values[i - 1])));
+            }
+            return deltas;
+        }
+
+        constexpr uint8_t PACK_MODE_FOR = 0;
+        constexpr uint8_t PACK_MODE_DELTA = 1;
+
+        inline void writeVarint(std::vector<uint8_t> &out, uint64_t value)
+        {
+            while (value >= 0x80)
+            {
+                out.push_back(static_cast<uint8_t>(value | 0x80));
+                value >>= 7;
+            }
+            out.push_back(static_cast<uint8_t>(value));
+        }
+
+        inline uint64_t readVarint(const uint8_t *&ptr, const uint8_t *end)
+        {
+            uint64_t result = 0;
+            for (unsigned shift = 0; shift < 64; shift += 7)
+            {
+                if (ptr >= end)
+                {
+                    throw std::runtime_error("Varint stream truncated");
+                }
+                uint8_t byte = *ptr++;
+                result |= static_cast<uint64_t>(byte & 0x7F) << shift;
+                if ((byte & 0x80) == 0)
+                {
+                    return result;
+                }
+            }
+            throw std::runtime_error("Varint too long");
+        }
+    } // namespace
+
+    // DeltaOfDeltaEncoding implementation
+    std::vector<uint8_t> DeltaOfDeltaEncoding::compress(const uint8_t *data, size_t size)
+    {
+        std::vector<uint64_t> timestamps(size / sizeof(uint64_t));
+        memcpy(timestamps.data(), data, timestamps.size() * sizeof(uint64_t));
+        return compressTimestamps(timestamps.data(), timestamps.size());
+    }
+
+    std::vector<uint8_t> DeltaOfDeltaEncoding::decompress(const uint8_t *data, size_t size)
+    {
+        std::vector<uint64_t> timestamps = decompressTimestamps(data, size);
+        std::vector<uint8_t> result(timestamps.size() * sizeof(uint64_t));
+        memcpy(result.data(), timestamps.data(), result.size());
+        return result;
+    }
+
+    std::vector<uint8_t> DeltaOfDeltaEncoding::compressTimestamps(const uint64_t *timestamps, size_t count)
+    {
+        std::vector<uint8_t> result;
+        if (count == 0)
+            return result;
+
+        result.reserve(count + 16);
+
+        // Header: count and first timestamp
+        writeVarint(result, count);
+        writeVarint(result, timestamps[0]);
+
+        int64_t previousDelta = 0;
+        for (size_t i = 1; i < count; ++i)
+        {
+            int64_t delta = static_cast<int64_t>(timestamps[i] - timestamps[i - 1]);
+            writeVarint(result, zigzagEncode(delta - previousDelta));
+            previousDelta = delta;
+        }
+
+        return result;
+    }
+
+    std::vector<uint64_t> DeltaOfDeltaEncoding::decompressTimestamps(const uint8_t *data, size_t size)
+    {
+        std::vector<uint64_t> result;
+        if (size == 0)
+            return result;
+
+        const uint8_t *ptr = data;
+        const uint8_t *end = data + size;
+
+        uint64_t count = readVarint(ptr, end);
+        uint64_t current = readVarint(ptr, end);
+
+        result.reserve(count);
+        result.push_back(current);
+
+        int64_t delta = 0;
+        for (uint64_t i = 1; i < count; ++i)
+        {
+            delta += zigzagDecode(readVarint(ptr, end));
+            current += delta;
+            result.push_back(current);
+        }
+
+        return result;
+    }
+
+    // ConstantStrideEncoding implementation
+    std::pair<size_t, size_t> ConstantStrideEncoding::Stride::indexRange(uint64_t startTime, uint64_t endTime) const
+    {
+        size_t n = static_cast<size_t>(count);
+        if (n == 0 || startTime > endTime)
+            return {0, 0};
+
+        size_t first;
+        size_t last;
+
+        if (interval == 0)
+        {
+            bool inside = startTime <= start && start <= endTime;
+            return inside ? std::make_pair(size_t(0), n) : std::make_pair(size_t(0), size_t(0));
+        }
+
+        // First index with timestamp >= startTime
+        if (startTime <= start)
+            first = 0;
+        else
+            first = static_cast<size_t>(std::min<uint64_t>((startTime - start + interval - 1) / interval, n));
+
+        // First index with timestamp > endTime
+        if (endTime < start)
+            last = 0;
+        else
+            last = static_cast<size_t>(std::min<uint64_t>((endTime - start) / interval + 1, n));
+
+        return {first, std::max(first, last)};
+    }
+
+    std::vector<uint8_t> ConstantStrideEncoding::compress(const uint8_t *data, size_t size)
+    {
+        std::vector<uint64_t> timestamps(size / sizeof(uint64_t));
+        memcpy(timestamps.data(), data, timestamps.size() * sizeof(uint64_t));
+        return compressTimestamps(timestamps.data(), timestamps.size());
+    }
+
+    std::vector<uint8_t> ConstantStrideEncoding::decompress(const uint8_t *data, size_t size)
+    {
+        std::vector<uint64_t> timestamps = decompressTimestamps(data, size);
+        std::vector<uint8_t> result(timestamps.size() * sizeof(uint64_t));
+        memcpy(result.data(), timestamps.data(), result.size());
+        return result;
+    }
+
+    bool ConstantStrideEncoding::isConstantStride(const uint64_t *timestamps, size_t count)
+    {
+        if (count < 2)
+            return count == 1;
+
+        if (timestamps[1] < timestamps[0])
+            return false;
+
+        uint64_t interval = timestamps[1] - timestamps[0];
+        for (size_t i = 2; i < count; ++i)
+        {
+            if (timestamps[i] < timestamps[i - 1] || timestamps[i] - timestamps[i - 1] != interval)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::vector<uint8_t> ConstantStrideEncoding::compressTimestamps(const uint64_t *timestamps, size_t count)
+    {
+        if (!isConstantStride(timestamps, count))
+        {
+            throw std::invalid_argument("Timestamps do not have a constant stride");
+        }
+
+        Stride stride{timestamps[0], count > 1 ? timestamps[1] - timestamps[0] : 0, count};
+
+        std::vector<uint8_t> result(sizeof(Stride));
+        memcpy(result.data(), &stride, sizeof(Stride));
+        return result;
+    }
+
+    std::vector<uint64_t> ConstantStrideEncoding::decompressTimestamps(const uint8_t *data, size_t size)
+    {
+        Stride stride = decode(data, size);
+
+        std::vector<uint64_t> result(stride.count);
+        for (size_t i = 0; i < result.size(); ++i)
+        {
+            result[i] = stride.at(i);
+        }
+        return result;
+    }
+
+    ConstantStrideEncoding::Stride ConstantStrideEncoding::decode(const uint8_t *data, size_t size)
+    {
+        if (size < sizeof(Stride))
+        {
+            throw std::runtime_error("Stride block truncated");
+        }
+
+        Stride stride;
+        memcpy(&stride, data, sizeof(Stride));
+        return stride;
+    }
+
     // RunLengthEncoding implementation
     std::vector<uint8_t> RunLengthEncoding::compress(const uint8_t *data, size_t size)
     {
@@ -302,10 +561,404 @@ namespace waffledb
         return result;
     }
 
+    namespace
+    {
+        // MSB-first bit stream writer
+        class BitWriter
+        {
+        private:
+            std::vector<uint8_t> &out_;
+            unsigned used_ = 8; // bits used in the last byte
+
+        public:
+            explicit BitWriter(std::vector<uint8_t> &out) : out_(out) {}
+
+            void write(uint64_t bits, unsigned count)
+            {
+                while (count > 0)
+                {
+                    if (used_ == 8)
+                    {
+                        out_.push_back(0);
+                        used_ = 0;
+                    }
+                    unsigned take = std::min(8 - used_, count);
+                    uint8_t chunk = static_cast<uint8_t>((bits >> (count - take)) & ((1u << take) - 1));
+                    out_.back() |= static_cast<uint8_t>(chunk << (8 - used_ - take));
+                    used_ += take;
+                    count -= take;
+                }
+            }
+        };
+
+        // Only counts bits, lets the selector size a stream without writing it
+        class BitCounter
+        {
+        public:
+            size_t bits = 0;
+            void write(uint64_t, unsigned count) { bits += count; }
+        };
+
+        inline unsigned leadingZeros(uint64_t v)
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            return v == 0 ? 64 : static_cast<unsigned>(__builtin_clzll(v));
+#else
+            unsigned n = 0;
+            for (uint64_t mask = 1ULL << 63; mask && !(v & mask); mask >>= 1)
+                ++n;
+            return n;
+#endif
+        }
+
+        inline unsigned trailingZeros(uint64_t v)
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            return v == 0 ? 64 : static_cast<unsigned>(__builtin_ctzll(v));
+#else
+            unsigned n = 0;
+            for (uint64_t mask = 1; mask && !(v & mask); mask <<= 1)
+                ++n;
+            return n;
+#endif
+        }
+
+        // Control bits per value:
+        //   0                   same value as the previous one
+        //   10 <bits>           XOR fits in the previous meaningful window
+        //   11 <5> <6> <bits>   new window: leading zeros, meaningful length - 1
+        template <typename Sink>
+        void encodeGorilla(const double *values, size_t count, Sink &sink)
+        {
+            uint64_t previous;
+            memcpy(&previous, &values[0], sizeof(double));
+            sink.write(previous, 64);
+
+            unsigned prevLeading = 0;
+            unsigned prevMeaningful = 0;
+
+            for (size_t i = 1; i < count; ++i)
+            {
+                uint64_t current;
+                memcpy(&current, &values[i], sizeof(double));
+                uint64_t x = current ^ previous;
+                previous = current;
+
+                if (x == 0)
+                {
+                    sink.write(0, 1);
+                    continue;
+                }
+
+                unsigned leading = std::min(leadingZeros(x), 31u);
+                unsigned trailing = trailingZeros(x);
+                unsigned prevTrailing = 64 - prevLeading - prevMeaningful;
+
+                if (prevMeaningful != 0 && leading >= prevLeading && trailing >= prevTrailing)
+                {
+                    sink.write(0b10, 2);
+                    sink.write(x >> prevTrailing, prevMeaningful);
+                }
+                else
+                {
+                    unsigned meaningful = 64 - leading - trailing;
+                    sink.write(0b11, 2);
+                    sink.write(leading, 5);
+                    sink.write(meaningful - 1, 6);
+                    sink.write(x >> trailing, meaningful);
+                    prevLeading = leading;
+                    prevMeaningful = meaningful;
+                }
+            }
+        }
+    } // namespace
+
+    // GorillaEncoding implementation
+    std::vector<uint8_t> GorillaEncoding::compress(const uint8_t *data, size_t size)
+    {
+        std::vector<double> values(size / sizeof(double));
+        memcpy(values.data(), data, values.size() * sizeof(double));
+        return compressDoubles(values.data(), values.size());
+    }
+
+    std::vector<uint8_t> GorillaEncoding::decompress(const uint8_t *data, size_t size)
+    {
+        std::vector<double> values = decompressDoubles(data, size);
+        std::vector<uint8_t> result(values.size() * sizeof(double));
+        memcpy(result.data(), values.data(), result.size());
+        return result;
+    }
+
+    std::vector<uint8_t> GorillaEncoding::compressDoubles(const double *values, size_t count)
+    {
+        std::vector<uint8_t> result;
+        if (count == 0)
+            return result;
+
+        // Store count
+        uint64_t count64 = count;
+        result.resize(sizeof(uint64_t));
+        memcpy(result.data(), &count64, sizeof(uint64_t));
+
+        BitWriter writer(result);
+        encodeGorilla(values, count, writer);
+
+        return result;
+    }
+
+    std::vector<double> GorillaEncoding::decompressDoubles(const uint8_t *data, size_t size)
+    {
+        GorillaDecoder decoder(data, size);
+
+        std::vector<double> result;
+        result.reserve(decoder.count());
+
+        double value;
+        while (decoder.next(value))
+        {
+            result.push_back(value);
+        }
+
+        return result;
+    }
+
+    size_t GorillaEncoding::encodedSize(const double *values, size_t count)
+    {
+        if (count == 0)
+            return 0;
+
+        BitCounter counter;
+        encodeGorilla(values, count, counter);
+        return sizeof(uint64_t) + (counter.bits + 7) / 8;
+    }
+
+    // GorillaDecoder implementation
+    GorillaDecoder::GorillaDecoder(const uint8_t *data, size_t size)
+        : data_(data), sizeBits_(0)
+    {
+        if (size < sizeof(uint64_t))
+            return;
+
+        uint64_t count;
+        memcpy(&count, data, sizeof(uint64_t));
+        count_ = static_cast<size_t>(count);
+
+        data_ = data + sizeof(uint64_t);
+        sizeBits_ = (size - sizeof(uint64_t)) * 8;
+    }
+
+    uint64_t GorillaDecoder::readBits(unsigned bits)
+    {
+        if (bitPos_ + bits > sizeBits_)
+        {
+            throw std::runtime_error("Gorilla stream truncated");
+        }
+
+        uint64_t result = 0;
+        while (bits > 0)
+        {
+            unsigned offset = static_cast<unsigned>(bitPos_ & 7);
+            unsigned take = std::min(8 - offset, bits);
+            uint8_t chunk = static_cast<uint8_t>((data_[bitPos_ >> 3] >> (8 - offset - take)) & ((1u << take) - 1));
+            result = (result << take) | chunk;
+            bitPos_ += take;
+            bits -= take;
+        }
+        return result;
+    }
+
+    bool GorillaDecoder::next(double &value)
+    {
+        if (index_ >= count_)
+            return false;
+
+        if (index_ == 0)
+        {
+            previous_ = readBits(64);
+        }
+        else if (readBits(1) != 0)
+        {
+            if (readBits(1) != 0)
+            {
+                leading_ = static_cast<uint8_t>(readBits(5));
+                meaningful_ = static_cast<uint8_t>(readBits(6) + 1);
+            }
+            unsigned trailing = 64 - leading_ - meaningful_;
+            previous_ ^= readBits(meaningful_) << trailing;
+        }
+
+        memcpy(&value, &previous_, sizeof(double));
+        index_++;
+        return true;
+    }
+
+    void GorillaDecoder::skip(size_t n)
+    {
+        double ignored;
+        for (size_t i = 0; i < n && next(ignored); ++i)
+        {
+        }
+    }
+
+    RunLengthEncoding::RangeAggregate RunLengthEncoding::aggregateRange(
+        const uint8_t *data, size_t size, size_t first, size_t last)
+    {
+        RangeAggregate result;
+        if (size < sizeof(size_t) || first >= last)
+            return result;
+
+        const uint8_t *ptr = data + sizeof(size_t);
+        const uint8_t *end = data + size;
+        constexpr size_t runSize = sizeof(uint16_t) + sizeof(double);
+
+        size_t position = 0;
+        while (position < last && end - ptr >= static_cast<ptrdiff_t>(runSize))
+        {
+            uint16_t runLength;
+            double value;
+            memcpy(&runLength, ptr, sizeof(uint16_t));
+            memcpy(&value, ptr + sizeof(uint16_t), sizeof(double));
+            ptr += runSize;
+
+            size_t runStart = std::max(position, first);
+            size_t runEnd = std::min(position + runLength, last);
+            position += runLength;
+
+            if (runStart >= runEnd)
+                continue;
+
+            size_t covered = runEnd - runStart;
+            if (result.count == 0)
+            {
+                result.min = value;
+                result.max = value;
+            }
+            else
+            {
+                result.min = std::min(result.min, value);
+                result.max = std::max(result.max, value);
+            }
+            result.sum += value * static_cast<double>(covered);
+            result.count += covered;
+        }
+
+        return result;
+    }
+
     // BitPackingCompression implementation
+    namespace
+    {
+        constexpr size_t PACK_LANES = 4;
+        constexpr size_t VALUES_PER_LANE = BitPackingCompression::BLOCK_SIZE / PACK_LANES;
+
+        inline size_t wordsPerLane(uint8_t width)
+        {
+            return (VALUES_PER_LANE * width + 63) / 64;
+        }
+
+        inline uint64_t widthMask(uint8_t width)
+        {
+            return width >= 64 ? ~0ULL : ((1ULL << width) - 1);
+        }
+
+        // Packs one block of BLOCK_SIZE offsets; value i lives in lane i % 4
+        void packBlock(const uint64_t *offsets, uint8_t width, uint64_t *words)
+        {
+            if (width == 0)
+                return;
+
+            for (size_t lane = 0; lane < PACK_LANES; ++lane)
+            {
+                for (size_t j = 0; j < VALUES_PER_LANE; ++j)
+                {
+                    uint64_t value = offsets[j * PACK_LANES + lane];
+                    size_t bitOffset = j * width;
+                    size_t word = bitOffset / 64;
+                    unsigned shift = static_cast<unsigned>(bitOffset % 64);
+
+                    words[word * PACK_LANES + lane] |= value << shift;
+                    if (shift + width > 64)
+                    {
+                        words[(word + 1) * PACK_LANES + lane] |= value >> (64 - shift);
+                    }
+                }
+            }
+        }
+
+        // Unpacks one block and adds the base back, four values per step
+        void unpackBlock(const uint8_t *words, uint8_t width, uint64_t base, uint64_t *out)
+        {
+            if (width == 0)
+            {
+                std::fill(out, out + BitPackingCompression::BLOCK_SIZE, base);
+                return;
+            }
+
+#ifdef __AVX2__
+            const __m256i mask = _mm256_set1_epi64x(static_cast<long long>(widthMask(width)));
+            const __m256i baseVec = _mm256_set1_epi64x(static_cast<long long>(base));
+
+            for (size_t j = 0; j < VALUES_PER_LANE; ++j)
+            {
+                size_t bitOffset = j * width;
+                size_t word = bitOffset / 64;
+                unsigned shift = static_cast<unsigned>(bitOffset % 64);
+
+                __m256i lo = _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i *>(words + word * PACK_LANES * sizeof(uint64_t)));
+                __m256i v = _mm256_srl_epi64(lo, _mm_cvtsi32_si128(static_cast<int>(shift)));
+
+                if (shift + width > 64)
+                {
+                    __m256i hi = _mm256_loadu_si256(
+                        reinterpret_cast<const __m256i *>(words + (word + 1) * PACK_LANES * sizeof(uint64_t)));
+                    v = _mm256_or_si256(v, _mm256_sll_epi64(hi, _mm_cvtsi32_si128(static_cast<int>(64 - shift))));
+                }
+
+                v = _mm256_add_epi64(_mm256_and_si256(v, mask), baseVec);
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + j * PACK_LANES), v);
+            }
+#else
+            const uint64_t mask = widthMask(width);
+            for (size_t j = 0; j < VALUES_PER_LANE; ++j)
+            {
+                size_t bitOffset = j * width;
+                size_t word = bitOffset / 64;
+                unsigned shift = static_cast<unsigned>(bitOffset % 64);
+
+                for (size_t lane = 0; lane < PACK_LANES; ++lane)
+                {
+                    uint64_t lo;
+                    memcpy(&lo, words + (word * PACK_LANES + lane) * sizeof(uint64_t), sizeof(uint64_t));
+                    uint64_t v = lo >> shift;
+
+                    if (shift + width > 64)
+                    {
+                        uint64_t hi;
+                        memcpy(&hi, words + ((word + 1) * PACK_LANES + lane) * sizeof(uint64_t), sizeof(uint64_t));
+                        v |= hi << (64 - shift);
+                    }
+
+                    out[j * PACK_LANES + lane] = (v & mask) + base;
+                }
+            }
+#endif
+        }
+    } // namespace
+
     BitPackingCompression::BitPackingCompression(uint8_t bitsPerValue)
         : bitsPerValue_(bitsPerValue) {}
 
+    uint8_t BitPackingCompression::bitWidth(uint64_t maxValue)
+    {
+        uint8_t bits = 0;
+        while (bits < 64 && (maxValue >> bits) != 0)
+        {
+            bits++;
+        }
+        return bits;
+    }
+
     void BitPackingCompression::detectBitWidth(const uint64_t *values, size_t count)
     {
         uint64_t maxValue = 0;
@@ -314,35 +967,129 @@ namespace waffledb
             maxValue = std::max(maxValue, values[i]);
         }
 
-        bitsPerValue_ = 1;
-        while ((1ULL << bitsPerValue_) <= maxValue && bitsPerValue_ < 64)
-        {
-            bitsPerValue_++;
-        }
+        bitsPerValue_ = bitWidth(maxValue);
     }
 
     std::vector<uint8_t> BitPackingCompression::compress(const uint8_t *data, size_t size)
     {
-        // Simple bit packing for bytes
+        std::vector<uint64_t> values(size / sizeof(uint64_t));
+        memcpy(values.data(), data, values.size() * sizeof(uint64_t));
+        return packIntegers(values.data(), values.size());
+    }
+
+    std::vector<uint8_t> BitPackingCompression::decompress(const uint8_t *data, size_t size)
+    {
+        std::vector<uint64_t> values = unpackIntegers(data, size);
+        std::vector<uint8_t> result(values.size() * sizeof(uint64_t));
+        memcpy(result.data(), values.data(), result.size());
+        return result;
+    }
+
+    // Layout: count, then per block: base (8 bytes), width (1 byte) and
+    // 4 * wordsPerLane(width) little-endian words. The last block is padded
+    // with the base value.
+    std::vector<uint8_t> BitPackingCompression::packIntegers(const uint64_t *values, size_t count)
+    {
         std::vector<uint8_t> result;
+        if (count == 0)
+            return result;
 
-        // For now, just copy - real implementation would pack bits
-        result.assign(data, data + size);
+        result.reserve(packedSize(values, count));
+
+        uint64_t count64 = count;
+        result.resize(sizeof(uint64_t));
+        memcpy(result.data(), &count64, sizeof(uint64_t));
+
+        uint64_t offsets[BLOCK_SIZE];
+        std::vector<uint64_t> words;
+
+        for (size_t blockStart = 0; blockStart < count; blockStart += BLOCK_SIZE)
+        {
+            size_t n = std::min(BLOCK_SIZE, count - blockStart);
+            uint64_t base = *std::min_element(values + blockStart, values + blockStart + n);
+
+            for (size_t i = 0; i < BLOCK_SIZE; ++i)
+            {
+                offsets[i] = i < n ? values[blockStart + i] - base : 0;
+            }
+            detectBitWidth(offsets, n);
+
+            words.assign(PACK_LANES * wordsPerLane(bitsPerValue_), 0);
+            packBlock(offsets, bitsPerValue_, words.data());
+
+            size_t oldSize = result.size();
+            result.resize(oldSize + sizeof(uint64_t) + 1 + words.size() * sizeof(uint64_t));
+            memcpy(result.data() + oldSize, &base, sizeof(uint64_t));
+            result[oldSize + sizeof(uint64_t)] = bitsPerValue_;
+            memcpy(result.data() + oldSize + sizeof(uint64_t) + 1, words.data(), words.size() * sizeof(uint64_t));
+        }
 
         return result;
     }
 
-    std::vector<uint8_t> BitPackingCompression::decompress(const uint8_t *data, size_t size)
+    std::vector<uint64_t> BitPackingCompression::unpackIntegers(const uint8_t *data, size_t size)
     {
-        // For now, just copy - real implementation would unpack bits
-        return std::vector<uint8_t>(data, data + size);
+        if (size < sizeof(uint64_t))
+            return {};
+
+        uint64_t count;
+        memcpy(&count, data, sizeof(uint64_t));
+
+        size_t blocks = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        std::vector<uint64_t> result(blocks * BLOCK_SIZE);
+
+        const uint8_t *ptr = data + sizeof(uint64_t);
+        const uint8_t *end = data + size;
+
+        for (size_t block = 0; block < blocks; ++block)
+        {
+            if (end - ptr < static_cast<ptrdiff_t>(sizeof(uint64_t) + 1))
+            {
+                throw std::runtime_error("Bit-packed block truncated");
+            }
+
+            uint64_t base;
+            memcpy(&base, ptr, sizeof(uint64_t));
+            uint8_t width = ptr[sizeof(uint64_t)];
+            ptr += sizeof(uint64_t) + 1;
+
+            size_t wordBytes = PACK_LANES * wordsPerLane(width) * sizeof(uint64_t);
+            if (width > 64 || end - ptr < static_cast<ptrdiff_t>(wordBytes))
+            {
+                throw std::runtime_error("Bit-packed block truncated");
+            }
+
+            unpackBlock(ptr, width, base, result.data() + block * BLOCK_SIZE);
+            ptr += wordBytes;
+        }
+
+        result.resize(count);
+        return result;
+    }
+
+    size_t BitPackingCompression::packedSize(const uint64_t *values, size_t count)
+    {
+        if (count == 0)
+            return 0;
+
+        size_t size = sizeof(uint64_t);
+        for (size_t blockStart = 0; blockStart < count; blockStart += BLOCK_SIZE)
+        {
+            size_t n = std::min(BLOCK_SIZE, count - blockStart);
+            auto [lo, hi] = std::minmax_element(values + blockStart, values + blockStart + n);
+            size += sizeof(uint64_t) + 1 + PACK_LANES * wordsPerLane(bitWidth(*hi - *lo)) * sizeof(uint64_t);
+        }
+        return size;
     }
 
     // CompressionEngine implementation
     CompressionEngine::CompressionEngine()
         : deltaEncoder_(std::make_unique<DeltaEncoding>()),
+          dodEncoder_(std::make_unique<DeltaOfDeltaEncoding>()),
+          strideEncoder_(std::make_unique<ConstantStrideEncoding>()),
           rleEncoder_(std::make_unique<RunLengthEncoding>()),
-          bitPacker_(std::make_unique<BitPackingCompression>()) {}
+          bitPacker_(std::make_unique<BitPackingCompression>()),
+          gorillaEncoder_(std::make_unique<GorillaEncoding>()) {}
 
     CompressionEngine::~CompressionEngine() = default;
 
@@ -354,10 +1101,28 @@ namespace waffledb
 
         // Choose and apply timestamp compression
         result.timestampCodec = selectTimestampCodec(timestamps, count);
-        if (result.timestampCodec == "delta")
+        if (result.timestampCodec == "stride")
+        {
+            result.timestamps = strideEncoder_->compressTimestamps(timestamps, count);
+        }
+        else if (result.timestampCodec == "dod")
+        {
+            result.timestamps = dodEncoder_->compressTimestamps(timestamps, count);
+        }
+        else if (result.timestampCodec == "bitpack")
+        {
+            result.timestamps = packTimestamps(timestamps, count);
+        }
+        else if (result.timestampCodec == "delta")
         {
             result.timestamps = deltaEncoder_->compressTimestamps(timestamps, count);
         }
+        else
+        {
+            // No compression - just copy
+            result.timestamps.resize(count * sizeof(uint64_t));
+            memcpy(result.timestamps.data(), timestamps, count * sizeof(uint64_t));
+        }
 
         // Choose and apply value compression
         result.valueCodec = selectValueCodec(values, count);
@@ -365,6 +1130,14 @@ namespace waffledb
         {
             result.values = rleEncoder_->compressDoubles(values, count);
         }
+        else if (result.valueCodec == "gorilla")
+        {
+            result.values = gorillaEncoder_->compressDoubles(values, count);
+        }
+        else if (result.valueCodec == "bitpack")
+        {
+            result.values = packValues(values, count);
+        }
         else
         {
             // No compression - just copy
@@ -379,7 +1152,7 @@ namespace waffledb
         lastStats_ = {
             originalSize,
             compressedSize,
-            static_cast<double>(originalSize) / compressedSize,
+            compressedSize > 0 ? static_cast<double>(originalSize) / compressedSize : 1.0,
             result.timestampCodec + "+" + result.valueCodec};
 
         return result;
@@ -390,28 +1163,71 @@ namespace waffledb
     {
 
         DecompressedData result;
+        result.timestamps = decompressTimestamps(compressed);
+        result.values = decompressValues(compressed);
+        return result;
+    }
+
+    std::vector<uint64_t> CompressionEngine::decompressTimestamps(const CompressedData &compressed)
+    {
+        return decodeTimestamps(compressed.timestampCodec, compressed.timestamps.data(),
+                                compressed.timestamps.size());
+    }
 
-        // Decompress timestamps
-        if (compressed.timestampCodec == "delta")
+    std::vector<double> CompressionEngine::decompressValues(const CompressedData &compressed)
+    {
+        return decodeValues(compressed.valueCodec, compressed.values.data(), compressed.values.size());
+    }
+
+    std::vector<uint64_t> CompressionEngine::decodeTimestamps(const std::string &codec, const uint8_t *data, size_t size)
+    {
+        if (codec == "stride")
         {
-            result.timestamps = deltaEncoder_->decompressTimestamps(
-                compressed.timestamps.data(), compressed.timestamps.size());
+            return strideEncoder_->decompressTimestamps(data, size);
+        }
+        if (codec == "dod")
+        {
+            return dodEncoder_->decompressTimestamps(data, size);
+        }
+        if (codec == "bitpack")
+        {
+            return unpackTimestamps(data, size);
+        }
+        if (codec == "delta")
+        {
+            return deltaEncoder_->decompressTimestamps(data, size);
         }
 
-        // Decompress values
-        if (compressed.valueCodec == "rle")
+        // No compression - just copy
+        std::vector<uint64_t> result(size / sizeof(uint64_t));
+        if (!result.empty())
         {
-            result.values = rleEncoder_->decompressDoubles(
-                compressed.values.data(), compressed.values.size());
+            memcpy(result.data(), data, result.size() * sizeof(uint64_t));
         }
-        else
+        return result;
+    }
+
+    std::vector<double> CompressionEngine::decodeValues(const std::string &codec, const uint8_t *data, size_t size)
+    {
+        if (codec == "rle")
         {
-            // No compression - just copy
-            size_t count = compressed.values.size() / sizeof(double);
-            result.values.resize(count);
-            memcpy(result.values.data(), compressed.values.data(), compressed.values.size());
+            return rleEncoder_->decompressDoubles(data, size);
+        }
+        if (codec == "gorilla")
+        {
+            return gorillaEncoder_->decompressDoubles(data, size);
+        }
+        if (codec == "bitpack")
+        {
+            return unpackValues(data, size);
         }
 
+        // No compression - just copy
+        std::vector<double> result(size / sizeof(double));
+        if (!result.empty())
+        {
+            memcpy(result.data(), data, result.size() * sizeof(double));
+        }
         return result;
     }
 
@@ -420,65 +1236,183 @@ namespace waffledb
         if (count < 2)
             return "none";
 
-        // Check if timestamps are regular (fixed interval)
-        bool regular = true;
-        int64_t firstDelta = timestamps[1] - timestamps[0];
-
-        for (size_t i = 2; i < count; ++i)
+        // Scraper-generated series with a fixed interval collapse to O(1) bytes
+        if (ConstantStrideEncoding::isConstantStride(timestamps, count))
         {
-            if (timestamps[i] - timestamps[i - 1] != firstDelta)
-            {
-                regular = false;
-                break;
-            }
+            return "stride";
         }
 
-        // Use delta encoding for all timestamp data
-        return "delta";
+        // Otherwise whichever of delta-of-delta varints and bit-packed
+        // deltas is smaller; "delta" is only kept for decoding chunks
+        // written by older versions
+        size_t dodSize = dodEncoder_->compressTimestamps(timestamps, count).size();
+        std::vector<uint64_t> deltas = zigzagDeltas(timestamps, count);
+        size_t packedSize = sizeof(uint64_t) + BitPackingCompression::packedSize(deltas.data(), deltas.size());
+
+        return packedSize < dodSize ? "bitpack" : "dod";
     }
 
-    std::string CompressionEngine::selectValueCodec(const double *values, size_t count)
+    std::vector<uint8_t> CompressionEngine::packTimestamps(const uint64_t *timestamps, size_t count)
     {
-        if (count < 10)
-            return "none";
+        std::vector<uint8_t> result(sizeof(uint64_t));
+        memcpy(result.data(), &timestamps[0], sizeof(uint64_t));
 
-        // Count unique values
-        std::unordered_map<double, size_t> valueCounts;
+        std::vector<uint64_t> deltas = zigzagDeltas(timestamps, count);
+        std::vector<uint8_t> packed = bitPacker_->packIntegers(deltas.data(), deltas.size());
+        result.insert(result.end(), packed.begin(), packed.end());
+        return result;
+    }
+
+    std::vector<uint64_t> CompressionEngine::unpackTimestamps(const uint8_t *data, size_t size)
+    {
+        if (size < sizeof(uint64_t))
+            return {};
+
+        uint64_t current;
+        memcpy(&current, data, sizeof(uint64_t));
+
+        std::vector<uint64_t> deltas = bitPacker_->unpackIntegers(data + sizeof(uint64_t), size - sizeof(uint64_t));
+
+        std::vector<uint64_t> result;
+        result.reserve(deltas.size() + 1);
+        result.push_back(current);
+        for (uint64_t delta : deltas)
+        {
+            current += static_cast<uint64_t>(zigzagDecode(delta));
+            result.push_back(current);
+        }
+        return result;
+    }
+
+    std::vector<uint8_t> CompressionEngine::packValues(const double *values, size_t count)
+    {
+        std::vector<int64_t> integers;
+        if (!integralValues(values, count, integers))
+        {
+            throw std::invalid_argument("Bit-packing requires integral values");
+        }
+
+        std::vector<uint64_t> biased(count);
         for (size_t i = 0; i < count; ++i)
         {
-            valueCounts[values[i]]++;
+            biased[i] = biasEncode(integers[i]);
         }
+        std::vector<uint64_t> deltas = zigzagDeltas(integers.data(), count);
 
-        // If few unique values relative to total, use RLE
-        if (valueCounts.size() < count / 10)
+        // Counters pack best as deltas, bounded gauges as plain offsets
+        std::vector<uint8_t> result;
+        if (sizeof(int64_t) + BitPackingCompression::packedSize(deltas.data(), deltas.size()) <
+            BitPackingCompression::packedSize(biased.data(), count))
         {
-            return "rle";
+            result.push_back(PACK_MODE_DELTA);
+            result.resize(1 + sizeof(int64_t));
+            memcpy(result.data() + 1, &integers[0], sizeof(int64_t));
+            std::vector<uint8_t> packed = bitPacker_->packIntegers(deltas.data(), deltas.size());
+            result.insert(result.end(), packed.begin(), packed.end());
+        }
+        else
+        {
+            result.push_back(PACK_MODE_FOR);
+            std::vector<uint8_t> packed = bitPacker_->packIntegers(biased.data(), count);
+            result.insert(result.end(), packed.begin(), packed.end());
         }
+        return result;
+    }
 
-        // Check for runs
-        size_t totalRuns = 0;
+    std::vector<double> CompressionEngine::unpackValues(const uint8_t *data, size_t size)
+    {
+        if (size < 1)
+            return {};
+
+        std::vector<double> result;
+
+        if (data[0] == PACK_MODE_DELTA)
+        {
+            if (size < 1 + sizeof(int64_t))
+            {
+                throw std::runtime_error("Bit-packed value block truncated");
+            }
+
+            int64_t current;
+            memcpy(&current, data + 1, sizeof(int64_t));
+            std::vector<uint64_t> deltas = bitPacker_->unpackIntegers(
+                data + 1 + sizeof(int64_t), size - 1 - sizeof(int64_t));
+
+            result.reserve(deltas.size() + 1);
+            result.push_back(static_cast<double>(current));
+            for (uint64_t delta : deltas)
+            {
+                current += zigzagDecode(delta);
+                result.push_back(static_cast<double>(current));
+            }
+        }
+        else
+        {
+            std::vector<uint64_t> biased = bitPacker_->unpackIntegers(data + 1, size - 1);
+            result.reserve(biased.size());
+            for (uint64_t value : biased)
+            {
+                result.push_back(static_cast<double>(biasDecode(value)));
+            }
+        }
+
+        return result;
+    }
+
+    std::string CompressionEngine::selectValueCodec(const double *values, size_t count)
+    {
+        if (count < 10)
+            return "none";
+
+        // Both candidate encodings can be sized exactly in a single pass,
+        // pick whichever produces the smallest block
+        size_t rawSize = count * sizeof(double);
+
+        size_t runs = 0;
         size_t i = 0;
         while (i < count)
         {
             size_t runLength = 1;
-            while (i + runLength < count && values[i + runLength] == values[i])
+            while (i + runLength < count && values[i + runLength] == values[i] && runLength < 65535)
             {
                 runLength++;
             }
-            if (runLength > 1)
+            runs++;
+            i += runLength;
+        }
+        size_t rleSize = sizeof(size_t) + runs * (sizeof(uint16_t) + sizeof(double));
+        size_t gorillaSize = GorillaEncoding::encodedSize(values, count);
+
+        // Integral columns (counters) can also be bit-packed
+        size_t packedSize = SIZE_MAX;
+        std::vector<int64_t> integers;
+        if (integralValues(values, count, integers))
+        {
+            std::vector<uint64_t> biased(count);
+            for (size_t j = 0; j < count; ++j)
             {
-                totalRuns += runLength;
+                biased[j] = biasEncode(integers[j]);
             }
-            i += runLength;
+            std::vector<uint64_t> deltas = zigzagDeltas(integers.data(), count);
+
+            packedSize = 1 + std::min(BitPackingCompression::packedSize(biased.data(), count),
+                                      sizeof(int64_t) + BitPackingCompression::packedSize(deltas.data(), deltas.size()));
         }
 
-        // If significant runs exist, use RLE
-        if (totalRuns > count / 2)
+        size_t best = std::min({rawSize, rleSize, gorillaSize, packedSize});
+        if (best == rawSize)
+        {
+            return "none";
+        }
+        if (best == rleSize)
         {
             return "rle";
         }
-
-        return "none";
+        if (best == packedSize)
+        {
+            return "bitpack";
+        }
+        return "gorilla";
     }
 
     // CompressionBlockHeader implementation
@@ -1,6 +1,7 @@
 // waffledb/src/dsl_parser.cpp
 #include "dsl_parser.h"
 #include "waffledb.h"
+#include "rollup.h"
 #include <sstream>
 #include <iomanip>
 #include <cctype>
@@ -901,13 +902,6 @@ namespace waffledb
                                query->timeRange->end.time_since_epoch())
                                .count();
 
-        auto points = db_->query(query->from->name, startTime, endTime, query->from->tags);
-
-        if (points.empty())
-        {
-            return results;
-        }
-
         // Apply windowing
         uint64_t windowDuration = query->window->duration.count() / 1000; // Convert to seconds
         uint64_t slideInterval = query->window->slide.count() / 1000;
@@ -917,6 +911,59 @@ namespace waffledb
             slideInterval = windowDuration; // Tumbling window
         }
 
+        std::shared_ptr<ast::AggregateFunc> aggFunc;
+        if (!query->select.empty())
+        {
+            aggFunc = std::dynamic_pointer_cast<ast::AggregateFunc>(query->select[0]);
+        }
+
+        // Minute-aligned tumbling windows are served from pre-aggregated rollups
+        if (aggFunc && slideInterval == windowDuration &&
+            aggFunc->type != ast::AggregateFunc::RATE && aggFunc->type != ast::AggregateFunc::DERIVATIVE)
+        {
+            std::vector<std::pair<uint64_t, RollupBucket>> windows;
+            if (db_->rollupWindows(query->from->name, startTime, endTime, windowDuration,
+                                   query->from->tags, windows))
+            {
+                for (const auto &[windowStart, bucket] : windows)
+                {
+                    AggregateResult result;
+                    result.timestamp = windowStart;
+                    result.metric = query->from->name;
+                    result.tags = query->from->tags;
+
+                    switch (aggFunc->type)
+                    {
+                    case ast::AggregateFunc::SUM:
+                        result.value = bucket.sum;
+                        break;
+                    case ast::AggregateFunc::AVG:
+                        result.value = bucket.avg();
+                        break;
+                    case ast::AggregateFunc::MIN:
+                        result.value = bucket.min;
+                        break;
+                    case ast::AggregateFunc::MAX:
+                        result.value = bucket.max;
+                        break;
+                    default:
+                        result.value = static_cast<double>(bucket.count);
+                        break;
+                    }
+
+                    results.push_back(result);
+                }
+                return results;
+            }
+        }
+
+        auto points = db_->query(query->from->name, startTime, endTime, query->from->tags);
+
+        if (points.empty())
+        {
+            return results;
+        }
+
         // Process windows
         for (uint64_t windowStart = startTime; windowStart < endTime; windowStart += slideInterval)
         {
@@ -941,12 +988,9 @@ namespace waffledb
                 result.tags = query->from->tags;
 
                 // Assume first select expression is an aggregate
-                if (!query->select.empty())
+                if (aggFunc)
                 {
-                    if (auto aggFunc = std::dynamic_pointer_cast<ast::AggregateFunc>(query->select[0]))
-                    {
-                        result.value = evaluateAggregate(aggFunc->type, windowPoints);
-                    }
+                    result.value = evaluateAggregate(aggFunc->type, windowPoints);
                 }
 
                 results.push_back(result);
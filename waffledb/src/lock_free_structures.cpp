@@ -7,6 +7,13 @@
 namespace waffledb
 {
 
+    size_t currentThreadSlot()
+    {
+        static std::atomic<size_t> nextSlot{0};
+        thread_local size_t slot = nextSlot.fetch_add(1, std::memory_order_relaxed);
+        return slot;
+    }
+
     // Thread-local storage definitions
     thread_local size_t EpochManager::threadId_ = SIZE_MAX;
     thread_local std::vector<EpochManager::RetiredPtr> EpochManager::retiredList_;
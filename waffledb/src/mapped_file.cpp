@@ -0,0 +1,78 @@
+// waffledb/src/mapped_file.cpp
+#include "mapped_file.h"
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace waffledb
+{
+
+    MappedFile::~MappedFile()
+    {
+#ifndef _WIN32
+        if (data_ && fallback_.empty())
+        {
+            munmap(const_cast<uint8_t *>(data_), length_);
+        }
+#endif
+    }
+
+    std::shared_ptr<const MappedFile> MappedFile::open(const std::string &path, size_t reserve)
+    {
+        std::shared_ptr<MappedFile> file(new MappedFile());
+
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return nullptr;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0)
+        {
+            ::close(fd);
+            return nullptr;
+        }
+
+        // Shared, so bytes appended later show through the mapping
+        size_t length = std::max(static_cast<size_t>(st.st_size), reserve);
+        void *addr = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd); // the mapping keeps its own reference to the file
+
+        if (addr == MAP_FAILED)
+        {
+            return nullptr;
+        }
+
+        file->data_ = static_cast<const uint8_t *>(addr);
+        file->size_ = static_cast<size_t>(st.st_size);
+        file->length_ = length;
+#else
+        (void)reserve;
+        std::ifstream in(path, std::ios::binary);
+        if (!in)
+        {
+            return nullptr;
+        }
+        file->fallback_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        if (file->fallback_.empty())
+        {
+            return nullptr;
+        }
+        file->data_ = file->fallback_.data();
+        file->size_ = file->fallback_.size();
+        file->length_ = file->size_;
+#endif
+
+        return file;
+    }
+
+} // namespace waffledb
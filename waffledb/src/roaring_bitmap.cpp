@@ -0,0 +1,744 @@
+// waffledb/src/roaring_bitmap.cpp
+#include "roaring_bitmap.h"
+#include "serialization.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace waffledb
+{
+
+    namespace
+    {
+        constexpr const char *BITMAP_SOURCE = "bitmap"; // named in read errors
+
+        inline uint32_t popcount64(uint64_t word)
+        {
+#ifdef _MSC_VER
+            return static_cast<uint32_t>(__popcnt64(word));
+#else
+            return static_cast<uint32_t>(__builtin_popcountll(word));
+#endif
+        }
+
+        inline uint32_t trailingZeros64(uint64_t word)
+        {
+#ifdef _MSC_VER
+            unsigned long index;
+            _BitScanForward64(&index, word);
+            return static_cast<uint32_t>(index);
+#else
+            return static_cast<uint32_t>(__builtin_ctzll(word));
+#endif
+        }
+
+        inline uint32_t leadingZeros64(uint64_t word)
+        {
+#ifdef _MSC_VER
+            unsigned long index;
+            _BitScanReverse64(&index, word);
+            return static_cast<uint32_t>(63 - index);
+#else
+            return static_cast<uint32_t>(__builtin_clzll(word));
+#endif
+        }
+
+        // Appends the positions of the set bits of a full bitmap in order
+        void appendSetBits(const uint64_t *words, std::vector<uint16_t> &values)
+        {
+            for (size_t w = 0; w < RoaringBitmap::BITMAP_WORDS; ++w)
+            {
+                for (uint64_t word = words[w]; word != 0; word &= word - 1)
+                {
+                    values.push_back(static_cast<uint16_t>(w * 64 + trailingZeros64(word)));
+                }
+            }
+        }
+
+        enum class WordOp
+        {
+            And,
+            Or,
+            AndNot
+        };
+
+        // Combines two full bitmaps word by word
+        void combineWords(const uint64_t *a, const uint64_t *b, uint64_t *out, WordOp op)
+        {
+#ifdef __AVX2__
+            static_assert(RoaringBitmap::BITMAP_WORDS % 4 == 0, "bitmap must fill whole AVX2 lanes");
+            for (size_t i = 0; i < RoaringBitmap::BITMAP_WORDS; i += 4)
+            {
+                __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+                __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+                __m256i result;
+                switch (op)
+                {
+                case WordOp::And:
+                    result = _mm256_and_si256(va, vb);
+                    break;
+                case WordOp::Or:
+                    result = _mm256_or_si256(va, vb);
+                    break;
+                default:
+                    result = _mm256_andnot_si256(vb, va);
+                    break;
+                }
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), result);
+            }
+#else
+            for (size_t i = 0; i < RoaringBitmap::BITMAP_WORDS; ++i)
+            {
+                switch (op)
+                {
+                case WordOp::And:
+                    out[i] = a[i] & b[i];
+                    break;
+                case WordOp::Or:
+                    out[i] = a[i] | b[i];
+                    break;
+                default:
+                    out[i] = a[i] & ~b[i];
+                    break;
+                }
+            }
+#endif
+        }
+
+        // Sets bits [first, last) of a full bitmap
+        void setRange(uint64_t *words, uint32_t first, uint32_t last)
+        {
+            while (first < last)
+            {
+                uint32_t word = first / 64;
+                uint32_t bit = first % 64;
+                uint32_t span = std::min<uint32_t>(64 - bit, last - first);
+                uint64_t mask = span == 64 ? ~0ULL : ((1ULL << span) - 1) << bit;
+                words[word] |= mask;
+                first += span;
+            }
+        }
+
+        // Sorted intersection that gallops through the longer input when
+        // the sizes are lopsided
+        std::vector<uint16_t> intersectArrays(const std::vector<uint16_t> &a, const std::vector<uint16_t> &b)
+        {
+            const auto &small = a.size() <= b.size() ? a : b;
+            const auto &large = a.size() <= b.size() ? b : a;
+
+            std::vector<uint16_t> result;
+            result.reserve(small.size());
+            if (small.size() * 16 < large.size())
+            {
+                auto from = large.begin();
+                for (uint16_t value : small)
+                {
+                    from = std::lower_bound(from, large.end(), value);
+                    if (from == large.end())
+                        break;
+                    if (*from == value)
+                        result.push_back(value);
+                }
+                return result;
+            }
+
+            std::set_intersection(small.begin(), small.end(), large.begin(), large.end(),
+                                  std::back_inserter(result));
+            return result;
+        }
+    } // namespace
+
+    bool RoaringBitmap::Container::contains(uint16_t low) const
+    {
+        switch (type)
+        {
+        case Type::Array:
+            return std::binary_search(values.begin(), values.end(), low);
+        case Type::Bitmap:
+            return (words[low / 64] >> (low % 64)) & 1;
+        default:
+        {
+            // Last run starting at or before low
+            auto it = std::upper_bound(runs.begin(), runs.end(), low,
+                                       [](uint16_t value, const std::pair<uint16_t, uint16_t> &run)
+                                       { return value < run.first; });
+            if (it == runs.begin())
+                return false;
+            --it;
+            return low - it->first <= it->second;
+        }
+        }
+    }
+
+    size_t RoaringBitmap::Container::sizeInBytes() const
+    {
+        switch (type)
+        {
+        case Type::Array:
+            return values.size() * sizeof(uint16_t);
+        case Type::Bitmap:
+            return BITMAP_WORDS * sizeof(uint64_t);
+        default:
+            return runs.size() * sizeof(runs[0]);
+        }
+    }
+
+    RoaringBitmap::RoaringBitmap(std::initializer_list<uint32_t> values)
+    {
+        for (uint32_t value : values)
+        {
+            add(value);
+        }
+    }
+
+    RoaringBitmap::Container &RoaringBitmap::containerFor(uint16_t key)
+    {
+        // Series IDs grow monotonically, so the common case is the last container
+        if (!keys_.empty() && keys_.back() == key)
+        {
+            return containers_.back();
+        }
+
+        auto it = std::lower_bound(keys_.begin(), keys_.end(), key);
+        size_t index = it - keys_.begin();
+        if (it == keys_.end() || *it != key)
+        {
+            keys_.insert(it, key);
+            containers_.insert(containers_.begin() + index, Container());
+        }
+        return containers_[index];
+    }
+
+    const uint64_t *RoaringBitmap::wordsOf(const Container &container, std::vector<uint64_t> &scratch)
+    {
+        if (container.type == Container::Type::Bitmap)
+        {
+            return container.words.data();
+        }
+
+        scratch.assign(BITMAP_WORDS, 0);
+        if (container.type == Container::Type::Array)
+        {
+            for (uint16_t value : container.values)
+            {
+                scratch[value / 64] |= 1ULL << (value % 64);
+            }
+        }
+        else
+        {
+            for (const auto &[start, length] : container.runs)
+            {
+                setRange(scratch.data(), start, static_cast<uint32_t>(start) + length + 1);
+            }
+        }
+        return scratch.data();
+    }
+
+    RoaringBitmap::Container RoaringBitmap::fromWords(std::vector<uint64_t> words)
+    {
+        Container container;
+        for (uint64_t word : words)
+        {
+            container.cardinality += popcount64(word);
+        }
+
+        if (container.cardinality > ARRAY_MAX)
+        {
+            container.type = Container::Type::Bitmap;
+            container.words = std::move(words);
+            return container;
+        }
+
+        container.values.reserve(container.cardinality);
+        appendSetBits(words.data(), container.values);
+        return container;
+    }
+
+    std::vector<uint16_t> RoaringBitmap::lowValues(const Container &container)
+    {
+        if (container.type == Container::Type::Array)
+        {
+            return container.values;
+        }
+
+        std::vector<uint64_t> scratch;
+        const uint64_t *words = wordsOf(container, scratch);
+
+        std::vector<uint16_t> values;
+        values.reserve(container.cardinality);
+        appendSetBits(words, values);
+        return values;
+    }
+
+    void RoaringBitmap::add(uint32_t value)
+    {
+        Container &container = containerFor(static_cast<uint16_t>(value >> 16));
+        uint16_t low = static_cast<uint16_t>(value & 0xFFFF);
+
+        switch (container.type)
+        {
+        case Container::Type::Array:
+        {
+            auto &values = container.values;
+            if (values.empty() || values.back() < low)
+            {
+                values.push_back(low);
+            }
+            else
+            {
+                auto it = std::lower_bound(values.begin(), values.end(), low);
+                if (*it == low)
+                    return;
+                values.insert(it, low);
+            }
+
+            if (++container.cardinality > ARRAY_MAX)
+            {
+                std::vector<uint64_t> scratch;
+                wordsOf(container, scratch);
+                container = fromWords(std::move(scratch));
+            }
+            break;
+        }
+        case Container::Type::Bitmap:
+        {
+            uint64_t &word = container.words[low / 64];
+            uint64_t bit = 1ULL << (low % 64);
+            if ((word & bit) == 0)
+            {
+                word |= bit;
+                ++container.cardinality;
+            }
+            break;
+        }
+        default:
+        {
+            if (container.contains(low))
+                return;
+
+            std::vector<uint64_t> scratch;
+            wordsOf(container, scratch);
+            scratch[low / 64] |= 1ULL << (low % 64);
+            container = fromWords(std::move(scratch));
+            break;
+        }
+        }
+    }
+
+    void RoaringBitmap::addRange(uint32_t first, uint32_t last)
+    {
+        uint64_t value = first;
+        while (value < last)
+        {
+            uint16_t key = static_cast<uint16_t>(value >> 16);
+            uint64_t chunkEnd = std::min<uint64_t>(last, (static_cast<uint64_t>(key) + 1) << 16);
+
+            Container &container = containerFor(key);
+            std::vector<uint64_t> scratch;
+            const uint64_t *words = wordsOf(container, scratch);
+            std::vector<uint64_t> updated(words, words + BITMAP_WORDS);
+            setRange(updated.data(), static_cast<uint32_t>(value & 0xFFFF),
+                     static_cast<uint32_t>(chunkEnd - (static_cast<uint64_t>(key) << 16)));
+            container = fromWords(std::move(updated));
+
+            value = chunkEnd;
+        }
+    }
+
+    bool RoaringBitmap::contains(uint32_t value) const
+    {
+        uint16_t key = static_cast<uint16_t>(value >> 16);
+        auto it = std::lower_bound(keys_.begin(), keys_.end(), key);
+        if (it == keys_.end() || *it != key)
+            return false;
+
+        return containers_[it - keys_.begin()].contains(static_cast<uint16_t>(value & 0xFFFF));
+    }
+
+    uint64_t RoaringBitmap::cardinality() const
+    {
+        uint64_t total = 0;
+        for (const auto &container : containers_)
+        {
+            total += container.cardinality;
+        }
+        return total;
+    }
+
+    uint32_t RoaringBitmap::maximum() const
+    {
+        if (keys_.empty())
+        {
+            throw std::out_of_range("Empty bitmap has no maximum");
+        }
+
+        const Container &container = containers_.back();
+        uint32_t low = 0;
+        switch (container.type)
+        {
+        case Container::Type::Array:
+            low = container.values.back();
+            break;
+        case Container::Type::Bitmap:
+            for (size_t w = BITMAP_WORDS; w-- > 0;)
+            {
+                if (container.words[w] != 0)
+                {
+                    low = static_cast<uint32_t>(w * 64 + 63 - leadingZeros64(container.words[w]));
+                    break;
+                }
+            }
+            break;
+        default:
+            low = static_cast<uint32_t>(container.runs.back().first) + container.runs.back().second;
+            break;
+        }
+        return (static_cast<uint32_t>(keys_.back()) << 16) | low;
+    }
+
+    std::vector<uint32_t> RoaringBitmap::toVector() const
+    {
+        std::vector<uint32_t> result;
+        result.reserve(cardinality());
+        for (size_t i = 0; i < keys_.size(); ++i)
+        {
+            uint32_t high = static_cast<uint32_t>(keys_[i]) << 16;
+            for (uint16_t low : lowValues(containers_[i]))
+            {
+                result.push_back(high | low);
+            }
+        }
+        return result;
+    }
+
+    void RoaringBitmap::runOptimize()
+    {
+        for (auto &container : containers_)
+        {
+            std::vector<std::pair<uint16_t, uint16_t>> runs;
+            for (uint16_t low : lowValues(container))
+            {
+                if (!runs.empty() && static_cast<uint32_t>(runs.back().first) + runs.back().second + 1 == low)
+                {
+                    ++runs.back().second;
+                }
+                else
+                {
+                    runs.emplace_back(low, 0);
+                }
+            }
+
+            if (runs.size() * sizeof(runs[0]) < container.sizeInBytes())
+            {
+                uint32_t cardinality = container.cardinality;
+                container = Container();
+                container.type = Container::Type::Run;
+                container.cardinality = cardinality;
+                container.runs = std::move(runs);
+            }
+        }
+    }
+
+    size_t RoaringBitmap::sizeInBytes() const
+    {
+        size_t bytes = keys_.size() * (sizeof(uint16_t) + sizeof(Container));
+        for (const auto &container : containers_)
+        {
+            bytes += container.sizeInBytes();
+        }
+        return bytes;
+    }
+
+    RoaringBitmap::Container RoaringBitmap::intersect(const Container &a, const Container &b)
+    {
+        using Type = Container::Type;
+
+        if (a.type == Type::Array || b.type == Type::Array)
+        {
+            Container result;
+            if (a.type == Type::Array && b.type == Type::Array)
+            {
+                result.values = intersectArrays(a.values, b.values);
+            }
+            else
+            {
+                // Probe the other container with each array value
+                const Container &array = a.type == Type::Array ? a : b;
+                const Container &other = a.type == Type::Array ? b : a;
+                for (uint16_t value : array.values)
+                {
+                    if (other.contains(value))
+                        result.values.push_back(value);
+                }
+            }
+            result.cardinality = static_cast<uint32_t>(result.values.size());
+            return result;
+        }
+
+        std::vector<uint64_t> scratchA, scratchB;
+        std::vector<uint64_t> words(BITMAP_WORDS);
+        combineWords(wordsOf(a, scratchA), wordsOf(b, scratchB), words.data(), WordOp::And);
+        return fromWords(std::move(words));
+    }
+
+    RoaringBitmap::Container RoaringBitmap::unite(const Container &a, const Container &b)
+    {
+        using Type = Container::Type;
+
+        if (a.type == Type::Array && b.type == Type::Array &&
+            a.cardinality + b.cardinality <= ARRAY_MAX)
+        {
+            Container result;
+            result.values.reserve(a.values.size() + b.values.size());
+            std::set_union(a.values.begin(), a.values.end(), b.values.begin(), b.values.end(),
+                           std::back_inserter(result.values));
+            result.cardinality = static_cast<uint32_t>(result.values.size());
+            return result;
+        }
+
+        std::vector<uint64_t> scratchA, scratchB;
+        std::vector<uint64_t> words(BITMAP_WORDS);
+        combineWords(wordsOf(a, scratchA), wordsOf(b, scratchB), words.data(), WordOp::Or);
+        return fromWords(std::move(words));
+    }
+
+    RoaringBitmap::Container RoaringBitmap::difference(const Container &a, const Container &b)
+    {
+        if (a.type == Container::Type::Array)
+        {
+            Container result;
+            for (uint16_t value : a.values)
+            {
+                if (!b.contains(value))
+                    result.values.push_back(value);
+            }
+            result.cardinality = static_cast<uint32_t>(result.values.size());
+            return result;
+        }
+
+        std::vector<uint64_t> scratchA, scratchB;
+        std::vector<uint64_t> words(BITMAP_WORDS);
+        combineWords(wordsOf(a, scratchA), wordsOf(b, scratchB), words.data(), WordOp::AndNot);
+        return fromWords(std::move(words));
+    }
+
+    RoaringBitmap RoaringBitmap::intersect(const RoaringBitmap &a, const RoaringBitmap &b)
+    {
+        RoaringBitmap result;
+        size_t i = 0, j = 0;
+        while (i < a.keys_.size() && j < b.keys_.size())
+        {
+            if (a.keys_[i] < b.keys_[j])
+            {
+                ++i;
+            }
+            else if (b.keys_[j] < a.keys_[i])
+            {
+                ++j;
+            }
+            else
+            {
+                Container container = intersect(a.containers_[i], b.containers_[j]);
+                if (container.cardinality > 0)
+                {
+                    result.keys_.push_back(a.keys_[i]);
+                    result.containers_.push_back(std::move(container));
+                }
+                ++i;
+                ++j;
+            }
+        }
+        return result;
+    }
+
+    RoaringBitmap RoaringBitmap::unite(const RoaringBitmap &a, const RoaringBitmap &b)
+    {
+        RoaringBitmap result;
+        size_t i = 0, j = 0;
+        while (i < a.keys_.size() || j < b.keys_.size())
+        {
+            if (j == b.keys_.size() || (i < a.keys_.size() && a.keys_[i] < b.keys_[j]))
+            {
+                result.keys_.push_back(a.keys_[i]);
+                result.containers_.push_back(a.containers_[i++]);
+            }
+            else if (i == a.keys_.size() || b.keys_[j] < a.keys_[i])
+            {
+                result.keys_.push_back(b.keys_[j]);
+                result.containers_.push_back(b.containers_[j++]);
+            }
+            else
+            {
+                result.keys_.push_back(a.keys_[i]);
+                result.containers_.push_back(unite(a.containers_[i++], b.containers_[j++]));
+            }
+        }
+        return result;
+    }
+
+    RoaringBitmap RoaringBitmap::difference(const RoaringBitmap &a, const RoaringBitmap &b)
+    {
+        RoaringBitmap result;
+        size_t j = 0;
+        for (size_t i = 0; i < a.keys_.size(); ++i)
+        {
+            while (j < b.keys_.size() && b.keys_[j] < a.keys_[i])
+                ++j;
+
+            Container container = j < b.keys_.size() && b.keys_[j] == a.keys_[i]
+                                      ? difference(a.containers_[i], b.containers_[j])
+                                      : a.containers_[i];
+            if (container.cardinality > 0)
+            {
+                result.keys_.push_back(a.keys_[i]);
+                result.containers_.push_back(std::move(container));
+            }
+        }
+        return result;
+    }
+
+    bool RoaringBitmap::operator==(const RoaringBitmap &other) const
+    {
+        if (keys_ != other.keys_)
+            return false;
+
+        for (size_t i = 0; i < keys_.size(); ++i)
+        {
+            if (containers_[i].cardinality != other.containers_[i].cardinality ||
+                lowValues(containers_[i]) != lowValues(other.containers_[i]))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Layout: container count, then per container its key, type,
+    // cardinality and payload (values, words, or run count and runs)
+    void RoaringBitmap::serialize(std::vector<uint8_t> &buffer) const
+    {
+        appendPod(buffer, static_cast<uint32_t>(keys_.size()));
+        for (size_t i = 0; i < keys_.size(); ++i)
+        {
+            const Container &container = containers_[i];
+            appendPod(buffer, keys_[i]);
+            appendPod(buffer, static_cast<uint8_t>(container.type));
+            appendPod(buffer, container.cardinality);
+
+            switch (container.type)
+            {
+            case Container::Type::Array:
+                for (uint16_t value : container.values)
+                    appendPod(buffer, value);
+                break;
+            case Container::Type::Bitmap:
+                for (uint64_t word : container.words)
+                    appendPod(buffer, word);
+                break;
+            default:
+                appendPod(buffer, static_cast<uint32_t>(container.runs.size()));
+                for (const auto &[start, length] : container.runs)
+                {
+                    appendPod(buffer, start);
+                    appendPod(buffer, length);
+                }
+                break;
+            }
+        }
+    }
+
+    RoaringBitmap RoaringBitmap::deserialize(const uint8_t *&ptr, size_t &remaining)
+    {
+        RoaringBitmap bitmap;
+
+        uint32_t count = readPod<uint32_t>(ptr, remaining, BITMAP_SOURCE);
+        if (count > 65536)
+        {
+            throw std::runtime_error("Invalid bitmap: too many containers");
+        }
+
+        for (uint32_t c = 0; c < count; ++c)
+        {
+            uint16_t key = readPod<uint16_t>(ptr, remaining, BITMAP_SOURCE);
+            if (!bitmap.keys_.empty() && key <= bitmap.keys_.back())
+            {
+                throw std::runtime_error("Invalid bitmap: unsorted containers");
+            }
+
+            Container container;
+            container.type = static_cast<Container::Type>(readPod<uint8_t>(ptr, remaining, BITMAP_SOURCE));
+            container.cardinality = readPod<uint32_t>(ptr, remaining, BITMAP_SOURCE);
+            if (container.cardinality == 0 || container.cardinality > 65536)
+            {
+                throw std::runtime_error("Invalid bitmap: bad container cardinality");
+            }
+
+            uint32_t actual = 0;
+            switch (container.type)
+            {
+            case Container::Type::Array:
+                container.values.reserve(container.cardinality);
+                for (uint32_t i = 0; i < container.cardinality; ++i)
+                {
+                    uint16_t value = readPod<uint16_t>(ptr, remaining, BITMAP_SOURCE);
+                    if (i > 0 && value <= container.values.back())
+                    {
+                        throw std::runtime_error("Invalid bitmap: unsorted array container");
+                    }
+                    container.values.push_back(value);
+                }
+                actual = container.cardinality;
+                break;
+            case Container::Type::Bitmap:
+                container.words.resize(BITMAP_WORDS);
+                for (auto &word : container.words)
+                {
+                    word = readPod<uint64_t>(ptr, remaining, BITMAP_SOURCE);
+                    actual += popcount64(word);
+                }
+                break;
+            case Container::Type::Run:
+            {
+                uint32_t runCount = readPod<uint32_t>(ptr, remaining, BITMAP_SOURCE);
+                if (runCount > container.cardinality)
+                {
+                    throw std::runtime_error("Invalid bitmap: too many runs");
+                }
+                uint32_t next = 0; // first value the next run may start at
+                for (uint32_t r = 0; r < runCount; ++r)
+                {
+                    uint16_t start = readPod<uint16_t>(ptr, remaining, BITMAP_SOURCE);
+                    uint16_t length = readPod<uint16_t>(ptr, remaining, BITMAP_SOURCE);
+                    if (start < next || static_cast<uint32_t>(start) + length > 0xFFFF)
+                    {
+                        throw std::runtime_error("Invalid bitmap: overlapping runs");
+                    }
+                    container.runs.emplace_back(start, length);
+                    actual += static_cast<uint32_t>(length) + 1;
+                    next = static_cast<uint32_t>(start) + length + 2;
+                }
+                break;
+            }
+            default:
+                throw std::runtime_error("Invalid bitmap: unknown container type");
+            }
+
+            if (actual != container.cardinality)
+            {
+                throw std::runtime_error("Invalid bitmap: cardinality mismatch");
+            }
+
+            bitmap.keys_.push_back(key);
+            bitmap.containers_.push_back(std::move(container));
+        }
+
+        return bitmap;
+    }
+
+} // namespace waffledb
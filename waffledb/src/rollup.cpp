@@ -0,0 +1,507 @@
+// waffledb/src/rollup.cpp
+#include "rollup.h"
+#include "serialization.h"
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+namespace waffledb
+{
+
+    namespace
+    {
+        constexpr uint32_t ROLLUP_MAGIC = 0x55524657; // "WFRU"
+        constexpr uint32_t ROLLUP_VERSION = 2; // 2 added the expiry state
+        constexpr const char *ROLLUP_SOURCE = "rollup data"; // named in read errors
+
+        // First multiple of width at or after value; false if it overflows
+        bool alignUp(uint64_t value, uint64_t width, uint64_t &aligned)
+        {
+            uint64_t remainder = value % width;
+            if (remainder == 0)
+            {
+                aligned = value;
+                return true;
+            }
+            aligned = value + (width - remainder);
+            return aligned > value;
+        }
+    } // namespace
+
+    void RollupBucket::add(double value)
+    {
+        ++count;
+        sum += value;
+        min = std::min(min, value);
+        max = std::max(max, value);
+    }
+
+    void RollupBucket::merge(const RollupBucket &other)
+    {
+        if (other.count == 0)
+            return;
+
+        count += other.count;
+        sum += other.sum;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+    }
+
+    RollupManager::RollupManager(const std::string &basePath)
+        : path_(basePath + "/rollups.dat")
+    {
+    }
+
+    std::string RollupManager::seriesKey(const std::unordered_map<std::string, std::string> &tags)
+    {
+        std::vector<std::pair<std::string, std::string>> sorted(tags.begin(), tags.end());
+        std::sort(sorted.begin(), sorted.end());
+
+        std::string key;
+        for (const auto &[name, value] : sorted)
+        {
+            key += name;
+            key += '=';
+            key += value;
+            key += '\0';
+        }
+        return key;
+    }
+
+    bool RollupManager::matches(const Series &series, const std::unordered_map<std::string, std::string> &tags)
+    {
+        for (const auto &[name, value] : tags)
+        {
+            auto it = series.tags.find(name);
+            if (it == series.tags.end() || it->second != value)
+                return false;
+        }
+        return true;
+    }
+
+    void RollupManager::add(const std::string &metric, const std::unordered_map<std::string, std::string> &tags,
+                            uint64_t timestamp, double value)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        MetricRollup &rollup = metrics_[metric];
+        ++rollup.points;
+
+        Series &series = rollup.series[seriesKey(tags)];
+        if (series.tags.empty())
+        {
+            series.tags = tags;
+        }
+
+        addPoint(rollup, series, timestamp, value);
+        if (rollup.newest >= rollup.nextExpiry)
+        {
+            expire(rollup);
+        }
+        dirty_ = true;
+    }
+
+    void RollupManager::add(const std::string &metric, const std::vector<const TimePoint *> &points)
+    {
+        // Series keys are built before taking the lock
+        std::vector<std::string> keys;
+        keys.reserve(points.size());
+        for (const TimePoint *point : points)
+        {
+            keys.push_back(seriesKey(point->tags));
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        MetricRollup &rollup = metrics_[metric];
+        rollup.points += points.size();
+
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            Series &series = rollup.series[keys[i]];
+            if (series.tags.empty())
+            {
+                series.tags = points[i]->tags;
+            }
+
+            addPoint(rollup, series, points[i]->timestamp, points[i]->value);
+        }
+
+        if (rollup.newest >= rollup.nextExpiry)
+        {
+            expire(rollup);
+        }
+        dirty_ = true;
+    }
+
+    // A point older than a level's horizon only reaches the coarser levels
+    void RollupManager::addPoint(MetricRollup &rollup, Series &series, uint64_t timestamp, double value)
+    {
+        for (size_t level = 0; level < ROLLUP_LEVELS.size(); ++level)
+        {
+            if (timestamp < rollup.keptFrom[level])
+                continue;
+            uint64_t bucketStart = timestamp - timestamp % ROLLUP_LEVELS[level];
+            series.levels[level][bucketStart].add(value);
+        }
+        rollup.newest = std::max(rollup.newest, timestamp);
+    }
+
+    // Drops the buckets of each level that fall behind its horizon, up to a
+    // bucket boundary of the next level, which covers them from then on.
+    // Boundaries only move when the newest point enters a new hour.
+    void RollupManager::expire(MetricRollup &rollup)
+    {
+        for (size_t level = 0; level + 1 < ROLLUP_LEVELS.size(); ++level)
+        {
+            if (rollup.newest < ROLLUP_HORIZONS[level])
+                continue;
+
+            uint64_t width = ROLLUP_LEVELS[level + 1];
+            uint64_t cutoff = (rollup.newest - ROLLUP_HORIZONS[level]) / width * width;
+            if (cutoff <= rollup.keptFrom[level])
+                continue;
+
+            rollup.keptFrom[level] = cutoff;
+            for (auto &[key, series] : rollup.series)
+            {
+                auto &buckets = series.levels[level];
+                buckets.erase(buckets.begin(), buckets.lower_bound(cutoff));
+            }
+        }
+
+        uint64_t hour = ROLLUP_LEVELS[1];
+        uint64_t next = rollup.newest - rollup.newest % hour + hour;
+        rollup.nextExpiry = next > rollup.newest ? next : UINT64_MAX;
+    }
+
+    // Width of the finest level with buckets at timestamp
+    uint64_t RollupManager::resolution(const MetricRollup &rollup, uint64_t timestamp)
+    {
+        size_t level = 0;
+        while (level + 1 < ROLLUP_LEVELS.size() && timestamp < rollup.keptFrom[level])
+        {
+            ++level;
+        }
+        return ROLLUP_LEVELS[level];
+    }
+
+    // Covers [start, end) with the coarsest buckets that fit and recurses
+    // into finer levels for the ragged edges
+    void RollupManager::aggregateSpan(const Series &series, uint64_t start, uint64_t end,
+                                      size_t level, RollupBucket &out)
+    {
+        if (start >= end)
+            return;
+
+        uint64_t width = ROLLUP_LEVELS[level];
+        uint64_t innerStart;
+        uint64_t innerEnd = end - end % width;
+
+        if (!alignUp(start, width, innerStart) || innerStart >= innerEnd)
+        {
+            if (level > 0)
+                aggregateSpan(series, start, end, level - 1, out);
+            return;
+        }
+
+        const auto &buckets = series.levels[level];
+        for (auto it = buckets.lower_bound(innerStart); it != buckets.end() && it->first < innerEnd; ++it)
+        {
+            out.merge(it->second);
+        }
+
+        if (level > 0)
+        {
+            aggregateSpan(series, start, innerStart, level - 1, out);
+            aggregateSpan(series, innerEnd, end, level - 1, out);
+        }
+    }
+
+    RollupBucket RollupManager::aggregate(const std::string &metric, uint64_t start, uint64_t end,
+                                          const std::unordered_map<std::string, std::string> &tags) const
+    {
+        RollupBucket result;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto it = metrics_.find(metric);
+        if (it == metrics_.end())
+        {
+            if (start % ROLLUP_LEVELS[0] != 0 || end % ROLLUP_LEVELS[0] != 0)
+                throw std::invalid_argument("Rollup range must be aligned to the kept levels");
+            return result;
+        }
+
+        // The edges are resolved down to the level kept at each of them
+        if (start % resolution(it->second, start) != 0 ||
+            (start < end && end % resolution(it->second, end - 1) != 0))
+        {
+            throw std::invalid_argument("Rollup range must be aligned to the kept levels");
+        }
+
+        aggregateLocked(metric, start, end, tags, result);
+        return result;
+    }
+
+    bool RollupManager::aggregateWithin(const std::string &metric, uint64_t start, uint64_t end,
+                                        const std::unordered_map<std::string, std::string> &tags,
+                                        RollupBucket &out, uint64_t &innerStart, uint64_t &innerEnd) const
+    {
+        if (start > end)
+            return false;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto it = metrics_.find(metric);
+        uint64_t startWidth = it != metrics_.end() ? resolution(it->second, start) : ROLLUP_LEVELS[0];
+        uint64_t endWidth = it != metrics_.end() ? resolution(it->second, end) : ROLLUP_LEVELS[0];
+
+        if (!alignUp(start, startWidth, innerStart))
+            return false;
+        innerEnd = end / endWidth * endWidth;
+        if (end % endWidth == endWidth - 1 && innerEnd <= UINT64_MAX - endWidth)
+            innerEnd += endWidth;
+        if (innerStart >= innerEnd)
+            return false;
+
+        aggregateLocked(metric, innerStart, innerEnd, tags, out);
+        return true;
+    }
+
+    // The caller holds mutex_
+    void RollupManager::aggregateLocked(const std::string &metric, uint64_t start, uint64_t end,
+                                        const std::unordered_map<std::string, std::string> &tags,
+                                        RollupBucket &out) const
+    {
+        auto it = metrics_.find(metric);
+        if (it == metrics_.end())
+            return;
+
+        for (const auto &[key, series] : it->second.series)
+        {
+            if (matches(series, tags))
+            {
+                aggregateSpan(series, start, end, ROLLUP_LEVELS.size() - 1, out);
+            }
+        }
+    }
+
+    uint64_t RollupManager::pointCount(const std::string &metric) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = metrics_.find(metric);
+        return it != metrics_.end() ? it->second.points : 0;
+    }
+
+    void RollupManager::dropMetric(const std::string &metric)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        dirty_ = metrics_.erase(metric) > 0 || dirty_;
+    }
+
+    void RollupManager::dropBefore(const std::string &metric, uint64_t timestamp)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = metrics_.find(metric);
+        if (it == metrics_.end())
+            return;
+
+        MetricRollup &rollup = it->second;
+        for (auto series = rollup.series.begin(); series != rollup.series.end();)
+        {
+            for (size_t level = 0; level < ROLLUP_LEVELS.size(); ++level)
+            {
+                auto &buckets = series->second.levels[level];
+                auto end = buckets.begin();
+                while (end != buckets.end() && end->first + ROLLUP_LEVELS[level] <= timestamp)
+                {
+                    // The point count follows the coarsest level, which
+                    // holds every point
+                    if (level + 1 == ROLLUP_LEVELS.size())
+                        rollup.points -= std::min(rollup.points, end->second.count);
+                    ++end;
+                }
+                buckets.erase(buckets.begin(), end);
+            }
+
+            if (series->second.levels.back().empty())
+                series = rollup.series.erase(series);
+            else
+                ++series;
+        }
+        dirty_ = true;
+    }
+
+    std::vector<std::string> RollupManager::getMetrics() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<std::string> names;
+        names.reserve(metrics_.size());
+        for (const auto &[metric, rollup] : metrics_)
+        {
+            names.push_back(metric);
+        }
+        return names;
+    }
+
+    void RollupManager::save() const
+    {
+        std::vector<uint8_t> buffer;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!dirty_)
+                return;
+            dirty_ = false;
+
+            appendPod(buffer, ROLLUP_MAGIC);
+            appendPod(buffer, ROLLUP_VERSION);
+            appendPod(buffer, static_cast<uint32_t>(metrics_.size()));
+
+            for (const auto &[metric, rollup] : metrics_)
+            {
+                appendString(buffer, metric);
+                appendPod(buffer, rollup.points);
+                appendPod(buffer, rollup.newest);
+                for (size_t level = 0; level + 1 < ROLLUP_LEVELS.size(); ++level)
+                {
+                    appendPod(buffer, rollup.keptFrom[level]);
+                }
+                appendPod(buffer, static_cast<uint32_t>(rollup.series.size()));
+
+                for (const auto &[key, series] : rollup.series)
+                {
+                    appendPod(buffer, static_cast<uint32_t>(series.tags.size()));
+                    for (const auto &[name, value] : series.tags)
+                    {
+                        appendString(buffer, name);
+                        appendString(buffer, value);
+                    }
+
+                    for (const auto &buckets : series.levels)
+                    {
+                        appendPod(buffer, static_cast<uint32_t>(buckets.size()));
+                        for (const auto &[bucketStart, bucket] : buckets)
+                        {
+                            appendPod(buffer, bucketStart);
+                            appendPod(buffer, bucket.count);
+                            appendPod(buffer, bucket.sum);
+                            appendPod(buffer, bucket.min);
+                            appendPod(buffer, bucket.max);
+                        }
+                    }
+                }
+            }
+        }
+
+        try
+        {
+            replaceFile(path_, buffer, "rollups");
+        }
+        catch (const std::exception &)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            dirty_ = true;
+            throw;
+        }
+    }
+
+    void RollupManager::load()
+    {
+        std::vector<uint8_t> buffer;
+        {
+            std::ifstream file(path_, std::ios::binary);
+            if (!file)
+            {
+                return; // No rollups yet, they will be rebuilt from chunks
+            }
+            buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+
+        std::unordered_map<std::string, MetricRollup> loaded;
+        try
+        {
+            const uint8_t *ptr = buffer.data();
+            size_t remaining = buffer.size();
+
+            if (readPod<uint32_t>(ptr, remaining, ROLLUP_SOURCE) != ROLLUP_MAGIC)
+            {
+                throw std::runtime_error("Invalid rollup data: bad magic");
+            }
+            uint32_t version = readPod<uint32_t>(ptr, remaining, ROLLUP_SOURCE);
+            if (version == 0 || version > ROLLUP_VERSION)
+            {
+                throw std::runtime_error("Invalid rollup data: unsupported version " + std::to_string(version));
+            }
+
+            uint32_t metricCount = readPod<uint32_t>(ptr, remaining, ROLLUP_SOURCE);
+            for (uint32_t m = 0; m < metricCount; ++m)
+            {
+                std::string metric = readString(ptr, remaining, ROLLUP_SOURCE);
+                MetricRollup &rollup = loaded[metric];
+                rollup.points = readPod<uint64_t>(ptr, remaining, ROLLUP_SOURCE);
+                if (version >= 2)
+                {
+                    rollup.newest = readPod<uint64_t>(ptr, remaining, ROLLUP_SOURCE);
+                    for (size_t level = 0; level + 1 < ROLLUP_LEVELS.size(); ++level)
+                    {
+                        rollup.keptFrom[level] = readPod<uint64_t>(ptr, remaining, ROLLUP_SOURCE);
+                    }
+                }
+
+                uint32_t seriesCount = readPod<uint32_t>(ptr, remaining, ROLLUP_SOURCE);
+                for (uint32_t s = 0; s < seriesCount; ++s)
+                {
+                    Series series;
+                    uint32_t tagCount = readPod<uint32_t>(ptr, remaining, ROLLUP_SOURCE);
+                    for (uint32_t t = 0; t < tagCount; ++t)
+                    {
+                        std::string name = readString(ptr, remaining, ROLLUP_SOURCE);
+                        series.tags[name] = readString(ptr, remaining, ROLLUP_SOURCE);
+                    }
+
+                    for (auto &buckets : series.levels)
+                    {
+                        uint32_t bucketCount = readPod<uint32_t>(ptr, remaining, ROLLUP_SOURCE);
+                        for (uint32_t b = 0; b < bucketCount; ++b)
+                        {
+                            uint64_t bucketStart = readPod<uint64_t>(ptr, remaining, ROLLUP_SOURCE);
+                            RollupBucket bucket;
+                            bucket.count = readPod<uint64_t>(ptr, remaining, ROLLUP_SOURCE);
+                            bucket.sum = readPod<double>(ptr, remaining, ROLLUP_SOURCE);
+                            bucket.min = readPod<double>(ptr, remaining, ROLLUP_SOURCE);
+                            bucket.max = readPod<double>(ptr, remaining, ROLLUP_SOURCE);
+                            buckets.emplace_hint(buckets.end(), bucketStart, bucket);
+                        }
+                    }
+
+                    rollup.series.emplace(seriesKey(series.tags), std::move(series));
+                }
+
+                // Older files kept every level in full
+                for (const auto &[key, series] : rollup.series)
+                {
+                    if (!series.levels[0].empty())
+                        rollup.newest = std::max(rollup.newest, series.levels[0].rbegin()->first);
+                }
+                expire(rollup);
+            }
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Discarding rollups " << path_ << ": " << e.what() << std::endl;
+            loaded.clear();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        metrics_ = std::move(loaded);
+        dirty_ = false;
+    }
+
+} // namespace waffledb
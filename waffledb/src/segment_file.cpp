@@ -0,0 +1,460 @@
+// waffledb/src/segment_file.cpp
+#include "segment_file.h"
+#include "serialization.h"
+#include <fstream>
+#include <filesystem>
+#include <iostream>
+#include <cstring>
+#include <array>
+#include <algorithm>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+namespace waffledb
+{
+
+    namespace
+    {
+        constexpr const char *SEGMENT_SOURCE = "segment file"; // named in read errors
+
+        // Segment file layout: magic and version, then records, each
+        // starting on an 8-byte boundary so mapped blocks can be read as
+        // uint64/double arrays:
+        //   block:   magic, entry length, entry, padding, block bytes, padding
+        //   footer:  magic, entry count, body length, body checksum, 0,
+        //            entries of every live block, padding
+        //   trailer: magic, version, footer offset (always the last record
+        //            of a cleanly written file)
+        constexpr uint32_t SEGMENT_MAGIC = 0x47534657; // "WFSG"
+        constexpr uint32_t SEGMENT_VERSION = 1;
+        constexpr uint32_t BLOCK_MAGIC = 0x4B424657;   // "WFBK"
+        constexpr uint32_t FOOTER_MAGIC = 0x54464657;  // "WFFT"
+        constexpr uint32_t TRAILER_MAGIC = 0x52544657; // "WFTR"
+
+        constexpr uint64_t HEADER_SIZE = 2 * sizeof(uint32_t);
+        constexpr uint64_t FOOTER_HEADER_SIZE = 4 * sizeof(uint32_t) + sizeof(uint64_t);
+        constexpr uint64_t TRAILER_SIZE = 2 * sizeof(uint32_t) + sizeof(uint64_t);
+        constexpr uint64_t RECORD_ALIGNMENT = 8;
+
+        uint64_t aligned(uint64_t offset)
+        {
+            return (offset + RECORD_ALIGNMENT - 1) / RECORD_ALIGNMENT * RECORD_ALIGNMENT;
+        }
+
+        void appendCodec(std::vector<uint8_t> &buffer, const std::string &codec)
+        {
+            appendPod(buffer, static_cast<uint8_t>(std::min<size_t>(codec.size(), UINT8_MAX)));
+            buffer.insert(buffer.end(), codec.begin(), codec.begin() + std::min<size_t>(codec.size(), UINT8_MAX));
+        }
+
+        std::string readCodec(const uint8_t *&ptr, size_t &remaining)
+        {
+            uint8_t length = readPod<uint8_t>(ptr, remaining, SEGMENT_SOURCE);
+            if (remaining < length)
+            {
+                throw std::runtime_error("Invalid segment file: truncated codec name");
+            }
+            std::string codec(reinterpret_cast<const char *>(ptr), length);
+            ptr += length;
+            remaining -= length;
+            return codec;
+        }
+
+        void appendEntry(std::vector<uint8_t> &buffer, const SegmentBlock &block)
+        {
+            appendPod(buffer, block.chunkId);
+            appendPod(buffer, block.offset);
+            appendPod(buffer, block.size);
+            appendPod(buffer, block.minTimestamp);
+            appendPod(buffer, block.maxTimestamp);
+            appendPod(buffer, block.seriesId);
+            appendPod(buffer, block.checksum);
+            appendCodec(buffer, block.timestampCodec);
+            appendCodec(buffer, block.valueCodec);
+        }
+
+        SegmentBlock readEntry(const uint8_t *&ptr, size_t &remaining)
+        {
+            SegmentBlock block;
+            block.chunkId = readPod<uint64_t>(ptr, remaining, SEGMENT_SOURCE);
+            block.offset = readPod<uint64_t>(ptr, remaining, SEGMENT_SOURCE);
+            block.size = readPod<uint64_t>(ptr, remaining, SEGMENT_SOURCE);
+            block.minTimestamp = readPod<uint64_t>(ptr, remaining, SEGMENT_SOURCE);
+            block.maxTimestamp = readPod<uint64_t>(ptr, remaining, SEGMENT_SOURCE);
+            block.seriesId = readPod<uint32_t>(ptr, remaining, SEGMENT_SOURCE);
+            block.checksum = readPod<uint32_t>(ptr, remaining, SEGMENT_SOURCE);
+            block.timestampCodec = readCodec(ptr, remaining);
+            block.valueCodec = readCodec(ptr, remaining);
+            return block;
+        }
+
+        bool readAt(std::ifstream &file, uint64_t offset, void *out, size_t size)
+        {
+            file.clear();
+            file.seekg(static_cast<std::streamoff>(offset));
+            file.read(static_cast<char *>(out), static_cast<std::streamsize>(size));
+            return static_cast<size_t>(file.gcount()) == size;
+        }
+    } // namespace
+
+    uint32_t SegmentFile::checksum(const uint8_t *data, size_t size)
+    {
+        // CRC-32 (IEEE), table driven
+        static const std::array<uint32_t, 256> table = []()
+        {
+            std::array<uint32_t, 256> entries{};
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; ++bit)
+                {
+                    crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+                }
+                entries[i] = crc;
+            }
+            return entries;
+        }();
+
+        uint32_t crc = 0xFFFFFFFFu;
+        for (size_t i = 0; i < size; ++i)
+        {
+            crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return crc ^ 0xFFFFFFFFu;
+    }
+
+    std::unique_ptr<SegmentFile> SegmentFile::open(const std::string &path)
+    {
+        std::unique_ptr<SegmentFile> file(new SegmentFile(path));
+
+        std::error_code ec;
+        if (!fs::exists(path, ec))
+        {
+            std::vector<uint8_t> header;
+            appendPod(header, SEGMENT_MAGIC);
+            appendPod(header, SEGMENT_VERSION);
+            file->write(header);
+            return file;
+        }
+
+        file->size_ = fs::file_size(path);
+        std::ifstream in(path, std::ios::binary);
+        uint32_t header[2] = {0, 0};
+        if (!in || !readAt(in, 0, header, sizeof(header)) || header[0] != SEGMENT_MAGIC)
+        {
+            throw std::runtime_error("Not a segment file: " + path);
+        }
+        if (header[1] == 0 || header[1] > SEGMENT_VERSION)
+        {
+            throw std::runtime_error("Unsupported segment file version: " + path);
+        }
+        in.close();
+
+        if (!file->readFooter())
+        {
+            file->scan();
+        }
+        return file;
+    }
+
+    // Reads the index through the trailer; false if the file does not end
+    // in a valid one
+    bool SegmentFile::readFooter()
+    {
+        if (size_ < HEADER_SIZE + FOOTER_HEADER_SIZE + TRAILER_SIZE)
+            return false;
+
+        std::ifstream in(path_, std::ios::binary);
+        uint8_t trailer[TRAILER_SIZE];
+        if (!readAt(in, size_ - TRAILER_SIZE, trailer, sizeof(trailer)))
+            return false;
+
+        const uint8_t *ptr = trailer;
+        size_t remaining = sizeof(trailer);
+        if (readPod<uint32_t>(ptr, remaining, SEGMENT_SOURCE) != TRAILER_MAGIC)
+            return false;
+        readPod<uint32_t>(ptr, remaining, SEGMENT_SOURCE);
+        uint64_t footerOffset = readPod<uint64_t>(ptr, remaining, SEGMENT_SOURCE);
+        if (footerOffset < HEADER_SIZE || footerOffset + FOOTER_HEADER_SIZE > size_ - TRAILER_SIZE)
+            return false;
+
+        uint8_t header[FOOTER_HEADER_SIZE];
+        if (!readAt(in, footerOffset, header, sizeof(header)))
+            return false;
+        ptr = header;
+        remaining = sizeof(header);
+        if (readPod<uint32_t>(ptr, remaining, SEGMENT_SOURCE) != FOOTER_MAGIC)
+            return false;
+        uint32_t count = readPod<uint32_t>(ptr, remaining, SEGMENT_SOURCE);
+        uint64_t bodySize = readPod<uint64_t>(ptr, remaining, SEGMENT_SOURCE);
+        uint32_t bodyChecksum = readPod<uint32_t>(ptr, remaining, SEGMENT_SOURCE);
+        if (aligned(footerOffset + FOOTER_HEADER_SIZE + bodySize) != size_ - TRAILER_SIZE)
+            return false;
+
+        std::vector<uint8_t> body(bodySize);
+        if (!readAt(in, footerOffset + FOOTER_HEADER_SIZE, body.data(), body.size()) ||
+            checksum(body.data(), body.size()) != bodyChecksum)
+            return false;
+
+        ptr = body.data();
+        remaining = body.size();
+        try
+        {
+            std::map<uint64_t, SegmentBlock> blocks;
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                SegmentBlock block = readEntry(ptr, remaining);
+                if (block.offset + block.size > footerOffset)
+                    return false;
+                blocks[block.offset] = std::move(block);
+            }
+            blocks_ = std::move(blocks);
+        }
+        catch (const std::exception &)
+        {
+            return false;
+        }
+
+        liveBytes_ = 0;
+        for (const auto &[offset, block] : blocks_)
+        {
+            liveBytes_ += block.size;
+        }
+        return true;
+    }
+
+    // Rebuilds the index from the records of a file that was not closed
+    // with a footer. Each footer met resets the index to the blocks it
+    // lists; a torn record at the end is cut off.
+    void SegmentFile::scan()
+    {
+        std::ifstream in(path_, std::ios::binary);
+        uint64_t pos = HEADER_SIZE;
+        blocks_.clear();
+
+        while (pos + RECORD_ALIGNMENT <= size_)
+        {
+            uint32_t head[2];
+            if (!readAt(in, pos, head, sizeof(head)))
+                break;
+
+            if (head[0] == BLOCK_MAGIC)
+            {
+                std::vector<uint8_t> entry(head[1]);
+                if (pos + sizeof(head) + entry.size() > size_ ||
+                    !readAt(in, pos + sizeof(head), entry.data(), entry.size()))
+                    break;
+
+                const uint8_t *ptr = entry.data();
+                size_t remaining = entry.size();
+                SegmentBlock block;
+                try
+                {
+                    block = readEntry(ptr, remaining);
+                }
+                catch (const std::exception &)
+                {
+                    break;
+                }
+
+                uint64_t start = aligned(pos + sizeof(head) + entry.size());
+                if (block.offset != start || block.size > size_ - start)
+                    break;
+
+                pos = aligned(start + block.size);
+                if (block.chunkId != STAGED_BLOCK)
+                {
+                    blocks_[block.offset] = std::move(block);
+                }
+            }
+            else if (head[0] == FOOTER_MAGIC)
+            {
+                uint8_t header[FOOTER_HEADER_SIZE];
+                if (!readAt(in, pos, header, sizeof(header)))
+                    break;
+                const uint8_t *ptr = header + sizeof(head);
+                size_t remaining = sizeof(header) - sizeof(head);
+                uint64_t bodySize = readPod<uint64_t>(ptr, remaining, SEGMENT_SOURCE);
+                uint32_t bodyChecksum = readPod<uint32_t>(ptr, remaining, SEGMENT_SOURCE);
+                if (bodySize > size_ - pos - FOOTER_HEADER_SIZE)
+                    break;
+
+                std::vector<uint8_t> body(bodySize);
+                if (!readAt(in, pos + FOOTER_HEADER_SIZE, body.data(), body.size()) ||
+                    checksum(body.data(), body.size()) != bodyChecksum)
+                    break;
+
+                std::map<uint64_t, SegmentBlock> blocks;
+                ptr = body.data();
+                remaining = body.size();
+                try
+                {
+                    for (uint32_t i = 0; i < head[1]; ++i)
+                    {
+                        SegmentBlock block = readEntry(ptr, remaining);
+                        blocks[block.offset] = std::move(block);
+                    }
+                }
+                catch (const std::exception &)
+                {
+                    break;
+                }
+                blocks_ = std::move(blocks);
+                pos = aligned(pos + FOOTER_HEADER_SIZE + bodySize);
+            }
+            else if (head[0] == TRAILER_MAGIC && pos + TRAILER_SIZE <= size_)
+            {
+                pos += TRAILER_SIZE;
+            }
+            else
+            {
+                break;
+            }
+        }
+        in.close();
+
+        if (pos < size_)
+        {
+            std::cerr << "Segment file " << path_ << ": dropping " << size_ - pos << " bytes of torn records" << std::endl;
+            fs::resize_file(path_, pos);
+            size_ = pos;
+        }
+
+        liveBytes_ = 0;
+        for (const auto &[offset, block] : blocks_)
+        {
+            liveBytes_ += block.size;
+        }
+        footerStale_ = true;
+    }
+
+    // Appends a record; a failed write is cut off again so the file keeps
+    // ending on a record boundary
+    void SegmentFile::write(const std::vector<uint8_t> &record, const uint8_t *data, size_t size)
+    {
+        static const uint8_t padding[RECORD_ALIGNMENT] = {};
+        uint64_t total = record.size() + aligned(size);
+
+        if (!out_)
+        {
+            out_ = AppendFile::open(path_);
+        }
+        if (out_->write(record.data(), record.size()) &&
+            (size == 0 || (out_->write(data, size) && out_->write(padding, aligned(size) - size))))
+        {
+            size_ += total;
+            unsynced_ = true;
+            return;
+        }
+
+        out_->truncate(size_);
+        throw std::runtime_error("Failed to write segment file: " + path_);
+    }
+
+    uint64_t SegmentFile::append(SegmentBlock block, const uint8_t *data, size_t size)
+    {
+        block.size = size;
+        block.checksum = checksum(data, size);
+
+        // The entry has a fixed size for given codec names, so its length
+        // is known before the offset it records
+        std::vector<uint8_t> entry;
+        appendEntry(entry, block);
+        block.offset = aligned(size_ + 2 * sizeof(uint32_t) + entry.size());
+
+        std::vector<uint8_t> record;
+        appendPod(record, BLOCK_MAGIC);
+        appendPod(record, static_cast<uint32_t>(entry.size()));
+        appendEntry(record, block);
+        record.resize(block.offset - size_, 0);
+        write(record, data, size);
+
+        liveBytes_ += size;
+        footerStale_ = true;
+        uint64_t offset = block.offset;
+        blocks_[offset] = std::move(block);
+        return offset;
+    }
+
+    void SegmentFile::relabel(uint64_t offset, uint64_t chunkId)
+    {
+        blocks_.at(offset).chunkId = chunkId;
+        footerStale_ = true;
+    }
+
+    void SegmentFile::erase(uint64_t offset)
+    {
+        auto it = blocks_.find(offset);
+        if (it == blocks_.end())
+            return;
+
+        liveBytes_ -= it->second.size;
+        blocks_.erase(it);
+        footerStale_ = true;
+    }
+
+    void SegmentFile::writeFooter()
+    {
+        if (!footerStale_)
+            return;
+
+        std::vector<uint8_t> body;
+        uint32_t count = 0;
+        for (const auto &[offset, block] : blocks_)
+        {
+            if (block.chunkId == STAGED_BLOCK)
+                continue;
+            appendEntry(body, block);
+            ++count;
+        }
+
+        uint64_t footerOffset = size_;
+        std::vector<uint8_t> record;
+        appendPod(record, FOOTER_MAGIC);
+        appendPod(record, count);
+        appendPod(record, static_cast<uint64_t>(body.size()));
+        appendPod(record, checksum(body.data(), body.size()));
+        appendPod(record, uint32_t(0));
+        record.insert(record.end(), body.begin(), body.end());
+        record.resize(aligned(record.size()), 0);
+        appendPod(record, TRAILER_MAGIC);
+        appendPod(record, SEGMENT_VERSION);
+        appendPod(record, footerOffset);
+        write(record);
+
+        footerStale_ = false;
+    }
+
+    void SegmentFile::sync()
+    {
+        if (!unsynced_)
+            return;
+
+        if (!out_->sync())
+        {
+            throw std::runtime_error("Failed to sync segment file: " + path_);
+        }
+        unsynced_ = false;
+    }
+
+    std::shared_ptr<const MappedFile> SegmentFile::map(const SegmentBlock &block)
+    {
+        uint64_t end = block.offset + block.size;
+        if (!mapping_ || mapping_->length() < end)
+        {
+            mapping_ = MappedFile::open(path_, static_cast<size_t>(std::max<uint64_t>(SEGMENT_FILE_BYTES, size_ * 2)));
+        }
+
+        // The mapping reaches past the end of the file, where reads fault,
+        // so the block is checked against the file itself
+        std::error_code ec;
+        uint64_t actual = fs::file_size(path_, ec);
+        if (!mapping_ || mapping_->length() < end || ec || actual < end)
+        {
+            throw std::runtime_error("Segment file is shorter than its index: " + path_);
+        }
+        return mapping_;
+    }
+
+} // namespace waffledb
@@ -0,0 +1,222 @@
+// waffledb/src/series_catalog.cpp
+#include "series_catalog.h"
+#include "serialization.h"
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+namespace waffledb
+{
+
+    namespace
+    {
+        // Layout: magic, version, series count, then per series in ID order
+        // its tag count and length-prefixed names and values
+        constexpr uint32_t CATALOG_MAGIC = 0x53534657; // "WFSS"
+        constexpr uint32_t CATALOG_VERSION = 1;
+        constexpr const char *CATALOG_SOURCE = "series catalog"; // named in read errors
+    } // namespace
+
+    SeriesCatalog::SeriesCatalog(const std::string &basePath)
+        : path_(basePath.empty() ? std::string() : basePath + "/series.dat"),
+          indexPath_(basePath.empty() ? std::string() : basePath + "/tags.idx")
+    {
+    }
+
+    std::string SeriesCatalog::canonicalKey(const TagSet &tags)
+    {
+        std::vector<std::pair<std::string, std::string>> sorted(tags.begin(), tags.end());
+        std::sort(sorted.begin(), sorted.end());
+
+        std::string key;
+        for (const auto &[name, value] : sorted)
+        {
+            key += name;
+            key += '=';
+            key += value;
+            key += '\0';
+        }
+        return key;
+    }
+
+    uint32_t SeriesCatalog::internLocked(const TagSet &tags, bool indexed)
+    {
+        std::string key = canonicalKey(tags);
+        auto it = ids_.find(key);
+        if (it != ids_.end())
+        {
+            return it->second;
+        }
+
+        if (series_.size() >= UINT32_MAX)
+        {
+            throw std::runtime_error("Series catalog is full");
+        }
+
+        uint32_t id = static_cast<uint32_t>(series_.size());
+        series_.push_back(tags);
+        ids_.emplace(std::move(key), id);
+        if (indexed)
+        {
+            index_.add(id, tags);
+        }
+        return id;
+    }
+
+    uint32_t SeriesCatalog::intern(const TagSet &tags)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return internLocked(tags, true);
+    }
+
+    const TagSet &SeriesCatalog::tags(uint32_t id) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (id >= series_.size())
+        {
+            throw std::out_of_range("Unknown series ID " + std::to_string(id));
+        }
+        return series_[id];
+    }
+
+    bool SeriesCatalog::matches(uint32_t id, const TagSet &filter) const
+    {
+        const TagSet &series = tags(id);
+        for (const auto &[name, value] : filter)
+        {
+            auto it = series.find(name);
+            if (it == series.end() || it->second != value)
+                return false;
+        }
+        return true;
+    }
+
+    RoaringBitmap SeriesCatalog::select(const TagSet &filter) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!filter.empty())
+        {
+            return index_.select(filter);
+        }
+
+        RoaringBitmap all;
+        all.addRange(0, static_cast<uint32_t>(series_.size()));
+        return all;
+    }
+
+    std::vector<uint32_t> SeriesCatalog::find(const TagSet &filter) const
+    {
+        return select(filter).toVector();
+    }
+
+    std::vector<uint32_t> SeriesCatalog::findAny(const std::string &key, const std::vector<std::string> &values) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return index_.selectAny(key, values).toVector();
+    }
+
+    size_t SeriesCatalog::size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return series_.size();
+    }
+
+    void SeriesCatalog::save() const
+    {
+        if (path_.empty())
+            return;
+
+        std::vector<uint8_t> buffer;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            appendPod(buffer, CATALOG_MAGIC);
+            appendPod(buffer, CATALOG_VERSION);
+            appendPod(buffer, static_cast<uint32_t>(series_.size()));
+            for (const auto &tags : series_)
+            {
+                appendPod(buffer, static_cast<uint32_t>(tags.size()));
+                for (const auto &[name, value] : tags)
+                {
+                    appendString(buffer, name);
+                    appendString(buffer, value);
+                }
+            }
+        }
+
+        replaceFile(path_, buffer, "series catalog");
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        index_.save(indexPath_);
+    }
+
+    void SeriesCatalog::load()
+    {
+        if (path_.empty())
+            return;
+
+        std::vector<uint8_t> buffer;
+        {
+            std::ifstream file(path_, std::ios::binary);
+            if (!file)
+            {
+                return; // Fresh database, or chunks re-intern their series on load
+            }
+            buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+
+        std::deque<TagSet> loaded;
+        try
+        {
+            const uint8_t *ptr = buffer.data();
+            size_t remaining = buffer.size();
+
+            if (readPod<uint32_t>(ptr, remaining, CATALOG_SOURCE) != CATALOG_MAGIC ||
+                readPod<uint32_t>(ptr, remaining, CATALOG_SOURCE) != CATALOG_VERSION)
+            {
+                throw std::runtime_error("Invalid series catalog: bad header");
+            }
+
+            uint32_t count = readPod<uint32_t>(ptr, remaining, CATALOG_SOURCE);
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                TagSet tags;
+                uint32_t tagCount = readPod<uint32_t>(ptr, remaining, CATALOG_SOURCE);
+                for (uint32_t t = 0; t < tagCount; ++t)
+                {
+                    std::string name = readString(ptr, remaining, CATALOG_SOURCE);
+                    tags[name] = readString(ptr, remaining, CATALOG_SOURCE);
+                }
+                loaded.push_back(std::move(tags));
+            }
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Discarding series catalog " << path_ << ": " << e.what() << std::endl;
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        series_.clear();
+        ids_.clear();
+        for (auto &tags : loaded)
+        {
+            internLocked(tags, false);
+        }
+
+        // A stale or missing index is rebuilt from the series themselves
+        if (!index_.load(indexPath_, series_.size()))
+        {
+            for (uint32_t id = 0; id < series_.size(); ++id)
+            {
+                index_.add(id, series_[id]);
+            }
+        }
+    }
+
+} // namespace waffledb
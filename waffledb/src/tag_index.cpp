@@ -0,0 +1,177 @@
+// waffledb/src/tag_index.cpp
+#include "tag_index.h"
+#include "serialization.h"
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+namespace waffledb
+{
+
+    namespace
+    {
+        // Layout: magic, version, series count, key count, then per key its
+        // name and values, each value followed by its serialized bitmap.
+        // Version 1 files held varint postings; they are rebuilt instead.
+        constexpr uint32_t TAG_INDEX_MAGIC = 0x49544657; // "WFTI"
+        constexpr uint32_t TAG_INDEX_VERSION = 2;
+        constexpr const char *TAG_INDEX_SOURCE = "tag index"; // named in read errors
+    } // namespace
+
+    void TagIndex::add(uint32_t seriesId, const std::unordered_map<std::string, std::string> &tags)
+    {
+        for (const auto &[key, value] : tags)
+        {
+            postings_[key][value].add(seriesId);
+        }
+        seriesCount_ = std::max<size_t>(seriesCount_, static_cast<size_t>(seriesId) + 1);
+    }
+
+    void TagIndex::clear()
+    {
+        postings_.clear();
+        seriesCount_ = 0;
+    }
+
+    const Postings *TagIndex::find(const std::string &key, const std::string &value) const
+    {
+        auto keyIt = postings_.find(key);
+        if (keyIt == postings_.end())
+            return nullptr;
+
+        auto valueIt = keyIt->second.find(value);
+        return valueIt != keyIt->second.end() ? &valueIt->second : nullptr;
+    }
+
+    Postings TagIndex::select(const std::unordered_map<std::string, std::string> &filter) const
+    {
+        std::vector<const Postings *> lists;
+        lists.reserve(filter.size());
+        for (const auto &[key, value] : filter)
+        {
+            const Postings *list = find(key, value);
+            if (!list)
+                return {};
+            lists.push_back(list);
+        }
+        if (lists.empty())
+            return {};
+
+        // Smallest list first keeps every intermediate result small
+        std::sort(lists.begin(), lists.end(),
+                  [](const Postings *a, const Postings *b)
+                  { return a->cardinality() < b->cardinality(); });
+
+        Postings result = *lists[0];
+        for (size_t i = 1; i < lists.size() && !result.empty(); ++i)
+        {
+            result = RoaringBitmap::intersect(result, *lists[i]);
+        }
+        return result;
+    }
+
+    Postings TagIndex::selectAny(const std::string &key, const std::vector<std::string> &values) const
+    {
+        Postings result;
+        for (const auto &value : values)
+        {
+            if (const Postings *list = find(key, value))
+            {
+                result = RoaringBitmap::unite(result, *list);
+            }
+        }
+        return result;
+    }
+
+    size_t TagIndex::pairCount() const
+    {
+        size_t pairs = 0;
+        for (const auto &[key, values] : postings_)
+        {
+            pairs += values.size();
+        }
+        return pairs;
+    }
+
+    void TagIndex::save(const std::string &path) const
+    {
+        std::vector<uint8_t> buffer;
+        appendPod(buffer, TAG_INDEX_MAGIC);
+        appendPod(buffer, TAG_INDEX_VERSION);
+        appendPod(buffer, static_cast<uint64_t>(seriesCount_));
+        appendPod(buffer, static_cast<uint32_t>(postings_.size()));
+
+        for (const auto &[key, values] : postings_)
+        {
+            appendString(buffer, key);
+            appendPod(buffer, static_cast<uint32_t>(values.size()));
+            for (const auto &[value, list] : values)
+            {
+                Postings packed = list;
+                packed.runOptimize();
+
+                appendString(buffer, value);
+                packed.serialize(buffer);
+            }
+        }
+
+        replaceFile(path, buffer, "tag index");
+    }
+
+    bool TagIndex::load(const std::string &path, size_t expectedSeries)
+    {
+        clear();
+
+        std::vector<uint8_t> buffer;
+        {
+            std::ifstream file(path, std::ios::binary);
+            if (!file)
+            {
+                return false;
+            }
+            buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+
+        try
+        {
+            const uint8_t *ptr = buffer.data();
+            size_t remaining = buffer.size();
+
+            if (readPod<uint32_t>(ptr, remaining, TAG_INDEX_SOURCE) != TAG_INDEX_MAGIC ||
+                readPod<uint32_t>(ptr, remaining, TAG_INDEX_SOURCE) != TAG_INDEX_VERSION ||
+                readPod<uint64_t>(ptr, remaining, TAG_INDEX_SOURCE) != expectedSeries)
+            {
+                return false;
+            }
+
+            uint32_t keyCount = readPod<uint32_t>(ptr, remaining, TAG_INDEX_SOURCE);
+            for (uint32_t k = 0; k < keyCount; ++k)
+            {
+                auto &values = postings_[readString(ptr, remaining, TAG_INDEX_SOURCE)];
+                uint32_t valueCount = readPod<uint32_t>(ptr, remaining, TAG_INDEX_SOURCE);
+                for (uint32_t v = 0; v < valueCount; ++v)
+                {
+                    Postings &list = values[readString(ptr, remaining, TAG_INDEX_SOURCE)];
+                    list = RoaringBitmap::deserialize(ptr, remaining);
+                    if (list.empty() || list.maximum() >= expectedSeries)
+                    {
+                        throw std::runtime_error("Invalid tag index: series out of range");
+                    }
+                }
+            }
+        }
+        catch (const std::exception &)
+        {
+            clear();
+            return false;
+        }
+
+        seriesCount_ = expectedSeries;
+        return true;
+    }
+
+} // namespace waffledb
@@ -0,0 +1,121 @@
+// waffledb/src/thread_pool.cpp
+#include "thread_pool.h"
+#include <atomic>
+#include <exception>
+#include <algorithm>
+#include <memory>
+
+namespace waffledb
+{
+
+    ThreadPool::ThreadPool(size_t threads)
+    {
+        if (threads == 0)
+        {
+            unsigned hardware = std::thread::hardware_concurrency();
+            threads = hardware > 1 ? hardware - 1 : 0;
+        }
+
+        for (size_t i = 0; i < threads; ++i)
+        {
+            workers_.emplace_back(&ThreadPool::workerLoop, this);
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        available_.notify_all();
+
+        for (auto &worker : workers_)
+        {
+            worker.join();
+        }
+    }
+
+    void ThreadPool::workerLoop()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                available_.wait(lock, [this]()
+                                { return stopping_ || !tasks_.empty(); });
+                if (tasks_.empty())
+                    return;
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            task();
+        }
+    }
+
+    void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)> &fn)
+    {
+        if (count == 0)
+            return;
+
+        // Items are claimed from a shared counter; helpers that start late
+        // find nothing left and just check out
+        struct Job
+        {
+            std::atomic<size_t> next{0};
+            size_t helpers = 0;
+            std::exception_ptr error;
+            std::mutex mutex;
+            std::condition_variable finished;
+        };
+        auto job = std::make_shared<Job>();
+
+        auto work = [job, count, &fn]()
+        {
+            size_t item;
+            while ((item = job->next.fetch_add(1)) < count)
+            {
+                try
+                {
+                    fn(item);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(job->mutex);
+                    if (!job->error)
+                        job->error = std::current_exception();
+                }
+            }
+        };
+
+        size_t helpers = std::min(workers_.size(), count - 1);
+        job->helpers = helpers;
+        if (helpers > 0)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                for (size_t i = 0; i < helpers; ++i)
+                {
+                    tasks_.emplace_back([job, work]()
+                                        {
+                                            work();
+                                            std::lock_guard<std::mutex> lock(job->mutex);
+                                            if (--job->helpers == 0)
+                                                job->finished.notify_one(); });
+                }
+            }
+            available_.notify_all();
+        }
+
+        work();
+
+        // fn lives on the caller's stack, so wait for every helper to leave it
+        std::unique_lock<std::mutex> lock(job->mutex);
+        job->finished.wait(lock, [&]()
+                           { return job->helpers == 0; });
+        if (job->error)
+            std::rethrow_exception(job->error);
+    }
+
+} // namespace waffledb
@@ -5,6 +5,11 @@
 #include "compression.h"
 #include "wal.h"
 #include "adaptive_index.h"
+#include "rollup.h"
+#include "chunk_cache.h"
+#include "lock_free_structures.h"
+#include "thread_pool.h"
+#include "serialization.h"
 
 #include <iostream>
 #include <fstream>
@@ -12,6 +17,8 @@
 #include <algorithm>
 #include <thread>
 #include <set>
+#include <shared_mutex>
+#include <map>
 #include <filesystem>
 #include <queue>
 #include <condition_variable>
@@ -29,78 +36,110 @@ namespace fs = std::filesystem;
 namespace waffledb
 {
 
-    // Lock-free queue implementation using atomic operations
-    template <typename T>
-    class LockFreeQueue
+    // Series picked by a tag filter; an empty filter picks every series
+    struct SeriesSelection
     {
-    private:
-        struct Node
-        {
-            std::atomic<T *> data{nullptr};
-            std::atomic<Node *> next{nullptr};
-        };
-
-        std::atomic<Node *> head_;
-        std::atomic<Node *> tail_;
+        bool all = true;
+        AdaptiveIndex::SeriesList ids;
+        std::vector<uint64_t> pairHashes; // of the filter's tag pairs
 
-    public:
-        LockFreeQueue()
-        {
-            Node *dummy = new Node;
-            head_.store(dummy);
-            tail_.store(dummy);
-        }
+        bool contains(uint32_t id) const { return all || ids->contains(id); }
+        bool empty() const { return !all && ids->empty(); }
 
-        ~LockFreeQueue()
+        // Whether a persisted chunk can hold selected points, judged from its
+        // directory entry: single-series chunks by their ID, mixed ones by
+        // their tag filter
+        bool admits(const ChunkMeta &meta) const
         {
-            while (Node *const old_head = head_.load())
+            if (meta.seriesId != MIXED_SERIES)
+                return contains(meta.seriesId);
+            for (uint64_t hash : pairHashes)
             {
-                head_.store(old_head->next);
-                delete old_head;
+                if (!meta.tagFilter.mayContain(hash))
+                    return false;
             }
+            return true;
         }
+    };
 
-        void push(const T &item)
-        {
-            Node *new_node = new Node;
-            T *data = new T(std::move(item));
-            new_node->data.store(data);
+    // A completed chunk a read folds in over [start, end] once chunksMutex_
+    // is released; the copied entry outlives any change to the directory
+    struct DeferredChunk
+    {
+        ChunkMeta meta;
+        uint64_t start = 0;
+        uint64_t end = 0;
+    };
 
-            Node *prev_tail = tail_.exchange(new_node);
-            prev_tail->next.store(new_node);
+    // The flusher drains the write buffer once a shard of it holds this many
+    // points or bytes, or this long after its first point arrived
+    constexpr size_t FLUSH_TRIGGER_POINTS = 8192;
+    constexpr size_t FLUSH_TRIGGER_BYTES = 4 << 20;
+    constexpr std::chrono::milliseconds FLUSH_MAX_LATENCY{100};
+
+    // Slots per write buffer shard; room for a second batch while the
+    // flusher works through the first
+    constexpr size_t WRITE_BUFFER_SLOTS = 2 * FLUSH_TRIGGER_POINTS;
+
+    // Points more than this many seconds older than the newest point of
+    // their series go to the metric's overflow chunk instead of stretching
+    // the series' active chunk back in time
+    constexpr uint64_t OUT_OF_ORDER_WINDOW = 300;
+
+    // The compactor wakes this often. A series is compacted once it has
+    // this many chunks under half a segment, or points in an overflow
+    // chunk; one pass reads at most this many points per metric.
+    constexpr std::chrono::seconds COMPACTION_INTERVAL{60};
+    constexpr size_t COMPACTION_MIN_CHUNKS = 4;
+    constexpr size_t COMPACTION_BATCH_POINTS = 1 << 21;
+
+    // The log is checkpointed in the background once it holds this many
+    // bytes or its first entry is this old
+    constexpr uint64_t CHECKPOINT_WAL_BYTES = 64ull << 20;
+    constexpr std::chrono::seconds CHECKPOINT_MAX_AGE{300};
+
+    // Approximate memory a buffered point holds
+    static size_t bufferedSize(const TimePoint &point)
+    {
+        size_t bytes = sizeof(TimePoint) + point.metric.size();
+        for (const auto &[key, value] : point.tags)
+        {
+            bytes += key.size() + value.size();
         }
+        return bytes;
+    }
 
-        bool pop(T &result)
+    // Folds the points of chunk in [start_time, end_time] that belong to the
+    // selected series into bucket. Unless the chunk mixes series that the
+    // selection only partly covers, its column stats answer without a scan.
+    static void foldChunk(const ColumnarChunk &chunk, uint64_t start_time, uint64_t end_time,
+                          const SeriesSelection &selection, RollupBucket &bucket)
+    {
+        if (selection.all || chunk.seriesId() != MIXED_SERIES)
         {
-            Node *head = head_.load();
-            Node *next = head->next.load();
-
-            if (next == nullptr)
-            {
-                return false;
-            }
-
-            T *data = next->data.load();
-            if (data == nullptr)
-            {
-                return false;
-            }
-
-            result = *data;
-            head_.store(next);
-            delete data;
-            delete head;
-
-            return true;
+            size_t matched = chunk.count(start_time, end_time);
+            if (matched == 0)
+                return;
+
+            RollupBucket part;
+            part.count = matched;
+            part.sum = chunk.sum(start_time, end_time);
+            part.min = chunk.min(start_time, end_time);
+            part.max = chunk.max(start_time, end_time);
+            bucket.merge(part);
+            return;
         }
 
-        bool empty() const
+        auto columns = chunk.columns();
+        auto [first, last] = columns.timeRange(start_time, end_time);
+        for (size_t idx = first; idx < last; ++idx)
         {
-            Node *head = head_.load();
-            Node *next = head->next.load();
-            return next == nullptr;
+            if (selection.contains(chunk.seriesIdAt(idx)))
+            {
+                bucket.add(columns.values()[idx]);
+            }
         }
-    };
+    }
 
     // TimeSeriesDatabase::Impl - Private implementation with lock-free structures
     class TimeSeriesDatabase::Impl
@@ -109,38 +148,124 @@ namespace waffledb
         std::string dbName_;
         std::string dbPath_;
 
-        // Columnar storage organized by metric
-        std::unordered_map<std::string, std::vector<std::unique_ptr<ColumnarChunk>>> metricChunks_;
-        std::unordered_map<std::string, std::unique_ptr<ColumnarChunk>> activeChunks_;
+        // Columnar storage organized by metric and partitioned by series: each
+        // series fills its own active chunk, kept sorted as late points
+        // arrive. Points older than the out-of-order window fill the metric's
+        // overflow chunk, the active chunk keyed MIXED_SERIES. Completed
+        // chunks are known by their directory entry; bodies fault in through
+        // the cache on demand.
+        ColumnarStorageManager::ChunkDirectory metricChunks_;
+        std::unordered_map<std::string, std::unordered_map<uint32_t, std::unique_ptr<ColumnarChunk>>> activeChunks_;
+        std::unordered_map<std::string, std::unordered_map<uint32_t, uint64_t>> watermarks_; // newest timestamp per series
+        std::atomic<uint64_t> outOfOrderWindow_{OUT_OF_ORDER_WINDOW};
+        ChunkCache chunkCache_;
         mutable std::mutex chunksMutex_;
 
-        // Lock-free write buffer
-        LockFreeQueue<TimePoint> writeBuffer_;
-
-        // Write-ahead log for durability
+        // Per-thread write buffer shards, drained into drainBatch_, whose
+        // points trade their string buffers with the slots they replace
+        ShardedRingBuffer<TimePoint> writeBuffer_{WRITE_BUFFER_SLOTS};
+        std::vector<TimePoint> drainBatch_;
+        std::mutex flushMutex_; // one drain at a time, guards drainBatch_
+
+        // Workers that intern, append, compress and persist drained points
+        ThreadPool flushPool_;
+
+        // Write-ahead log for durability. Its entries from walSequence_ on
+        // hold the points the saved directory lacks: chunks registered
+        // since the last checkpoint are left out of it and replayed from
+        // the log after a crash. Writers hold writeGate_ shared from logging
+        // a point to buffering it, so a checkpoint holding it exclusively
+        // finds every logged point in the buffer.
         std::unique_ptr<WriteAheadLog> wal_;
+        std::shared_mutex writeGate_;
+        uint64_t walSequence_ = 0;                                // guarded by chunksMutex_
+        ColumnarStorageManager::ChunkIds uncheckpointed_;         // guarded by chunksMutex_
+        std::mutex checkpointMutex_;                              // one checkpoint at a time
+        std::mutex metadataMutex_;                                // one saveMetadata at a time
+        std::atomic<uint64_t> checkpointBytes_{CHECKPOINT_WAL_BYTES};
+        std::atomic<uint64_t> checkpointAge_{static_cast<uint64_t>(CHECKPOINT_MAX_AGE.count())};
 
         // Adaptive indexing for fast queries
         AdaptiveIndex index_;
 
-        // Background threads for maintenance
+        // Background flusher, asleep until the buffer has points
         std::atomic<bool> running_{true};
         std::thread flushThread_;
+        std::mutex flushSignalMutex_;
+        std::condition_variable flushSignal_;
+
+        // Background compactor, merging small sealed chunks into segments
+        std::thread compactThread_;
+        std::mutex compactSignalMutex_;
+        std::condition_variable compactSignal_;
+        std::atomic<bool> compactorStopping_{false};
+        bool checkpointWanted_ = false; // by the flusher; guarded by compactSignalMutex_
+        std::mutex compactMutex_;     // one compaction at a time
+        uint64_t directoryEpoch_ = 0; // bumped when chunks leave the directory
+
+        // Seconds of data kept behind each metric's newest point, database
+        // wide and per metric; 0 keeps everything
+        uint64_t retention_ = 0;
+        std::unordered_map<std::string, uint64_t> metricRetention_;
+        mutable std::mutex retentionMutex_;
 
         // Metrics tracking
         std::unordered_set<std::string> metrics_;
         mutable std::mutex metricsMutex_;
 
+        // Dense series IDs shared by every chunk of the database
+        std::shared_ptr<SeriesCatalog> catalog_;
+
         // Storage manager
         std::unique_ptr<ColumnarStorageManager> storageManager_;
 
+        // Pre-aggregated 1m/1h/1d buckets, updated as points are flushed.
+        // Metrics whose saved rollups disagreed with the directory on open
+        // are answered from chunks until the compactor has added the chunks
+        // with ids below the bound back in; guarded by chunksMutex_.
+        std::unique_ptr<RollupManager> rollups_;
+        std::unordered_map<std::string, size_t> staleRollups_;
+
         // DSL query engine - Modified to be optional
         std::unique_ptr<QueryDSL> queryEngine_;
 
         // Internal methods
         void flushLoop();
+        void stopFlusher();
+        void notifyFlusher();
+        void enqueue(const TimePoint &point);
         void flushWriteBuffer();
-        void ensureActiveChunk(const std::string &metric);
+        void compactLoop();
+        void stopCompactor();
+        bool compactMetric(const std::string &metric);
+        uint64_t retentionFor(const std::string &metric) const;
+        void saveRetention() const;
+        void loadRetention();
+        SeriesSelection selectSeries(const std::string &metric,
+                                     const std::unordered_map<std::string, std::string> &tags);
+        ChunkCache::Handle residentChunk(const std::string &metric, const ChunkMeta &meta);
+        std::vector<ChunkMeta> overlappingChunks(const std::string &metric,
+                                                 uint64_t start_time, uint64_t end_time) const;
+        size_t registerChunk(const std::string &metric, std::unique_ptr<ColumnarChunk> chunk);
+        const ChunkMeta *findChunk(const std::string &metric, size_t chunkId) const;
+        void persistChunk(const std::string &metric, size_t chunkId);
+        void persistSealed(const std::vector<std::pair<std::string, size_t>> &sealed);
+        bool checkpoint();
+        bool checkpointDue() const;
+        template <typename Fold>
+        bool foldDeferred(const std::string &metric, const std::vector<DeferredChunk> &deferred,
+                          uint64_t epoch, const Fold &fold);
+        void rawAggregate(const std::string &metric, uint64_t start_time, uint64_t end_time,
+                          const SeriesSelection &selection, RollupBucket &bucket,
+                          std::vector<DeferredChunk> &deferred);
+        bool rollupAggregate(const std::string &metric, uint64_t start_time, uint64_t end_time,
+                             const std::unordered_map<std::string, std::string> &tags,
+                             const SeriesSelection &selection, RollupBucket &bucket,
+                             std::vector<DeferredChunk> &deferred);
+        RollupBucket aggregate(const std::string &metric, uint64_t start_time, uint64_t end_time,
+                               const std::unordered_map<std::string, std::string> &tags);
+        void checkRollups();
+        void rebuildRollups();
         void initializeQueryEngine();
         std::vector<TimePoint> executeBasicDSLQuery(const std::string &queryStr);
 
@@ -151,6 +276,9 @@ namespace waffledb
         // IDatabase operations
         void write(const TimePoint &point);
         void writeBatch(const std::vector<TimePoint> &points);
+        void flush();
+        void sync();
+        void compact();
         std::vector<TimePoint> query(const std::string &metric, uint64_t start_time,
                                      uint64_t end_time, const std::unordered_map<std::string, std::string> &tags);
         double avg(const std::string &metric, uint64_t start_time, uint64_t end_time,
@@ -161,6 +289,27 @@ namespace waffledb
                    const std::unordered_map<std::string, std::string> &tags);
         double max(const std::string &metric, uint64_t start_time, uint64_t end_time,
                    const std::unordered_map<std::string, std::string> &tags);
+        bool rollupWindows(const std::string &metric, uint64_t start_time, uint64_t end_time,
+                           uint64_t window_seconds, const std::unordered_map<std::string, std::string> &tags,
+                           std::vector<std::pair<uint64_t, RollupBucket>> &windows);
+
+        void setChunkCacheBudget(size_t bytes) { chunkCache_.setBudget(bytes); }
+        ChunkCacheStats chunkCacheStats() const { return chunkCache_.stats(); }
+        void setAdaptiveIndexBudget(size_t bytes) { index_.setBudget(bytes); }
+        void setOutOfOrderWindow(uint64_t seconds) { outOfOrderWindow_ = seconds; }
+        void setWalSyncPolicy(WalSyncPolicy policy, uint64_t interval_ms)
+        {
+            wal_->setSyncPolicy(policy, std::chrono::milliseconds(interval_ms));
+        }
+        void setCheckpointThreshold(uint64_t wal_bytes, uint64_t max_age_seconds)
+        {
+            checkpointBytes_ = wal_bytes;
+            checkpointAge_ = max_age_seconds;
+        }
+        void setRetention(uint64_t seconds);
+        void setRetention(const std::string &metric, uint64_t seconds);
+        void applyRetention();
+        AdaptiveIndexStats adaptiveIndexStats() const { return index_.stats(); }
 
         std::vector<std::string> getMetrics();
         void deleteMetric(const std::string &metric);
@@ -179,16 +328,17 @@ namespace waffledb
         std::string explainQuery(const std::string &queryStr);
 
         // Persistence
-        void saveMetadata();
+        bool saveMetadata();
         void loadMetadata();
-        void saveActiveChunks();
     };
 
     TimeSeriesDatabase::Impl::Impl(const std::string &dbname, const std::string &path)
         : dbName_(dbname),
           dbPath_(path),
           wal_(std::make_unique<WriteAheadLog>(path)),
-          storageManager_(std::make_unique<ColumnarStorageManager>(path))
+          catalog_(std::make_shared<SeriesCatalog>(path)),
+          storageManager_(std::make_unique<ColumnarStorageManager>(path, catalog_)),
+          rollups_(std::make_unique<RollupManager>(path))
     {
 
         // Create directory if it doesn't exist
@@ -199,76 +349,59 @@ namespace waffledb
 
         // Load metadata and existing chunks first
         loadMetadata();
+        loadRetention();
 
-        // Only recover from WAL if we have no existing data
-        // This prevents duplicate data when chunks already exist
-        bool hasExistingData = false;
+        // Replay what the directory lacks. Directories saved before the
+        // log was checkpointed hold everything it does, as it was cleared
+        // on every open then.
+        std::vector<TimePoint> recoveredPoints;
+        if (walSequence_ == UNKNOWN_WAL_SEQUENCE)
         {
-            std::lock_guard<std::mutex> lock(chunksMutex_);
-            hasExistingData = !metricChunks_.empty() || !activeChunks_.empty();
+            wal_->recover();
+            walSequence_ = wal_->rotate();
+            wal_->release(walSequence_);
+        }
+        else
+        {
+            recoveredPoints = wal_->recover(walSequence_);
         }
 
-        if (!hasExistingData)
+        if (!recoveredPoints.empty())
         {
-            auto recoveredPoints = wal_->recover();
-            if (!recoveredPoints.empty())
-            {
-                std::cout << "WAL: Recovered " << recoveredPoints.size() << " entries" << std::endl;
+            std::cout << "WAL: Recovered " << recoveredPoints.size() << " entries" << std::endl;
 
-                // Process recovered points using normal write path
-                for (const auto &point : recoveredPoints)
+            // Process recovered points using normal write path
+            for (const auto &point : recoveredPoints)
+            {
+                // Add to metrics
                 {
-                    // Add to metrics
-                    {
-                        std::lock_guard<std::mutex> lock(metricsMutex_);
-                        metrics_.insert(point.metric);
-                    }
-
-                    // Add to write buffer
-                    writeBuffer_.push(point);
+                    std::lock_guard<std::mutex> lock(metricsMutex_);
+                    metrics_.insert(point.metric);
                 }
 
-                // Process the write buffer immediately
-                flushWriteBuffer();
-
-                // Clear WAL after successful recovery
-                wal_->clear();
-
-                std::cout << "WAL: Recovery complete, WAL cleared" << std::endl;
+                // Add to write buffer
+                enqueue(point);
             }
-        }
-        else
-        {
-            // Clear WAL if we have existing data to prevent conflicts
-            wal_->clear();
+
+            // Still covered by the log until the next checkpoint
+            flushWriteBuffer();
         }
 
         // Initialize DSL query engine (deferred)
         initializeQueryEngine();
 
-        // Start background thread
+        // Start background threads
         flushThread_ = std::thread(&Impl::flushLoop, this);
+        compactThread_ = std::thread(&Impl::compactLoop, this);
     }
 
     TimeSeriesDatabase::Impl::~Impl()
     {
-        // Signal thread to stop
-        running_ = false;
+        stopCompactor();
+        stopFlusher();
 
-        // Wait for thread
-        if (flushThread_.joinable())
-        {
-            flushThread_.join();
-        }
-
-        // Final flush
-        flushWriteBuffer();
-
-        // Save active chunks
-        saveActiveChunks();
-
-        // Save metadata
-        saveMetadata();
+        // Everything buffered or active goes to the chunk files
+        checkpoint();
 
         // Close DSL engine
         queryEngine_.reset();
@@ -287,88 +420,858 @@ namespace waffledb
         queryEngine_ = nullptr;
     }
 
+    // Sleeps until a point is buffered, then until the buffer fills up or
+    // FLUSH_MAX_LATENCY has passed, and drains it
     void TimeSeriesDatabase::Impl::flushLoop()
     {
+        auto full = [this]()
+        {
+            return writeBuffer_.anyShardAtLeast(FLUSH_TRIGGER_POINTS, FLUSH_TRIGGER_BYTES);
+        };
+
+        std::unique_lock<std::mutex> lock(flushSignalMutex_);
         while (running_)
         {
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            if (running_)
+            flushSignal_.wait(lock, [this]()
+                              { return !running_ || !writeBuffer_.empty(); });
+            if (!running_)
+                break;
+
+            auto deadline = std::chrono::steady_clock::now() + FLUSH_MAX_LATENCY;
+            flushSignal_.wait_until(lock, deadline, [&]()
+                                    { return !running_ || full(); });
+
+            lock.unlock();
+            flushWriteBuffer();
+            if (checkpointDue())
             {
-                flushWriteBuffer();
+                std::lock_guard<std::mutex> compactLock(compactSignalMutex_);
+                checkpointWanted_ = true;
+                compactSignal_.notify_one();
             }
+            lock.lock();
         }
     }
 
-    void TimeSeriesDatabase::Impl::ensureActiveChunk(const std::string &metric)
+    // Points left behind are drained by the caller's final flush
+    void TimeSeriesDatabase::Impl::stopFlusher()
     {
-        if (activeChunks_.find(metric) == activeChunks_.end())
         {
-            activeChunks_[metric] = std::make_unique<ColumnarChunk>();
+            std::lock_guard<std::mutex> lock(flushSignalMutex_);
+            running_ = false;
+        }
+        flushSignal_.notify_one();
+
+        if (flushThread_.joinable())
+        {
+            flushThread_.join();
         }
     }
 
-    void TimeSeriesDatabase::Impl::flushWriteBuffer()
+    void TimeSeriesDatabase::Impl::notifyFlusher()
+    {
+        // Taking the lock orders the notification after the flusher's
+        // predicate check, so it cannot be lost
+        {
+            std::lock_guard<std::mutex> lock(flushSignalMutex_);
+        }
+        flushSignal_.notify_one();
+    }
+
+    // Buffers a point and wakes the flusher when its shard stops being
+    // empty, to arm the deadline, and when the shard reaches a size trigger
+    void TimeSeriesDatabase::Impl::enqueue(const TimePoint &point)
     {
-        std::vector<TimePoint> points;
-        TimePoint point;
+        size_t size = bufferedSize(point);
+        ShardedRingBuffer<TimePoint>::Fill fill;
+        while (!writeBuffer_.tryPush(point, size, &fill))
+        {
+            // The shard is full: drain on this thread instead of waiting
+            flushWriteBuffer();
+        }
 
-        // Drain write buffer using lock-free queue
-        while (writeBuffer_.pop(point))
+        if (fill.items == 1 || fill.items == FLUSH_TRIGGER_POINTS ||
+            (fill.weight >= FLUSH_TRIGGER_BYTES && fill.weight - size < FLUSH_TRIGGER_BYTES))
         {
-            points.push_back(point);
+            notifyFlusher();
         }
+    }
 
-        if (points.empty())
+    // Tag-filtered selections go through the adaptive index, which keeps the
+    // series lists of hot patterns until the catalog grows
+    SeriesSelection TimeSeriesDatabase::Impl::selectSeries(const std::string &metric,
+                                                           const std::unordered_map<std::string, std::string> &tags)
+    {
+        SeriesSelection selection;
+        if (!tags.empty())
+        {
+            selection.all = false;
+            selection.ids = index_.selectSeries(metric, tags, catalog_->size(),
+                                                [&]
+                                                { return catalog_->select(tags); });
+            for (const auto &[key, value] : tags)
+            {
+                selection.pairHashes.push_back(TagBloomFilter::hash(key, value));
+            }
+        }
+        return selection;
+    }
+
+    // Adds a completed chunk to the directory and hands it to the cache under
+    // the next chunk id, since recent data is the most likely to be queried.
+    // It stays dirty, and therefore unevictable, until it has been written.
+    // The caller holds chunksMutex_.
+    size_t TimeSeriesDatabase::Impl::registerChunk(const std::string &metric, std::unique_ptr<ColumnarChunk> chunk)
+    {
+        auto &entries = metricChunks_[metric];
+        size_t chunkId = entries.empty() ? 0 : entries.back().id + 1;
+
+        entries.push_back(chunk->meta(chunkId));
+        index_.addChunk(chunkId, metric, entries.back().minTimestamp, entries.back().maxTimestamp);
+        chunkCache_.insert(metric, chunkId, std::move(chunk), true);
+        uncheckpointed_[metric].insert(chunkId);
+        return chunkId;
+    }
+
+    // Directory entry of a chunk, or nullptr; the caller holds chunksMutex_
+    const ChunkMeta *TimeSeriesDatabase::Impl::findChunk(const std::string &metric, size_t chunkId) const
+    {
+        auto completed = metricChunks_.find(metric);
+        if (completed == metricChunks_.end())
+            return nullptr;
+
+        // Entries are kept in ascending id order
+        const auto &entries = completed->second;
+        auto it = std::lower_bound(entries.begin(), entries.end(), chunkId,
+                                   [](const ChunkMeta &meta, size_t id)
+                                   { return meta.id < id; });
+        return it != entries.end() && it->id == chunkId ? &*it : nullptr;
+    }
+
+    void TimeSeriesDatabase::Impl::persistChunk(const std::string &metric, size_t chunkId)
+    {
+        auto chunk = chunkCache_.get(metric, chunkId, []()
+                                     { return std::unique_ptr<ColumnarChunk>(); });
+        if (!chunk)
             return;
 
-        // Group by metric
-        std::unordered_map<std::string, std::vector<TimePoint>> metricPoints;
-        for (const auto &p : points)
+        try
+        {
+            storageManager_->saveChunk(metric, chunkId, *chunk);
+            chunkCache_.markClean(metric, chunkId);
+        }
+        catch (const std::exception &e)
         {
-            metricPoints[p.metric].push_back(p);
+            // Left dirty and retried on the next save
+            std::cerr << "Failed to save chunk " << metric << "/" << chunkId << ": " << e.what() << std::endl;
         }
+    }
+
+    ChunkCache::Handle TimeSeriesDatabase::Impl::residentChunk(const std::string &metric, const ChunkMeta &meta)
+    {
+        return chunkCache_.get(metric, meta.id, [&]()
+                               { return storageManager_->loadChunk(metric, meta.id); });
+    }
+
+    // Copies of the directory entries of metric overlapping [start_time,
+    // end_time], found through the interval index instead of a scan. The
+    // caller holds chunksMutex_.
+    std::vector<ChunkMeta> TimeSeriesDatabase::Impl::overlappingChunks(
+        const std::string &metric, uint64_t start_time, uint64_t end_time) const
+    {
+        std::vector<ChunkMeta> result;
+        for (size_t chunkId : index_.findChunks(metric, start_time, end_time))
+        {
+            const ChunkMeta *meta = findChunk(metric, chunkId);
+            if (meta && meta->overlaps(start_time, end_time))
+            {
+                result.push_back(*meta);
+            }
+        }
+        return result;
+    }
+
+    // Drains the write buffer. Series are interned and points appended per
+    // metric on the flush pool; chunks that fill up are registered as they
+    // are, then compressed and written on the pool outside chunksMutex_.
+    void TimeSeriesDatabase::Impl::flushWriteBuffer()
+    {
+        // The queue has a single consumer; a flush() racing the flusher
+        // waits here until the points drained before it are in the chunks.
+        // Holding this also keeps sync() from writing a chunk being sealed.
+        std::lock_guard<std::mutex> flushLock(flushMutex_);
+
+        size_t count = 0;
+        writeBuffer_.drain(drainBatch_, count);
+        if (count == 0)
+            return;
+
+        // One work item per metric
+        struct MetricBatch
+        {
+            const std::string *metric = nullptr;
+            std::vector<const TimePoint *> points;
+            std::vector<uint32_t> seriesIds;
+            std::unordered_map<uint32_t, std::unique_ptr<ColumnarChunk>> *active = nullptr;
+            std::unordered_map<uint32_t, uint64_t> *watermarks = nullptr;
+            std::vector<std::unique_ptr<ColumnarChunk>> full;
+        };
+        std::vector<MetricBatch> batches;
+        std::unordered_map<std::string, size_t> batchOf;
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto [it, inserted] = batchOf.emplace(drainBatch_[i].metric, batches.size());
+            if (inserted)
+            {
+                batches.emplace_back();
+                batches.back().metric = &it->first;
+            }
+            batches[it->second].points.push_back(&drainBatch_[i]);
+        }
+
+        // Interning only takes the catalog's own lock
+        flushPool_.parallelFor(batches.size(), [&](size_t b)
+                               {
+                                   MetricBatch &batch = batches[b];
+                                   batch.seriesIds.reserve(batch.points.size());
+                                   for (const TimePoint *p : batch.points)
+                                   {
+                                       batch.seriesIds.push_back(catalog_->intern(p->tags));
+                                   } });
+
+        std::vector<std::pair<std::string, size_t>> sealed;
+        {
+            std::lock_guard<std::mutex> lock(chunksMutex_);
+
+            // Metric entries are created up front so the work items below
+            // each touch only their own
+            for (MetricBatch &batch : batches)
+            {
+                batch.active = &activeChunks_[*batch.metric];
+                batch.watermarks = &watermarks_[*batch.metric];
+            }
+            uint64_t window = outOfOrderWindow_;
+
+            flushPool_.parallelFor(batches.size(), [&](size_t b)
+                                   {
+                                       MetricBatch &batch = batches[b];
+                                       for (size_t i = 0; i < batch.points.size(); ++i)
+                                       {
+                                           uint64_t timestamp = batch.points[i]->timestamp;
+                                           uint64_t &watermark = (*batch.watermarks)[batch.seriesIds[i]];
+                                           bool late = watermark > window && timestamp < watermark - window;
+                                           watermark = std::max(watermark, timestamp);
+
+                                           // Chunks stay within one partition: a point from an
+                                           // earlier one than its series' chunk goes to the
+                                           // overflow chunk, a later one seals the chunk
+                                           uint64_t partition = partitionOf(timestamp);
+                                           auto *slot = &(*batch.active)[late ? MIXED_SERIES : batch.seriesIds[i]];
+                                           if (!late && *slot && partition < partitionOf((*slot)->getMinTimestamp()))
+                                           {
+                                               slot = &(*batch.active)[MIXED_SERIES];
+                                           }
+                                           auto &chunk = *slot;
+                                           if (chunk && (!chunk->canAppend() || partitionOf(chunk->getMinTimestamp()) != partition))
+                                           {
+                                               batch.full.push_back(std::move(chunk));
+                                           }
+                                           if (!chunk)
+                                           {
+                                               chunk = std::make_unique<ColumnarChunk>(catalog_);
+                                           }
+                                           chunk->append(timestamp, batch.points[i]->value, batch.seriesIds[i]);
+                                       }
+                                       rollups_->add(*batch.metric, batch.points); });
+
+            // Full chunks join the directory uncompressed and stay queryable
+            // while they are compressed and written below
+            for (MetricBatch &batch : batches)
+            {
+                for (auto &chunk : batch.full)
+                {
+                    sealed.emplace_back(*batch.metric, registerChunk(*batch.metric, std::move(chunk)));
+                }
+            }
+        }
+
+        persistSealed(sealed);
+    }
+
+    // Compresses and writes registered chunks on the flush pool outside
+    // chunksMutex_; the compressed copies then replace the originals in the
+    // cache. A chunk that fails to save stays dirty for the next attempt.
+    void TimeSeriesDatabase::Impl::persistSealed(const std::vector<std::pair<std::string, size_t>> &sealed)
+    {
+        if (sealed.empty())
+            return;
+
+        std::vector<std::unique_ptr<ColumnarChunk>> compressed(sealed.size());
+        std::vector<char> saved(sealed.size(), 0);
+        flushPool_.parallelFor(sealed.size(), [&](size_t i)
+                               {
+                                   const auto &[metric, chunkId] = sealed[i];
+                                   auto chunk = chunkCache_.get(metric, chunkId, []()
+                                                                { return std::unique_ptr<ColumnarChunk>(); });
+                                   if (!chunk)
+                                       return; // metric deleted meanwhile
+
+                                   compressed[i] = chunk->compressedCopy();
+                                   try
+                                   {
+                                       storageManager_->saveChunk(metric, chunkId, *compressed[i]);
+                                       saved[i] = 1;
+                                   }
+                                   catch (const std::exception &e)
+                                   {
+                                       // Left dirty and retried on the next save
+                                       std::cerr << "Failed to save chunk " << metric << "/" << chunkId << ": " << e.what() << std::endl;
+                                   } });
 
-        // Write to chunks
         std::lock_guard<std::mutex> lock(chunksMutex_);
+        for (size_t i = 0; i < sealed.size(); ++i)
+        {
+            const auto &[metric, chunkId] = sealed[i];
+            if (!compressed[i])
+                continue;
+
+            if (!findChunk(metric, chunkId))
+            {
+                storageManager_->deleteChunk(metric, chunkId);
+                continue;
+            }
+            chunkCache_.insert(metric, chunkId, std::move(compressed[i]), !saved[i]);
+        }
+    }
+
+    // Makes every point written so far durable in the chunk files and lets
+    // the log drop it. With writers held off, the buffer is drained, the
+    // log moved aside and the active chunks registered, so the chunks then
+    // hold exactly the entries before the cut. They are written and synced
+    // once writers resume, and the old log is deleted after the directory
+    // naming them is saved. Returns false if anything failed to save; the
+    // log keeps the entries until a later checkpoint succeeds.
+    bool TimeSeriesDatabase::Impl::checkpoint()
+    {
+        std::lock_guard<std::mutex> checkpointLock(checkpointMutex_);
+        if (!wal_ || !storageManager_)
+            return false; // closed by destroy()
+
+        uint64_t sequence = 0;
+        ColumnarStorageManager::ChunkIds covered;
+        std::vector<std::pair<std::string, size_t>> sealed;
+        {
+            std::unique_lock<std::shared_mutex> gate(writeGate_);
+            flushWriteBuffer();
+            try
+            {
+                sequence = wal_->rotate();
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << "Failed to checkpoint WAL: " << e.what() << std::endl;
+                return false;
+            }
+
+            std::lock_guard<std::mutex> flushLock(flushMutex_);
+            std::lock_guard<std::mutex> lock(chunksMutex_);
+            for (auto &[metric, seriesChunks] : activeChunks_)
+            {
+                for (auto &[seriesId, chunk] : seriesChunks)
+                {
+                    if (chunk && chunk->size() > 0)
+                    {
+                        sealed.emplace_back(metric, registerChunk(metric, std::move(chunk)));
+                    }
+                }
+            }
+            activeChunks_.clear();
+            covered = uncheckpointed_;
+        }
+
+        persistSealed(sealed);
 
-        for (const auto &[metric, pts] : metricPoints)
         {
-            ensureActiveChunk(metric);
+            std::lock_guard<std::mutex> flushLock(flushMutex_);
+            std::lock_guard<std::mutex> lock(chunksMutex_);
+
+            // Chunks left dirty by an earlier failure get another attempt
+            bool clean = true;
+            for (const auto &[metric, chunkId] : chunkCache_.dirtyChunks())
+            {
+                persistChunk(metric, chunkId);
+            }
+            for (const auto &[metric, chunkId] : chunkCache_.dirtyChunks())
+            {
+                auto ids = covered.find(metric);
+                clean = clean && (ids == covered.end() || !ids->second.count(chunkId));
+            }
+            if (!clean)
+                return false;
+
+            for (const auto &[metric, ids] : covered)
+            {
+                auto remaining = uncheckpointed_.find(metric);
+                if (remaining == uncheckpointed_.end())
+                    continue;
+                for (size_t chunkId : ids)
+                {
+                    remaining->second.erase(chunkId);
+                }
+                if (remaining->second.empty())
+                {
+                    uncheckpointed_.erase(remaining);
+                }
+            }
+            walSequence_ = sequence;
+        }
 
-            auto &activeChunk = activeChunks_[metric];
+        if (!saveMetadata())
+            return false;
+        wal_->release(sequence);
+        return true;
+    }
+
+    // Whether the log has outgrown the checkpoint thresholds; 0 disables one
+    bool TimeSeriesDatabase::Impl::checkpointDue() const
+    {
+        uint64_t bytes = checkpointBytes_;
+        uint64_t age = checkpointAge_;
+        return (bytes > 0 && wal_->size() >= bytes) ||
+               (age > 0 && wal_->age() >= std::chrono::seconds(age));
+    }
 
-            for (const auto &p : pts)
+    // Compacts every COMPACTION_INTERVAL, and checkpoints when the flusher
+    // asks or a pass finds the log due, until stopped
+    void TimeSeriesDatabase::Impl::compactLoop()
+    {
+        std::unique_lock<std::mutex> lock(compactSignalMutex_);
+        auto nextPass = std::chrono::steady_clock::now() + COMPACTION_INTERVAL;
+        while (true)
+        {
+            compactSignal_.wait_until(lock, nextPass, [this]()
+                                      { return compactorStopping_.load() || checkpointWanted_; });
+            if (compactorStopping_)
+                break;
+
+            bool pass = std::chrono::steady_clock::now() >= nextPass;
+            checkpointWanted_ = false;
+            lock.unlock();
+            try
             {
-                if (!activeChunk->canAppend())
+                if (pass)
                 {
-                    // Move to completed chunks
-                    if (metricChunks_.find(metric) == metricChunks_.end())
+                    applyRetention();
+                    compact();
+                }
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << "Compaction failed: " << e.what() << std::endl;
+            }
+            if (checkpointDue())
+            {
+                checkpoint();
+            }
+            lock.lock();
+
+            if (pass)
+                nextPass = std::chrono::steady_clock::now() + COMPACTION_INTERVAL;
+        }
+    }
+
+    // Waits for a running compaction to finish its current pass
+    void TimeSeriesDatabase::Impl::stopCompactor()
+    {
+        {
+            std::lock_guard<std::mutex> lock(compactSignalMutex_);
+            compactorStopping_ = true;
+        }
+        compactSignal_.notify_one();
+
+        if (compactThread_.joinable())
+        {
+            compactThread_.join();
+        }
+    }
+
+    void TimeSeriesDatabase::Impl::compact()
+    {
+        rebuildRollups();
+
+        std::lock_guard<std::mutex> compactLock(compactMutex_);
+
+        std::vector<std::string> metrics;
+        {
+            std::lock_guard<std::mutex> lock(chunksMutex_);
+            for (const auto &[metric, entries] : metricChunks_)
+            {
+                metrics.push_back(metric);
+            }
+        }
+
+        for (const auto &metric : metrics)
+        {
+            while (!compactorStopping_ && compactMetric(metric))
+            {
+            }
+        }
+    }
+
+    uint64_t TimeSeriesDatabase::Impl::retentionFor(const std::string &metric) const
+    {
+        std::lock_guard<std::mutex> lock(retentionMutex_);
+        auto it = metricRetention_.find(metric);
+        return it != metricRetention_.end() ? it->second : retention_;
+    }
+
+    void TimeSeriesDatabase::Impl::setRetention(uint64_t seconds)
+    {
+        {
+            std::lock_guard<std::mutex> lock(retentionMutex_);
+            retention_ = seconds;
+        }
+        saveRetention();
+    }
+
+    void TimeSeriesDatabase::Impl::setRetention(const std::string &metric, uint64_t seconds)
+    {
+        {
+            std::lock_guard<std::mutex> lock(retentionMutex_);
+            metricRetention_[metric] = seconds;
+        }
+        saveRetention();
+    }
+
+    void TimeSeriesDatabase::Impl::saveRetention() const
+    {
+        std::ostringstream file;
+        {
+            std::lock_guard<std::mutex> lock(retentionMutex_);
+            file << "retention:" << retention_ << "\n";
+            for (const auto &[metric, seconds] : metricRetention_)
+            {
+                file << metric << ":" << seconds << "\n";
+            }
+        }
+
+        std::string text = file.str();
+        try
+        {
+            replaceFile(dbPath_ + "/retention.txt", std::vector<uint8_t>(text.begin(), text.end()), "retention policy");
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Failed to save retention policy: " << e.what() << std::endl;
+        }
+    }
+
+    void TimeSeriesDatabase::Impl::loadRetention()
+    {
+        std::ifstream file(dbPath_ + "/retention.txt");
+        std::string line;
+        if (!file || !std::getline(file, line) || line.find("retention:") != 0)
+            return;
+
+        std::lock_guard<std::mutex> lock(retentionMutex_);
+        retention_ = std::stoull(line.substr(10));
+        while (std::getline(file, line))
+        {
+            size_t colonPos = line.rfind(':');
+            if (colonPos != std::string::npos)
+            {
+                metricRetention_[line.substr(0, colonPos)] = std::stoull(line.substr(colonPos + 1));
+            }
+        }
+    }
+
+    // Expires whole partitions: those ending at least the retention period
+    // before the metric's newest point. Their entries and rollup buckets go
+    // under chunksMutex_; once the directory without them is saved, their
+    // directories are unlinked with no chunk read or rewritten.
+    void TimeSeriesDatabase::Impl::applyRetention()
+    {
+        std::lock_guard<std::mutex> compactLock(compactMutex_);
+
+        std::vector<std::pair<std::string, uint64_t>> expired; // metric, first partition kept
+        std::vector<std::pair<std::string, size_t>> removed;
+        {
+            std::lock_guard<std::mutex> lock(chunksMutex_);
+            for (auto &[metric, entries] : metricChunks_)
+            {
+                uint64_t retention = retentionFor(metric);
+                if (retention == 0)
+                    continue;
+
+                uint64_t newest = 0;
+                for (const auto &meta : entries)
+                {
+                    newest = std::max(newest, meta.maxTimestamp);
+                }
+                for (const auto &[seriesId, watermark] : watermarks_[metric])
+                {
+                    newest = std::max(newest, watermark);
+                }
+                if (newest < retention)
+                    continue;
+
+                // New ids continue from the last entry, so its partition
+                // is kept until a newer chunk is sealed
+                uint64_t before = partitionOf(newest - retention);
+                if (!entries.empty())
+                {
+                    before = std::min(before, partitionOf(entries.back().maxTimestamp));
+                }
+
+                size_t expiredCount = 0;
+                auto expiredEnd = std::stable_partition(entries.begin(), entries.end(), [&](const ChunkMeta &meta)
+                                                        { return partitionOf(meta.maxTimestamp) >= before; });
+                for (auto it = expiredEnd; it != entries.end(); ++it)
+                {
+                    removed.emplace_back(metric, it->id);
+                    if (auto pending = uncheckpointed_.find(metric); pending != uncheckpointed_.end())
+                        pending->second.erase(it->id);
+                    ++expiredCount;
+                    index_.removeChunk(it->id, metric);
+                    chunkCache_.erase(metric, it->id);
+                }
+                entries.erase(expiredEnd, entries.end());
+
+                auto &active = activeChunks_[metric];
+                for (auto it = active.begin(); it != active.end();)
+                {
+                    if (it->second && partitionOf(it->second->getMaxTimestamp()) < before)
                     {
-                        metricChunks_[metric] = std::vector<std::unique_ptr<ColumnarChunk>>();
+                        it = active.erase(it);
+                        ++expiredCount;
                     }
+                    else
+                    {
+                        ++it;
+                    }
+                }
+
+                if (expiredCount > 0)
+                {
+                    ++directoryEpoch_;
+                    rollups_->dropBefore(metric, before);
+                    expired.emplace_back(metric, before);
+                }
+            }
+        }
+        if (expired.empty())
+            return;
+
+        // Until the directory without them is saved, a restart still finds
+        // the expired chunks
+        saveMetadata();
+        for (const auto &[metric, before] : expired)
+        {
+            storageManager_->dropPartitions(metric, before);
+        }
+        for (const auto &[metric, chunkId] : removed)
+        {
+            storageManager_->deleteChunk(metric, chunkId);
+        }
+    }
+
+    // One compaction pass over a metric. The points of its overflow chunks
+    // are split by series and partition, and every series with points there
+    // or with COMPACTION_MIN_CHUNKS small chunks in the partition has them
+    // merged, sorted and re-encoded into segments of up to
+    // VALUES_PER_SEGMENT points. Inputs
+    // are read and segments written outside chunksMutex_; the directory
+    // entries are swapped under it only if every input is still there, and
+    // the input files are removed once the new directory is saved. Returns
+    // true when the pass stopped at COMPACTION_BATCH_POINTS with work left.
+    bool TimeSeriesDatabase::Impl::compactMetric(const std::string &metric)
+    {
+        std::vector<ChunkMeta> overflow;
+        std::map<std::pair<uint32_t, uint64_t>, std::vector<ChunkMeta>> small; // by series, partition
+        uint64_t epoch = 0;
+        {
+            std::lock_guard<std::mutex> lock(chunksMutex_);
+            // Chunks a rollup rebuild still has to read keep their ids
+            auto completed = metricChunks_.find(metric);
+            if (completed == metricChunks_.end() || staleRollups_.count(metric))
+                return false;
+            epoch = directoryEpoch_;
 
-                    metricChunks_[metric].push_back(std::move(activeChunk));
-                    activeChunk = std::make_unique<ColumnarChunk>();
+            // Chunks not yet checkpointed, written ones included, are left to
+            // a later pass: the log still replays their points
+            static const std::unordered_set<size_t> none;
+            auto pending = uncheckpointed_.find(metric);
+            const auto &skip = pending != uncheckpointed_.end() ? pending->second : none;
 
-                    // Update index
-                    size_t chunkId = metricChunks_[metric].size() - 1;
-                    auto &chunk = metricChunks_[metric].back();
+            for (const auto &meta : completed->second)
+            {
+                if (skip.count(meta.id))
+                    continue;
+                if (meta.seriesId == MIXED_SERIES)
+                    overflow.push_back(meta);
+                else if (meta.stats.count < VALUES_PER_SEGMENT / 2)
+                    small[{meta.seriesId, partitionOf(meta.maxTimestamp)}].push_back(meta);
+            }
+        }
+
+        // Committed chunks are on disk, so inputs are read from their files
+        // rather than through the cache
+        std::map<std::pair<uint32_t, uint64_t>, std::vector<std::pair<uint64_t, double>>> merged;
+        std::vector<ChunkMeta> inputs;
+        size_t budget = COMPACTION_BATCH_POINTS;
+        auto gather = [&](const ChunkMeta &meta)
+        {
+            auto chunk = storageManager_->loadChunk(metric, meta.id);
+            if (!chunk)
+                return false;
+
+            ColumnarChunk::ColumnView view = chunk->columns();
+            for (size_t i = 0; i < view.size(); ++i)
+            {
+                uint64_t timestamp = view.timestamps()[i];
+                merged[{chunk->seriesIdAt(i), partitionOf(timestamp)}].emplace_back(timestamp, view.values()[i]);
+            }
+            inputs.push_back(meta);
+            budget -= std::min<size_t>(budget, meta.stats.count);
+            return true;
+        };
+
+        bool more = false;
+        for (const auto &meta : overflow)
+        {
+            if (budget == 0)
+            {
+                more = true;
+                break;
+            }
+            if (!gather(meta))
+                return false;
+        }
+
+        for (const auto &[key, metas] : small)
+        {
+            if (metas.size() < COMPACTION_MIN_CHUNKS && merged.find(key) == merged.end())
+                continue;
+
+            size_t taken = 0;
+            for (const auto &meta : metas)
+            {
+                if (budget == 0 && taken >= 2)
+                {
+                    more = true;
+                    break;
+                }
+                if (!gather(meta))
+                    return false;
+                ++taken;
+            }
+            if (more)
+                break;
+        }
 
-                    std::unordered_map<std::string, std::unordered_set<std::string>> tagIndex;
+        if (inputs.empty())
+            return false;
 
-                    index_.addChunk(chunkId, metric, chunk->getMinTimestamp(),
-                                    chunk->getMaxTimestamp(), tagIndex);
+        // Inputs overlap in time, so each series is re-sorted as a whole
+        std::vector<std::unique_ptr<ColumnarChunk>> segments;
+        for (auto &[key, points] : merged)
+        {
+            uint32_t seriesId = key.first;
+            std::stable_sort(points.begin(), points.end(), [](const auto &a, const auto &b)
+                             { return a.first < b.first; });
 
-                    // Save chunk to disk
-                    storageManager_->saveChunk(metric, chunkId, *chunk);
+            for (size_t first = 0; first < points.size(); first += VALUES_PER_SEGMENT)
+            {
+                size_t last = std::min(points.size(), first + VALUES_PER_SEGMENT);
+                std::vector<uint64_t> timestamps;
+                std::vector<double> values;
+                timestamps.reserve(last - first);
+                values.reserve(last - first);
+                for (size_t i = first; i < last; ++i)
+                {
+                    timestamps.push_back(points[i].first);
+                    values.push_back(points[i].second);
                 }
+                segments.push_back(ColumnarChunk::fromSorted(std::move(timestamps), std::move(values),
+                                                             std::vector<uint32_t>(last - first, seriesId),
+                                                             catalog_));
+            }
+            std::vector<std::pair<uint64_t, double>>().swap(points);
+        }
+
+        std::vector<ColumnarStorageManager::StagedChunk> staged;
+        auto discard = [&]()
+        {
+            for (const auto &chunk : staged)
+            {
+                storageManager_->discardChunk(chunk, metric);
+            }
+        };
+        try
+        {
+            for (const auto &segment : segments)
+            {
+                staged.push_back(storageManager_->stageChunk(metric, *segment));
+            }
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Failed to write compacted segment of " << metric << ": " << e.what() << std::endl;
+            discard();
+            return false;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(chunksMutex_);
+            auto completed = metricChunks_.find(metric);
+            bool intact = directoryEpoch_ == epoch && completed != metricChunks_.end() &&
+                          std::all_of(inputs.begin(), inputs.end(), [&](const ChunkMeta &meta)
+                                      { return findChunk(metric, meta.id) != nullptr; });
+            if (!intact)
+            {
+                discard();
+                return false;
+            }
 
-                activeChunk->append(p.timestamp, p.value, p.tags);
+            // Segments take ids past every existing chunk, so the entries
+            // stay in id order
+            auto &entries = completed->second;
+            size_t firstId = entries.back().id + 1;
+            for (size_t i = 0; i < staged.size(); ++i)
+            {
+                storageManager_->publishChunk(staged[i], metric, firstId + i);
+            }
+
+            ++directoryEpoch_;
+            std::unordered_set<size_t> replaced;
+            for (const auto &meta : inputs)
+            {
+                replaced.insert(meta.id);
+                index_.removeChunk(meta.id, metric);
+                chunkCache_.erase(metric, meta.id);
+            }
+            entries.erase(std::remove_if(entries.begin(), entries.end(), [&](const ChunkMeta &meta)
+                                         { return replaced.count(meta.id) > 0; }),
+                          entries.end());
+
+            for (size_t i = 0; i < segments.size(); ++i)
+            {
+                size_t chunkId = firstId + i;
+                entries.push_back(segments[i]->meta(chunkId));
+                index_.addChunk(chunkId, metric, entries.back().minTimestamp, entries.back().maxTimestamp);
+                chunkCache_.insert(metric, chunkId, std::move(segments[i]));
             }
         }
 
-        // Checkpoint WAL
-        wal_->checkpoint();
+        // Until the directory naming the segments is saved, a restart still
+        // finds the inputs
+        saveMetadata();
+        for (const auto &meta : inputs)
+        {
+            storageManager_->deleteChunk(metric, meta.id);
+        }
+        storageManager_->reclaimSegments(metric);
+        return more;
     }
 
     void TimeSeriesDatabase::Impl::write(const TimePoint &point)
@@ -380,10 +1283,10 @@ namespace waffledb
         }
 
         // Write to WAL first for durability
+        std::shared_lock<std::shared_mutex> gate(writeGate_);
         wal_->append(point);
 
-        // Add to write buffer using lock-free queue
-        writeBuffer_.push(point);
+        enqueue(point);
     }
 
     void TimeSeriesDatabase::Impl::writeBatch(const std::vector<TimePoint> &points)
@@ -398,128 +1301,134 @@ namespace waffledb
         }
 
         // Write to WAL
+        std::shared_lock<std::shared_mutex> gate(writeGate_);
         wal_->appendBatch(points);
 
-        // Add to write buffer using lock-free queue
         for (const auto &point : points)
         {
-            writeBuffer_.push(point);
+            enqueue(point);
+        }
+    }
+
+    void TimeSeriesDatabase::Impl::flush()
+    {
+        flushWriteBuffer();
+    }
+
+    // A checkpoint: active chunks are sealed and written along with any
+    // chunk still dirty, then saveMetadata forces the segment files, the
+    // directory and the files describing it to disk
+    void TimeSeriesDatabase::Impl::sync()
+    {
+        checkpoint();
+    }
+
+    // Loads the chunks a read deferred and hands each to fold, pinned for
+    // the call. Returns false when one of them left the directory after the
+    // read's snapshot at epoch, so the read starts over from a fresh one; a
+    // chunk that fails to load otherwise is skipped.
+    template <typename Fold>
+    bool TimeSeriesDatabase::Impl::foldDeferred(const std::string &metric, const std::vector<DeferredChunk> &deferred,
+                                                uint64_t epoch, const Fold &fold)
+    {
+        for (const DeferredChunk &entry : deferred)
+        {
+            if (auto chunk = residentChunk(metric, entry.meta))
+            {
+                fold(*chunk, entry);
+                continue;
+            }
+
+            std::lock_guard<std::mutex> lock(chunksMutex_);
+            if (directoryEpoch_ != epoch)
+                return false;
         }
+        return true;
     }
 
+    // Points of the active chunks are gathered under chunksMutex_ along with
+    // copies of the overlapping directory entries; completed chunks are then
+    // loaded without it. The tag filter is resolved to series IDs once, and
+    // chunks of other series are skipped without being loaded.
     std::vector<TimePoint> TimeSeriesDatabase::Impl::query(
         const std::string &metric, uint64_t start_time, uint64_t end_time,
         const std::unordered_map<std::string, std::string> &tags)
     {
-
         std::vector<TimePoint> results;
+        SeriesSelection selection = selectSeries(metric, tags);
+        if (selection.empty())
+            return results;
 
-        std::lock_guard<std::mutex> lock(chunksMutex_);
-
-        // Query active chunk
-        if (activeChunks_.find(metric) != activeChunks_.end())
+        std::unordered_map<uint32_t, const std::unordered_map<std::string, std::string> *> seriesTags;
+        auto collect = [&](const ColumnarChunk &chunk)
         {
-            auto &chunk = activeChunks_[metric];
-            if (chunk && chunk->size() > 0 && chunk->getMinTimestamp() <= end_time && chunk->getMaxTimestamp() >= start_time)
-            {
-                auto timeIndices = chunk->queryTimeRange(start_time, end_time);
+            auto columns = chunk.columns();
+            auto [first, last] = columns.timeRange(start_time, end_time);
 
-                if (tags.empty())
-                {
-                    // No tag filtering
-                    const double *values = chunk->getValuesPtr();
-                    const uint64_t *timestamps = chunk->getTimestampsPtr();
-                    const auto &chunkTags = chunk->getTagsRef();
+            const double *values = columns.values();
+            const uint64_t *timestamps = columns.timestamps();
 
-                    for (size_t idx : timeIndices)
-                    {
-                        TimePoint point;
-                        point.metric = metric;
-                        point.timestamp = timestamps[idx];
-                        point.value = values[idx];
-                        point.tags = chunkTags[idx];
-                        results.push_back(point);
-                    }
-                }
-                else
+            for (size_t idx = first; idx < last; ++idx)
+            {
+                uint32_t id = chunk.seriesIdAt(idx);
+                if (!selection.contains(id))
+                    continue;
+
+                auto it = seriesTags.find(id);
+                if (it == seriesTags.end())
                 {
-                    // With tag filtering
-                    auto tagIndices = chunk->queryWithTags(tags);
-                    std::vector<size_t> indices;
-                    std::set_intersection(timeIndices.begin(), timeIndices.end(),
-                                          tagIndices.begin(), tagIndices.end(),
-                                          std::back_inserter(indices));
-
-                    const double *values = chunk->getValuesPtr();
-                    const uint64_t *timestamps = chunk->getTimestampsPtr();
-                    const auto &chunkTags = chunk->getTagsRef();
-
-                    for (size_t idx : indices)
-                    {
-                        TimePoint point;
-                        point.metric = metric;
-                        point.timestamp = timestamps[idx];
-                        point.value = values[idx];
-                        point.tags = chunkTags[idx];
-                        results.push_back(point);
-                    }
+                    it = seriesTags.emplace(id, &catalog_->tags(id)).first;
                 }
+
+                TimePoint point;
+                point.metric = metric;
+                point.timestamp = timestamps[idx];
+                point.value = values[idx];
+                point.tags = *it->second;
+                results.push_back(point);
             }
-        }
+        };
 
-        // Query completed chunks
-        if (metricChunks_.find(metric) != metricChunks_.end())
+        bool complete = false;
+        while (!complete)
         {
-            for (size_t i = 0; i < metricChunks_[metric].size(); ++i)
+            results.clear();
+            std::vector<DeferredChunk> deferred;
+            uint64_t epoch = 0;
             {
-                auto &chunk = metricChunks_[metric][i];
-                if (!chunk)
-                    continue;
+                std::lock_guard<std::mutex> lock(chunksMutex_);
+                epoch = directoryEpoch_;
 
-                if (chunk->getMinTimestamp() <= end_time && chunk->getMaxTimestamp() >= start_time)
+                // Query active chunks of the selected series
+                auto active = activeChunks_.find(metric);
+                if (active != activeChunks_.end())
                 {
-                    auto timeIndices = chunk->queryTimeRange(start_time, end_time);
-
-                    if (tags.empty())
+                    for (const auto &[key, chunk] : active->second)
                     {
-                        const double *values = chunk->getValuesPtr();
-                        const uint64_t *timestamps = chunk->getTimestampsPtr();
-                        const auto &chunkTags = chunk->getTagsRef();
+                        // The overflow chunk may hold any series
+                        if (!chunk || chunk->size() == 0 ||
+                            (chunk->seriesId() != MIXED_SERIES && !selection.contains(chunk->seriesId())))
+                            continue;
 
-                        for (size_t idx : timeIndices)
+                        if (chunk->getMinTimestamp() <= end_time && chunk->getMaxTimestamp() >= start_time)
                         {
-                            TimePoint point;
-                            point.metric = metric;
-                            point.timestamp = timestamps[idx];
-                            point.value = values[idx];
-                            point.tags = chunkTags[idx];
-                            results.push_back(point);
+                            collect(*chunk);
                         }
                     }
-                    else
-                    {
-                        auto tagIndices = chunk->queryWithTags(tags);
-                        std::vector<size_t> indices;
-                        std::set_intersection(timeIndices.begin(), timeIndices.end(),
-                                              tagIndices.begin(), tagIndices.end(),
-                                              std::back_inserter(indices));
-
-                        const double *values = chunk->getValuesPtr();
-                        const uint64_t *timestamps = chunk->getTimestampsPtr();
-                        const auto &chunkTags = chunk->getTagsRef();
+                }
 
-                        for (size_t idx : indices)
-                        {
-                            TimePoint point;
-                            point.metric = metric;
-                            point.timestamp = timestamps[idx];
-                            point.value = values[idx];
-                            point.tags = chunkTags[idx];
-                            results.push_back(point);
-                        }
+                for (ChunkMeta &meta : overlappingChunks(metric, start_time, end_time))
+                {
+                    if (selection.admits(meta))
+                    {
+                        deferred.push_back({std::move(meta), start_time, end_time});
                     }
                 }
             }
+
+            // Query completed chunks
+            complete = foldDeferred(metric, deferred, epoch, [&](const ColumnarChunk &chunk, const DeferredChunk &)
+                                    { collect(chunk); });
         }
 
         // Sort by timestamp
@@ -532,189 +1441,166 @@ namespace waffledb
         return results;
     }
 
-    double TimeSeriesDatabase::Impl::sum(
+    // Folds the points of [start_time, end_time] into bucket from the chunks
+    // of the selected series. Active chunks and fully covered single-series
+    // chunks, answered from their directory stats, are folded in here; other
+    // completed chunks are left in deferred to be read once the caller, who
+    // holds chunksMutex_, releases it.
+    void TimeSeriesDatabase::Impl::rawAggregate(
         const std::string &metric, uint64_t start_time, uint64_t end_time,
-        const std::unordered_map<std::string, std::string> & /*tags*/)
+        const SeriesSelection &selection, RollupBucket &bucket, std::vector<DeferredChunk> &deferred)
     {
+        if (selection.empty())
+            return;
 
-        double total = 0.0;
-
-        std::lock_guard<std::mutex> lock(chunksMutex_);
-
-        // Sum from active chunk
-        if (activeChunks_.find(metric) != activeChunks_.end())
+        auto active = activeChunks_.find(metric);
+        if (active != activeChunks_.end())
         {
-            auto &chunk = activeChunks_[metric];
-            if (chunk && chunk->size() > 0)
+            for (const auto &[key, chunk] : active->second)
             {
-                total += chunk->sum(start_time, end_time);
+                if (chunk && chunk->size() > 0 &&
+                    (chunk->seriesId() == MIXED_SERIES || selection.contains(chunk->seriesId())))
+                {
+                    foldChunk(*chunk, start_time, end_time, selection, bucket);
+                }
             }
         }
 
-        // Sum from completed chunks
-        if (metricChunks_.find(metric) != metricChunks_.end())
+        for (ChunkMeta &meta : overlappingChunks(metric, start_time, end_time))
         {
-            for (auto &chunk : metricChunks_[metric])
+            if (!selection.admits(meta))
+                continue;
+
+            bool mixed = meta.seriesId == MIXED_SERIES;
+            if (meta.coveredBy(start_time, end_time) && (selection.all || !mixed))
             {
-                if (chunk)
-                {
-                    total += chunk->sum(start_time, end_time);
-                }
+                RollupBucket part;
+                part.count = meta.stats.count;
+                part.sum = meta.stats.sum;
+                part.min = meta.stats.min;
+                part.max = meta.stats.max;
+                bucket.merge(part);
+            }
+            else
+            {
+                deferred.push_back({std::move(meta), start_time, end_time});
             }
         }
-
-        return total;
     }
 
-    double TimeSeriesDatabase::Impl::avg(
+    // Answers the whole minutes of [start_time, end_time] from the rollup tree
+    // and only the partial minutes at either edge from raw chunks; where the
+    // minutes have expired, the edges widen to whole hours or days. Returns
+    // false when the range does not contain a whole bucket or the metric's
+    // rollups are being rebuilt. The caller holds chunksMutex_ so rollups and
+    // chunks describe the same flushed points.
+    bool TimeSeriesDatabase::Impl::rollupAggregate(
         const std::string &metric, uint64_t start_time, uint64_t end_time,
-        const std::unordered_map<std::string, std::string> & /*tags*/)
+        const std::unordered_map<std::string, std::string> &tags, const SeriesSelection &selection,
+        RollupBucket &bucket, std::vector<DeferredChunk> &deferred)
     {
+        if (staleRollups_.count(metric))
+            return false;
 
-        double total = 0.0;
-        size_t count = 0;
+        uint64_t innerStart = 0;
+        uint64_t innerEnd = 0;
+        if (!rollups_->aggregateWithin(metric, start_time, end_time, tags, bucket, innerStart, innerEnd))
+            return false;
 
-        std::lock_guard<std::mutex> lock(chunksMutex_);
+        if (start_time < innerStart)
+            rawAggregate(metric, start_time, innerStart - 1, selection, bucket, deferred);
+        if (innerEnd <= end_time)
+            rawAggregate(metric, innerEnd, end_time, selection, bucket, deferred);
+
+        return true;
+    }
 
-        // Calculate from active chunk
-        if (activeChunks_.find(metric) != activeChunks_.end())
+    // Aggregates [start_time, end_time] from the rollups and chunks as they
+    // stand under chunksMutex_, then folds in the chunks that must be read
+    // with the lock released
+    RollupBucket TimeSeriesDatabase::Impl::aggregate(
+        const std::string &metric, uint64_t start_time, uint64_t end_time,
+        const std::unordered_map<std::string, std::string> &tags)
+    {
+        SeriesSelection selection = selectSeries(metric, tags);
+        for (;;)
         {
-            auto &chunk = activeChunks_[metric];
-            if (chunk && chunk->size() > 0)
+            RollupBucket bucket;
+            std::vector<DeferredChunk> deferred;
+            uint64_t epoch = 0;
             {
-                auto indices = chunk->queryTimeRange(start_time, end_time);
-                if (!indices.empty())
+                std::lock_guard<std::mutex> lock(chunksMutex_);
+                epoch = directoryEpoch_;
+                if (!rollupAggregate(metric, start_time, end_time, tags, selection, bucket, deferred))
                 {
-                    total += chunk->sum(start_time, end_time);
-                    count += indices.size();
+                    rawAggregate(metric, start_time, end_time, selection, bucket, deferred);
                 }
             }
-        }
 
-        // Calculate from completed chunks
-        if (metricChunks_.find(metric) != metricChunks_.end())
-        {
-            for (auto &chunk : metricChunks_[metric])
+            if (foldDeferred(metric, deferred, epoch, [&](const ColumnarChunk &chunk, const DeferredChunk &entry)
+                             { foldChunk(chunk, entry.start, entry.end, selection, bucket); }))
             {
-                if (chunk)
-                {
-                    auto indices = chunk->queryTimeRange(start_time, end_time);
-                    if (!indices.empty())
-                    {
-                        total += chunk->sum(start_time, end_time);
-                        count += indices.size();
-                    }
-                }
+                return bucket;
             }
         }
-
-        return count > 0 ? total / count : 0.0;
     }
 
-    double TimeSeriesDatabase::Impl::min(
+    bool TimeSeriesDatabase::Impl::rollupWindows(
         const std::string &metric, uint64_t start_time, uint64_t end_time,
-        const std::unordered_map<std::string, std::string> & /*tags*/)
+        uint64_t window_seconds, const std::unordered_map<std::string, std::string> &tags,
+        std::vector<std::pair<uint64_t, RollupBucket>> &windows)
     {
+        const uint64_t minute = ROLLUP_LEVELS[0];
+        if (window_seconds == 0 || window_seconds % minute != 0 || start_time % minute != 0)
+            return false;
 
-        double minVal = std::numeric_limits<double>::max();
-        bool found = false;
-
-        std::lock_guard<std::mutex> lock(chunksMutex_);
-
-        // Check active chunk
-        if (activeChunks_.find(metric) != activeChunks_.end())
+        for (uint64_t windowStart = start_time; windowStart < end_time; windowStart += window_seconds)
         {
-            auto &chunk = activeChunks_[metric];
-            if (chunk && chunk->size() > 0)
-            {
-                auto indices = chunk->queryTimeRange(start_time, end_time);
-                if (!indices.empty())
-                {
-                    double chunkMin = chunk->min(start_time, end_time);
-                    if (chunkMin < minVal)
-                    {
-                        minVal = chunkMin;
-                        found = true;
-                    }
-                }
-            }
-        }
+            uint64_t windowLast = std::min(end_time, windowStart + (window_seconds - 1));
+            if (windowLast < windowStart)
+                windowLast = end_time; // window end overflowed
 
-        // Check completed chunks
-        if (metricChunks_.find(metric) != metricChunks_.end())
-        {
-            for (auto &chunk : metricChunks_[metric])
+            RollupBucket bucket = aggregate(metric, windowStart, windowLast, tags);
+            if (bucket.count > 0)
             {
-                if (chunk)
-                {
-                    auto indices = chunk->queryTimeRange(start_time, end_time);
-                    if (!indices.empty())
-                    {
-                        double chunkMin = chunk->min(start_time, end_time);
-                        if (chunkMin < minVal)
-                        {
-                            minVal = chunkMin;
-                            found = true;
-                        }
-                    }
-                }
+                windows.emplace_back(windowStart, bucket);
             }
+
+            if (windowStart > UINT64_MAX - window_seconds)
+                break;
         }
 
-        return found ? minVal : 0.0;
+        return true;
     }
 
-    double TimeSeriesDatabase::Impl::max(
+    double TimeSeriesDatabase::Impl::sum(
         const std::string &metric, uint64_t start_time, uint64_t end_time,
-        const std::unordered_map<std::string, std::string> & /*tags*/)
+        const std::unordered_map<std::string, std::string> &tags)
     {
+        return aggregate(metric, start_time, end_time, tags).sum;
+    }
 
-        double maxVal = std::numeric_limits<double>::lowest();
-        bool found = false;
-
-        std::lock_guard<std::mutex> lock(chunksMutex_);
-
-        // Check active chunk
-        if (activeChunks_.find(metric) != activeChunks_.end())
-        {
-            auto &chunk = activeChunks_[metric];
-            if (chunk && chunk->size() > 0)
-            {
-                auto indices = chunk->queryTimeRange(start_time, end_time);
-                if (!indices.empty())
-                {
-                    double chunkMax = chunk->max(start_time, end_time);
-                    if (chunkMax > maxVal)
-                    {
-                        maxVal = chunkMax;
-                        found = true;
-                    }
-                }
-            }
-        }
+    double TimeSeriesDatabase::Impl::avg(
+        const std::string &metric, uint64_t start_time, uint64_t end_time,
+        const std::unordered_map<std::string, std::string> &tags)
+    {
+        return aggregate(metric, start_time, end_time, tags).avg();
+    }
 
-        // Check completed chunks
-        if (metricChunks_.find(metric) != metricChunks_.end())
-        {
-            for (auto &chunk : metricChunks_[metric])
-            {
-                if (chunk)
-                {
-                    auto indices = chunk->queryTimeRange(start_time, end_time);
-                    if (!indices.empty())
-                    {
-                        double chunkMax = chunk->max(start_time, end_time);
-                        if (chunkMax > maxVal)
-                        {
-                            maxVal = chunkMax;
-                            found = true;
-                        }
-                    }
-                }
-            }
-        }
+    double TimeSeriesDatabase::Impl::min(
+        const std::string &metric, uint64_t start_time, uint64_t end_time,
+        const std::unordered_map<std::string, std::string> &tags)
+    {
+        RollupBucket bucket = aggregate(metric, start_time, end_time, tags);
+        return bucket.count > 0 ? bucket.min : 0.0;
+    }
 
-        return found ? maxVal : 0.0;
+    double TimeSeriesDatabase::Impl::max(
+        const std::string &metric, uint64_t start_time, uint64_t end_time,
+        const std::unordered_map<std::string, std::string> &tags)
+    {
+        RollupBucket bucket = aggregate(metric, start_time, end_time, tags);
+        return bucket.count > 0 ? bucket.max : 0.0;
     }
 
     std::vector<std::string> TimeSeriesDatabase::Impl::getMetrics()
@@ -725,6 +1611,9 @@ namespace waffledb
 
     void TimeSeriesDatabase::Impl::deleteMetric(const std::string &metric)
     {
+        // Points written before the delete go with it
+        flushWriteBuffer();
+
         // Remove from metrics
         {
             std::lock_guard<std::mutex> lock(metricsMutex_);
@@ -735,34 +1624,30 @@ namespace waffledb
         {
             std::lock_guard<std::mutex> lock(chunksMutex_);
             metricChunks_.erase(metric);
+            ++directoryEpoch_;
             activeChunks_.erase(metric);
+            watermarks_.erase(metric);
+            index_.removeMetric(metric);
+            chunkCache_.erase(metric);
+            rollups_->dropMetric(metric);
+            staleRollups_.erase(metric);
+            uncheckpointed_.erase(metric);
         }
 
         // Remove from disk
         storageManager_->deleteChunks(metric);
 
-        // Save updated metadata
-        saveMetadata();
+        // The log is cut past the metric's points, so none are replayed
+        checkpoint();
     }
 
     void TimeSeriesDatabase::Impl::destroy()
     {
-        // Stop background thread
-        running_ = false;
-
-        if (flushThread_.joinable())
-        {
-            flushThread_.join();
-        }
+        stopCompactor();
+        stopFlusher();
 
-        // Final flush
-        flushWriteBuffer();
-
-        // Save active chunks
-        saveActiveChunks();
-
-        // Save metadata
-        saveMetadata();
+        // Everything buffered or active goes to the chunk files
+        checkpoint();
 
         // Close all files
         queryEngine_.reset();
@@ -773,7 +1658,13 @@ namespace waffledb
         {
             std::lock_guard<std::mutex> lock(chunksMutex_);
             metricChunks_.clear();
+            ++directoryEpoch_;
             activeChunks_.clear();
+            watermarks_.clear();
+            index_.clear();
+            chunkCache_.clear();
+            staleRollups_.clear();
+            uncheckpointed_.clear();
         }
 
         // Wait a bit for Windows to release file handles
@@ -1072,46 +1963,21 @@ namespace waffledb
         // Implementation remains the same as before
     }
 
-    void TimeSeriesDatabase::Impl::saveActiveChunks()
-    {
-        std::lock_guard<std::mutex> lock(chunksMutex_);
-
-        for (auto &[metric, chunk] : activeChunks_)
-        {
-            if (chunk && chunk->size() > 0)
-            {
-                // Save active chunk as the next chunk ID
-                size_t chunkId = 0;
-                if (metricChunks_.find(metric) != metricChunks_.end())
-                {
-                    chunkId = metricChunks_[metric].size();
-                }
-
-                storageManager_->saveChunk(metric, chunkId, *chunk);
-
-                // Move active chunk to completed chunks
-                if (metricChunks_.find(metric) == metricChunks_.end())
-                {
-                    metricChunks_[metric] = std::vector<std::unique_ptr<ColumnarChunk>>();
-                }
-                metricChunks_[metric].push_back(std::move(chunk));
-            }
-        }
-
-        activeChunks_.clear();
-    }
-
-    void TimeSeriesDatabase::Impl::saveMetadata()
+    // Returns false if anything a restart needs failed to save; the rollups
+    // can be rebuilt
+    bool TimeSeriesDatabase::Impl::saveMetadata()
     {
-        std::string metadataPath = dbPath_ + "/metadata.txt";
-        std::ofstream file(metadataPath);
-
-        if (!file)
+        std::lock_guard<std::mutex> saveLock(metadataMutex_);
+        std::error_code ec;
+        if (!fs::is_directory(dbPath_, ec))
         {
             std::cerr << "Failed to save metadata" << std::endl;
-            return;
+            return false;
         }
 
+        bool saved = true;
+        std::ostringstream file;
+
         // Save metrics
         {
             std::lock_guard<std::mutex> lock(metricsMutex_);
@@ -1122,6 +1988,28 @@ namespace waffledb
             }
         }
 
+        // The chunk directory refers to series IDs, so the catalog goes first
+        try
+        {
+            catalog_->save();
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Failed to save series catalog: " << e.what() << std::endl;
+            saved = false;
+        }
+
+        // Most blocks the directory names are synced here, outside
+        // chunksMutex_; saveDirectory only syncs what is written meanwhile
+        try
+        {
+            storageManager_->syncFiles();
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Failed to sync segment files: " << e.what() << std::endl;
+        }
+
         // Save chunk information
         {
             std::lock_guard<std::mutex> lock(chunksMutex_);
@@ -1130,12 +2018,45 @@ namespace waffledb
             {
                 if (!chunks.empty())
                 {
-                    file << metric << ":" << chunks.size() << "\n";
+                    file << metric << ":" << chunks.back().id + 1 << "\n";
                 }
             }
+
+            try
+            {
+                storageManager_->saveDirectory(metricChunks_, walSequence_, uncheckpointed_);
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << "Failed to save chunk directory: " << e.what() << std::endl;
+                saved = false;
+            }
         }
 
-        file.close();
+        // Written without chunksMutex_, so flushes and queries go on; if a
+        // crash leaves them counting other points than the directory, they
+        // are rebuilt from the chunks
+        try
+        {
+            rollups_->save();
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Failed to save rollups: " << e.what() << std::endl;
+        }
+
+        // Written last: a database without it opens empty
+        std::string text = file.str();
+        try
+        {
+            replaceFile(dbPath_ + "/metadata.txt", std::vector<uint8_t>(text.begin(), text.end()), "metadata");
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Failed to save metadata: " << e.what() << std::endl;
+            saved = false;
+        }
+        return saved;
     }
 
     void TimeSeriesDatabase::Impl::loadMetadata()
@@ -1148,6 +2069,9 @@ namespace waffledb
             return; // No metadata file, fresh database
         }
 
+        // Before any chunk is read, so known series keep their IDs
+        catalog_->load();
+
         std::string line;
 
         // Load metrics
@@ -1166,7 +2090,8 @@ namespace waffledb
             }
         }
 
-        // Load chunk information
+        // Load the chunk directory; bodies are read on first query
+        auto directory = storageManager_->loadDirectory(&walSequence_);
         if (std::getline(file, line) && line == "chunks:")
         {
             while (std::getline(file, line))
@@ -1177,24 +2102,125 @@ namespace waffledb
                     std::string metric = line.substr(0, colonPos);
                     size_t chunkCount = std::stoull(line.substr(colonPos + 1));
 
-                    // Load chunks from disk
-                    for (size_t i = 0; i < chunkCount; ++i)
+                    // Compaction leaves gaps in the ids, so a metric the
+                    // directory knows is taken as is; older databases fall
+                    // back to the chunk headers
+                    std::vector<ChunkMeta> entries = std::move(directory[metric]);
+                    if (entries.empty())
                     {
-                        auto chunk = storageManager_->loadChunk(metric, i);
-                        if (chunk)
+                        for (size_t i = 0; i < chunkCount; ++i)
                         {
-                            if (metricChunks_.find(metric) == metricChunks_.end())
+                            ChunkMeta meta;
+                            if (storageManager_->loadChunkMeta(metric, i, meta))
                             {
-                                metricChunks_[metric] = std::vector<std::unique_ptr<ColumnarChunk>>();
+                                entries.push_back(meta);
                             }
-                            metricChunks_[metric].push_back(std::move(chunk));
                         }
                     }
+
+                    if (!entries.empty())
+                    {
+                        for (const auto &meta : entries)
+                        {
+                            index_.addChunk(meta.id, metric, meta.minTimestamp, meta.maxTimestamp);
+                        }
+                        metricChunks_[metric] = std::move(entries);
+                    }
                 }
             }
         }
 
         file.close();
+
+        // Blocks of chunks the directory does not name are garbage
+        storageManager_->retainChunks(metricChunks_);
+
+        rollups_->load();
+        checkRollups();
+    }
+
+    // Rollups are saved after the directory, outside chunksMutex_, so points
+    // flushed in between or a crash leave them describing other points than
+    // the chunks on disk. A metric
+    // whose point count disagrees has its rollups dropped and is answered
+    // from chunk stats until rebuildRollups has read its chunks; nothing is
+    // read here.
+    void TimeSeriesDatabase::Impl::checkRollups()
+    {
+        for (const auto &metric : rollups_->getMetrics())
+        {
+            if (metricChunks_.find(metric) == metricChunks_.end())
+            {
+                rollups_->dropMetric(metric);
+            }
+        }
+
+        for (const auto &[metric, chunks] : metricChunks_)
+        {
+            uint64_t points = 0;
+            for (const auto &meta : chunks)
+            {
+                points += meta.stats.count;
+            }
+
+            if (rollups_->pointCount(metric) == points)
+                continue;
+
+            // Points flushed from here on reach the rollups as usual, so only
+            // the chunks already in the directory are added back
+            rollups_->dropMetric(metric);
+            staleRollups_[metric] = chunks.back().id + 1;
+        }
+    }
+
+    // Adds the chunks of metrics with stale rollups back in ahead of a
+    // compaction pass, under compactMutex_ so their ids stay put. Chunks are read from disk
+    // one at a time outside chunksMutex_; the metric stays stale until its
+    // last chunk is in.
+    void TimeSeriesDatabase::Impl::rebuildRollups()
+    {
+        std::lock_guard<std::mutex> compactLock(compactMutex_);
+
+        std::vector<std::pair<std::string, std::vector<size_t>>> pending;
+        {
+            std::lock_guard<std::mutex> lock(chunksMutex_);
+            for (const auto &[metric, bound] : staleRollups_)
+            {
+                std::vector<size_t> chunkIds;
+                for (const auto &meta : metricChunks_[metric])
+                {
+                    if (meta.id < bound)
+                        chunkIds.push_back(meta.id);
+                }
+                pending.emplace_back(metric, std::move(chunkIds));
+            }
+        }
+
+        for (const auto &[metric, chunkIds] : pending)
+        {
+            for (size_t chunkId : chunkIds)
+            {
+                if (compactorStopping_)
+                    return;
+
+                auto chunk = storageManager_->loadChunk(metric, chunkId);
+
+                std::lock_guard<std::mutex> lock(chunksMutex_);
+                if (!staleRollups_.count(metric))
+                    break; // deleted meanwhile
+                if (!chunk || !findChunk(metric, chunkId))
+                    continue;
+
+                auto columns = chunk->columns();
+                for (size_t i = 0; i < columns.size(); ++i)
+                {
+                    rollups_->add(metric, chunk->tagsAt(i), columns.timestamps()[i], columns.values()[i]);
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(chunksMutex_);
+            staleRollups_.erase(metric);
+        }
     }
 
     // TimeSeriesDatabase public interface implementation
@@ -1218,6 +2244,36 @@ namespace waffledb
         pImpl->writeBatch(points);
     }
 
+    void TimeSeriesDatabase::flush()
+    {
+        pImpl->flush();
+    }
+
+    void TimeSeriesDatabase::sync()
+    {
+        pImpl->sync();
+    }
+
+    void TimeSeriesDatabase::compact()
+    {
+        pImpl->compact();
+    }
+
+    void TimeSeriesDatabase::setRetention(uint64_t seconds)
+    {
+        pImpl->setRetention(seconds);
+    }
+
+    void TimeSeriesDatabase::setRetention(const std::string &metric, uint64_t seconds)
+    {
+        pImpl->setRetention(metric, seconds);
+    }
+
+    void TimeSeriesDatabase::applyRetention()
+    {
+        pImpl->applyRetention();
+    }
+
     std::vector<TimePoint> TimeSeriesDatabase::query(
         const std::string &metric, uint64_t start_time, uint64_t end_time,
         const std::unordered_map<std::string, std::string> &tags)
@@ -1253,6 +2309,49 @@ namespace waffledb
         return pImpl->max(metric, start_time, end_time, tags);
     }
 
+    bool TimeSeriesDatabase::rollupWindows(
+        const std::string &metric, uint64_t start_time, uint64_t end_time,
+        uint64_t window_seconds, const std::unordered_map<std::string, std::string> &tags,
+        std::vector<std::pair<uint64_t, RollupBucket>> &windows)
+    {
+        return pImpl->rollupWindows(metric, start_time, end_time, window_seconds, tags, windows);
+    }
+
+    void TimeSeriesDatabase::setChunkCacheBudget(size_t bytes)
+    {
+        pImpl->setChunkCacheBudget(bytes);
+    }
+
+    ChunkCacheStats TimeSeriesDatabase::chunkCacheStats() const
+    {
+        return pImpl->chunkCacheStats();
+    }
+
+    void TimeSeriesDatabase::setOutOfOrderWindow(uint64_t seconds)
+    {
+        pImpl->setOutOfOrderWindow(seconds);
+    }
+
+    void TimeSeriesDatabase::setWalSyncPolicy(WalSyncPolicy policy, uint64_t interval_ms)
+    {
+        pImpl->setWalSyncPolicy(policy, interval_ms);
+    }
+
+    void TimeSeriesDatabase::setCheckpointThreshold(uint64_t wal_bytes, uint64_t max_age_seconds)
+    {
+        pImpl->setCheckpointThreshold(wal_bytes, max_age_seconds);
+    }
+
+    void TimeSeriesDatabase::setAdaptiveIndexBudget(size_t bytes)
+    {
+        pImpl->setAdaptiveIndexBudget(bytes);
+    }
+
+    AdaptiveIndexStats TimeSeriesDatabase::adaptiveIndexStats() const
+    {
+        return pImpl->adaptiveIndexStats();
+    }
+
     std::vector<std::string> TimeSeriesDatabase::getMetrics()
     {
         return pImpl->getMetrics();
@@ -1,172 +1,274 @@
 // waffledb/src/wal.cpp
 #include "wal.h"
+#include "serialization.h"
 #include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <sstream>
 #include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <algorithm>
 
 namespace fs = std::filesystem;
 
 namespace waffledb
 {
 
-    WriteAheadLog::WriteAheadLog(const std::string &basePath)
-        : logPath_(basePath + "/wal.log")
+    WriteAheadLog::WriteAheadLog(const std::string &basePath, WalSyncPolicy policy,
+                                 std::chrono::milliseconds interval)
+        : basePath_(basePath), logPath_(basePath + "/wal.log")
     {
         // Create directory if it doesn't exist
         fs::create_directories(basePath);
 
-        // Open log file in append mode
-        logFile_.open(logPath_, std::ios::out | std::ios::app | std::ios::binary);
-        if (!logFile_)
+        log_ = AppendFile::open(logPath_);
+        logSize_ = fs::file_size(logPath_);
+        if (logSize_ > 0)
         {
-            throw std::runtime_error("Failed to open WAL file: " + logPath_);
+            idle_ = false;
+            startedAt_ = std::chrono::steady_clock::now();
         }
+        setSyncPolicy(policy, interval);
     }
 
     WriteAheadLog::~WriteAheadLog()
     {
-        if (logFile_.is_open())
+        stopSyncer();
+        try
         {
-            logFile_.flush();
-            logFile_.close();
+            checkpoint();
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "WAL: " << e.what() << std::endl;
         }
     }
 
     void WriteAheadLog::append(const TimePoint &point)
     {
-        std::lock_guard<std::mutex> lock(writeMutex_);
-        writeEntryToFile(point);
+        std::unique_lock<std::mutex> lock(mutex_);
+        checkWritable();
+        appendEntry(point);
+        commit(lock, enqueued_, policy_ == WalSyncPolicy::EveryWrite);
     }
 
     void WriteAheadLog::appendBatch(const std::vector<TimePoint> &points)
     {
-        std::lock_guard<std::mutex> lock(writeMutex_);
-
+        std::unique_lock<std::mutex> lock(mutex_);
+        checkWritable();
         for (const auto &point : points)
         {
-            writeEntryToFile(point);
+            appendEntry(point);
+        }
+        commit(lock, enqueued_, policy_ == WalSyncPolicy::EveryWrite);
+    }
+
+    // Entries appended after a torn group would never be read back
+    void WriteAheadLog::checkWritable() const
+    {
+        if (torn_)
+        {
+            throw std::runtime_error("Failed to write WAL: " + logPath_ + " ends in a torn entry");
         }
     }
 
-    void WriteAheadLog::writeEntryToFile(const TimePoint &point)
+    // Encodes one entry into pending_; the caller holds mutex_, so
+    // sequence numbers follow file order
+    void WriteAheadLog::appendEntry(const TimePoint &point)
     {
-        // Create log entry with proper structure
-        LogEntry entry;
-        entry.sequence = sequenceNumber_.fetch_add(1);
-        entry.timestamp = point.timestamp;
-        entry.value = point.value;
-        entry.metric = point.metric;
-        entry.tags = point.tags;
-
-        // Calculate total size needed
-        size_t totalSize = sizeof(uint32_t) +      // entry size
-                           sizeof(uint64_t) +      // sequence
-                           sizeof(uint64_t) +      // timestamp
-                           sizeof(double) +        // value
-                           sizeof(uint32_t) +      // metric length
-                           entry.metric.length() + // metric data
-                           sizeof(uint32_t);       // tag count
-
-        for (const auto &[key, value] : entry.tags)
+        if (idle_)
         {
-            totalSize += sizeof(uint32_t) + key.length() +  // key length + key data
-                         sizeof(uint32_t) + value.length(); // value length + value data
+            idle_ = false;
+            startedAt_ = std::chrono::steady_clock::now();
         }
+        size_t start = pending_.size();
+
+        // Entry size first, patched below (for validation during recovery)
+        appendPod(pending_, uint32_t{0});
+        appendPod(pending_, sequenceNumber_.fetch_add(1));
+        appendPod(pending_, point.timestamp);
+        appendPod(pending_, point.value);
+        appendString(pending_, point.metric);
 
-        // Create buffer with exact size
-        std::vector<uint8_t> buffer;
-        buffer.reserve(totalSize);
-
-        // Write entry size first (for validation during recovery)
-        uint32_t entrySize = static_cast<uint32_t>(totalSize - sizeof(uint32_t));
-        buffer.insert(buffer.end(),
-                      reinterpret_cast<const uint8_t *>(&entrySize),
-                      reinterpret_cast<const uint8_t *>(&entrySize) + sizeof(uint32_t));
-
-        // Write sequence number
-        buffer.insert(buffer.end(),
-                      reinterpret_cast<const uint8_t *>(&entry.sequence),
-                      reinterpret_cast<const uint8_t *>(&entry.sequence) + sizeof(uint64_t));
-
-        // Write timestamp
-        buffer.insert(buffer.end(),
-                      reinterpret_cast<const uint8_t *>(&entry.timestamp),
-                      reinterpret_cast<const uint8_t *>(&entry.timestamp) + sizeof(uint64_t));
-
-        // Write value
-        buffer.insert(buffer.end(),
-                      reinterpret_cast<const uint8_t *>(&entry.value),
-                      reinterpret_cast<const uint8_t *>(&entry.value) + sizeof(double));
-
-        // Write metric
-        uint32_t metricLen = static_cast<uint32_t>(entry.metric.length());
-        buffer.insert(buffer.end(),
-                      reinterpret_cast<const uint8_t *>(&metricLen),
-                      reinterpret_cast<const uint8_t *>(&metricLen) + sizeof(uint32_t));
-        buffer.insert(buffer.end(),
-                      reinterpret_cast<const uint8_t *>(entry.metric.data()),
-                      reinterpret_cast<const uint8_t *>(entry.metric.data()) + entry.metric.length());
-
-        // Write tags
-        uint32_t tagCount = static_cast<uint32_t>(entry.tags.size());
-        buffer.insert(buffer.end(),
-                      reinterpret_cast<const uint8_t *>(&tagCount),
-                      reinterpret_cast<const uint8_t *>(&tagCount) + sizeof(uint32_t));
-
-        for (const auto &[key, value] : entry.tags)
+        appendPod(pending_, static_cast<uint32_t>(point.tags.size()));
+        for (const auto &[key, value] : point.tags)
         {
-            // Write key
-            uint32_t keyLen = static_cast<uint32_t>(key.length());
-            buffer.insert(buffer.end(),
-                          reinterpret_cast<const uint8_t *>(&keyLen),
-                          reinterpret_cast<const uint8_t *>(&keyLen) + sizeof(uint32_t));
-            buffer.insert(buffer.end(),
-                          reinterpret_cast<const uint8_t *>(key.data()),
-                          reinterpret_cast<const uint8_t *>(key.data()) + key.length());
-
-            // Write value
-            uint32_t valueLen = static_cast<uint32_t>(value.length());
-            buffer.insert(buffer.end(),
-                          reinterpret_cast<const uint8_t *>(&valueLen),
-                          reinterpret_cast<const uint8_t *>(&valueLen) + sizeof(uint32_t));
-            buffer.insert(buffer.end(),
-                          reinterpret_cast<const uint8_t *>(value.data()),
-                          reinterpret_cast<const uint8_t *>(value.data()) + value.length());
+            appendString(pending_, key);
+            appendString(pending_, value);
         }
 
-        // Write to file
-        logFile_.write(reinterpret_cast<const char *>(buffer.data()), buffer.size());
-        logFile_.flush();
+        uint32_t entrySize = static_cast<uint32_t>(pending_.size() - start - sizeof(uint32_t));
+        std::memcpy(pending_.data() + start, &entrySize, sizeof(entrySize));
+        enqueued_ += pending_.size() - start;
     }
 
-    std::vector<TimePoint> WriteAheadLog::recover()
+    // Waits until the first ticket bytes are written, and synced if asked.
+    // A waiter that finds no leader takes the whole buffer as its group and
+    // writes it without the lock, so writers arriving meanwhile gather the
+    // next group.
+    void WriteAheadLog::commit(std::unique_lock<std::mutex> &lock, uint64_t ticket, bool sync)
+    {
+        while ((sync ? synced_ : written_) < ticket)
+        {
+            if (leaderActive_)
+            {
+                committed_.wait(lock);
+                continue;
+            }
+
+            leaderActive_ = true;
+            std::vector<uint8_t> group;
+            group.swap(spare_);
+            group.swap(pending_);
+            bool syncGroup = sync || policy_ == WalSyncPolicy::EveryWrite;
+            uint64_t from = syncGroup ? synced_ : written_;
+            uint64_t to = enqueued_;
+            uint64_t start = logSize_;
+            lock.unlock();
+
+            // A failed group is cut off, whole or torn, so the entries
+            // behind it can still be read back
+            bool ok = log_->write(group.data(), group.size()) && (!syncGroup || log_->sync());
+            int error = ok ? 0 : errno;
+            bool cut = ok || log_->truncate(start);
+
+            lock.lock();
+            written_ = to;
+            if (syncGroup)
+            {
+                synced_ = to;
+            }
+            if (ok)
+            {
+                logSize_ += group.size();
+            }
+            else
+            {
+                failedFrom_ = from;
+                failedTo_ = to;
+                failedErrno_ = error;
+                torn_ = !cut;
+            }
+            group.clear();
+            spare_.swap(group);
+            leaderActive_ = false;
+            committed_.notify_all();
+        }
+
+        if (ticket > failedFrom_ && ticket <= failedTo_)
+        {
+            throw std::runtime_error("Failed to write WAL: " + logPath_ + ": " + std::strerror(failedErrno_));
+        }
+    }
+
+    void WriteAheadLog::setSyncPolicy(WalSyncPolicy policy, std::chrono::milliseconds interval)
+    {
+        stopSyncer();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            policy_ = policy;
+            interval_ = interval;
+            syncStopping_ = false;
+        }
+        if (policy == WalSyncPolicy::Interval)
+        {
+            syncThread_ = std::thread(&WriteAheadLog::syncLoop, this);
+        }
+    }
+
+    // Acts as a leader every interval_ once anything was written unsynced
+    void WriteAheadLog::syncLoop()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!syncSignal_.wait_for(lock, interval_, [this]()
+                                     { return syncStopping_; }))
+        {
+            try
+            {
+                commit(lock, enqueued_, true);
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << "WAL: " << e.what() << std::endl;
+            }
+        }
+    }
+
+    void WriteAheadLog::stopSyncer()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            syncStopping_ = true;
+        }
+        syncSignal_.notify_one();
+
+        if (syncThread_.joinable())
+        {
+            syncThread_.join();
+        }
+    }
+
+    // Logs moved aside, in entry order
+    std::vector<std::pair<uint64_t, std::string>> WriteAheadLog::retiredLogs() const
+    {
+        std::vector<std::pair<uint64_t, std::string>> logs;
+        std::error_code ec;
+        for (const auto &entry : fs::directory_iterator(basePath_, ec))
+        {
+            std::string name = entry.path().filename().string();
+            if (name.size() > 8 && name.compare(0, 4, "wal.") == 0 && name.compare(name.size() - 4, 4, ".log") == 0 &&
+                name.find_first_not_of("0123456789", 4) == name.size() - 4)
+            {
+                logs.emplace_back(std::stoull(name.substr(4, name.size() - 8)), entry.path().string());
+            }
+        }
+        std::sort(logs.begin(), logs.end());
+        return logs;
+    }
+
+    std::vector<TimePoint> WriteAheadLog::recover(uint64_t from)
     {
         std::vector<TimePoint> points;
+        uint64_t next = from;
+        for (const auto &[sequence, path] : retiredLogs())
+        {
+            readLog(path, from, points, next);
+        }
 
-        std::ifstream readFile(logPath_, std::ios::in | std::ios::binary);
-        if (!readFile)
+        // Appends after a torn entry would be unreachable
+        size_t valid = readLog(logPath_, from, points, next);
+        std::error_code ec;
+        uint64_t size = fs::file_size(logPath_, ec);
+        if (!ec && valid < size)
         {
-            return points; // No WAL file, nothing to recover
+            std::cerr << "WAL: Dropping " << size - valid << " bytes of torn entries" << std::endl;
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (log_->truncate(valid))
+            {
+                logSize_ = valid;
+            }
         }
 
-        // Get file size
-        readFile.seekg(0, std::ios::end);
-        size_t fileSize = readFile.tellg();
-        readFile.seekg(0, std::ios::beg);
+        sequenceNumber_.store(std::max(sequenceNumber_.load(), next));
+        return points;
+    }
 
-        if (fileSize == 0)
+    // Appends the entries of one log numbered from on to points, raising
+    // next past every entry read; returns the length of its whole entries
+    size_t WriteAheadLog::readLog(const std::string &path, uint64_t from, std::vector<TimePoint> &points,
+                                  uint64_t &next)
+    {
+        std::ifstream readFile(path, std::ios::in | std::ios::binary);
+        if (!readFile)
         {
-            return points;
+            return 0; // No WAL file, nothing to recover
         }
 
         // Read entire file into buffer for safer parsing
-        std::vector<uint8_t> fileBuffer(fileSize);
-        readFile.read(reinterpret_cast<char *>(fileBuffer.data()), fileSize);
-        readFile.close();
-
+        std::vector<uint8_t> fileBuffer((std::istreambuf_iterator<char>(readFile)), std::istreambuf_iterator<char>());
+        size_t fileSize = fileBuffer.size();
         size_t offset = 0;
-        uint64_t maxSequence = 0;
 
         while (offset < fileSize)
         {
@@ -180,10 +282,9 @@ namespace waffledb
             // Read entry size
             uint32_t entrySize;
             std::memcpy(&entrySize, fileBuffer.data() + offset, sizeof(uint32_t));
-            offset += sizeof(uint32_t);
 
             // Validate entry size
-            if (entrySize == 0 || offset + entrySize > fileSize)
+            if (entrySize == 0 || offset + sizeof(uint32_t) + entrySize > fileSize)
             {
                 std::cerr << "WAL: Invalid entry size " << entrySize << " at offset " << offset << std::endl;
                 break;
@@ -192,9 +293,14 @@ namespace waffledb
             // Read entry data
             try
             {
-                TimePoint point = parseEntry(fileBuffer.data() + offset, entrySize, maxSequence);
-                points.push_back(point);
-                offset += entrySize;
+                uint64_t sequence = 0;
+                TimePoint point = parseEntry(fileBuffer.data() + offset + sizeof(uint32_t), entrySize, sequence);
+                if (sequence >= from)
+                {
+                    points.push_back(std::move(point));
+                }
+                next = std::max(next, sequence + 1);
+                offset += sizeof(uint32_t) + entrySize;
             }
             catch (const std::exception &e)
             {
@@ -203,13 +309,10 @@ namespace waffledb
             }
         }
 
-        // Update sequence number
-        sequenceNumber_.store(maxSequence + 1);
-
-        return points;
+        return offset;
     }
 
-    TimePoint WriteAheadLog::parseEntry(const uint8_t *data, uint32_t entrySize, uint64_t &maxSequence)
+    TimePoint WriteAheadLog::parseEntry(const uint8_t *data, uint32_t entrySize, uint64_t &sequence)
     {
         size_t offset = 0;
         TimePoint point;
@@ -219,10 +322,8 @@ namespace waffledb
         {
             throw std::runtime_error("Entry too small for sequence");
         }
-        uint64_t sequence;
         std::memcpy(&sequence, data + offset, sizeof(uint64_t));
         offset += sizeof(uint64_t);
-        maxSequence = std::max(maxSequence, sequence);
 
         // Read timestamp
         if (offset + sizeof(uint64_t) > entrySize)
@@ -316,26 +417,86 @@ namespace waffledb
 
     void WriteAheadLog::checkpoint()
     {
-        std::lock_guard<std::mutex> lock(writeMutex_);
-        logFile_.flush();
+        std::unique_lock<std::mutex> lock(mutex_);
+        commit(lock, enqueued_, policy_ != WalSyncPolicy::None);
     }
 
-    void WriteAheadLog::clear()
+    uint64_t WriteAheadLog::rotate()
     {
-        std::lock_guard<std::mutex> lock(writeMutex_);
+        // Every entry numbered so far goes to the old log
+        std::unique_lock<std::mutex> lock(mutex_);
+        bool sync = policy_ != WalSyncPolicy::None;
+        while (leaderActive_ || (sync ? synced_ : written_) < enqueued_)
+        {
+            if (leaderActive_)
+                committed_.wait(lock);
+            else
+                commit(lock, enqueued_, sync);
+        }
 
-        // Close current file
-        if (logFile_.is_open())
+        uint64_t sequence = sequenceNumber_.load();
+        std::error_code ec;
+        if (fs::file_size(logPath_, ec) == 0 || ec)
         {
-            logFile_.close();
+            idle_ = true;
+            return sequence; // nothing since the last rotation
         }
 
-        // Delete the file
-        fs::remove(logPath_);
+        // Both names are synced before entries go to the new log
+        fs::rename(logPath_, basePath_ + "/wal." + std::to_string(sequence) + ".log");
+        log_ = AppendFile::open(logPath_, true);
+        logSize_ = 0;
+        torn_ = false;
+        idle_ = true;
+        if (!log_->sync() || !syncDirectory(basePath_))
+        {
+            throw std::runtime_error("Failed to sync WAL: " + logPath_);
+        }
+        return sequence;
+    }
 
-        // Reopen empty file
-        logFile_.open(logPath_, std::ios::out | std::ios::binary);
-        sequenceNumber_.store(0);
+    void WriteAheadLog::release(uint64_t sequence)
+    {
+        std::error_code ec;
+        for (const auto &[first, path] : retiredLogs())
+        {
+            if (first <= sequence)
+            {
+                fs::remove(path, ec);
+            }
+        }
+    }
+
+    void WriteAheadLog::clear()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        committed_.wait(lock, [this]()
+                        { return !leaderActive_; });
+
+        // Entries not yet written are dropped with the rest
+        pending_.clear();
+        written_ = synced_ = enqueued_;
+        committed_.notify_all();
+
+        log_ = AppendFile::open(logPath_, true);
+        logSize_ = 0;
+        torn_ = false;
+        idle_ = true;
+        release(UINT64_MAX);
+    }
+
+    uint64_t WriteAheadLog::size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return logSize_ + pending_.size();
+    }
+
+    std::chrono::steady_clock::duration WriteAheadLog::age() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (idle_)
+            return std::chrono::steady_clock::duration::zero();
+        return std::chrono::steady_clock::now() - startedAt_;
     }
 
-} // namespace waffledb
\ No newline at end of file
+} // namespace waffledb